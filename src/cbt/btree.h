@@ -31,10 +31,26 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "cbt/btree_aggregate.h"
+#include "cbt/btree_boxed.h"
+#include "cbt/btree_buffer.h"
+#include "cbt/btree_filter.h"
+#include "cbt/btree_key_probe.h"
 #include "cbt/btree_node.h"
 #include "cbt/btree_iterator.h"
+#include "cbt/btree_cursor.h"
+#include "cbt/btree_stats.h"
+#include "cbt/btree_parallel.h"
+#include "cbt/btree_frozen.h"
 
 namespace cbt {
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    class _BTreeDiffWalker;
 
   /*! 
    * \class btree
@@ -43,114 +59,2807 @@ namespace cbt {
    * \date 2011
    *
    * A btree with keys of type \b _TpKey, and values of type \b _TpValue.
+   *
+   * Every node counts the entries of its subtree, and the tree keeps its
+   * leftmost and rightmost leaves, so size(), begin(), min() and max() are
+   * O(1). pop_min() and pop_max() take their entry off the cached leaf and
+   * leave the counts of its ancestors behind for a while (see _settle()),
+   * so they cost amortized O(1) and the tree works as a priority queue;
+   * with an \b _Aggregate policy, whose aggregates cannot lag, they cost
+   * O(log n). The subtree counts are what let split_at() and join() work
+   * in O(log n).
+   *
+   * Copies are O(1), but for the buffered writes they take along: nodes
+   * are reference counted and shared between a tree and its clones. Every
+   * node is tagged with the tree that may change it in place; any other
+   * tree copies it (path copying) before changing it, or just takes it
+   * over once it is the only one left referring to it.
+   * Trees that were never cloned keep the tag 0 and copy nothing but the
+   * empty root they all start from, which is shared until the first insert.
+   * Entries reached through iterators, cursors, min() or max() may be
+   * shared with clones, so they are returned as const; upsert() changes a
+   * value.
+   *
+   * With an \b _Aggregate policy (see cbt/btree_aggregate.h), every node
+   * also keeps the aggregate of its subtree, maintained wherever the counts
+   * are, and aggregate(lo, hi) is O(log n).
    */
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order = 1>
+  template<typename _TpKey, typename _TpValue, uint8_t _order = 1,
+    typename _Aggregate = no_aggregate>
     class btree {
       private:
-        typedef _BTreeNode<_TpKey, _TpValue, _order> _Node;
+        typedef _BTreeNode<_TpKey, _TpValue, _order, _Aggregate> _Node;
+
+        friend class _BTreeDiffWalker<_TpKey, _TpValue, _order, _Aggregate>;
+
+      public:
+        typedef _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate> iterator;
+        typedef _BTreeReverseIterator<_TpKey, _TpValue, _order, _Aggregate>
+          reverse_iterator;
+        typedef _BTreeCursor<_TpKey, _TpValue, _order, _Aggregate> cursor;
+        typedef typename _Node::aggregate_type aggregate_type;
 
       public:
-        typedef _BTreeIterator<_TpKey, _TpValue, _order> iterator;
+        /*!
+         * \brief The most levels a tree can have, far more than 2^64 entries need.
+         */
+        static const uint8_t MAX_HEIGHT = 64;
 
       public:
-        btree() : root_(new _Node()) { }
+        btree() : root_(_empty_root()), leftmost_(root_), rightmost_(root_),
+          height_(1), owner_(0), stats_(NULL), buffer_capacity_(0),
+          huge_pages_(false) {
+          pops_[0] = pops_[1] = 0;
+        }
+
+        /*!
+         * \brief Shares every node of other, in O(1), and copies its buffered writes; see clone().
+         */
+        btree(const btree& other)
+          : root_(other.root_), leftmost_(other.leftmost_),
+          rightmost_(other.rightmost_), height_(other.height_),
+          owner_(_next_owner()), stats_(NULL), buffer_(other.buffer_),
+          buffer_capacity_(other.buffer_capacity_),
+          huge_pages_(other.huge_pages_), filter_(other.filter_) {
+          root_->ref();
+          other.owner_ = _next_owner();
+          _copy_lag(other);
+        }
+
+        ~btree() {
+          _end_compaction();
+          _release(root_);
+        }
+
+        btree& operator=(const btree& other) {
+          if (this != &other) {
+            other.root_->ref();
+            _end_compaction();
+            _release(root_);
+
+            root_ = other.root_;
+            leftmost_ = other.leftmost_;
+            rightmost_ = other.rightmost_;
+            height_ = other.height_;
+            owner_ = _next_owner();
+            other.owner_ = _next_owner();
+            _copy_lag(other);
+            buffer_ = other.buffer_;
+            buffer_capacity_ = other.buffer_capacity_;
+            huge_pages_ = other.huge_pages_;
+            filter_ = other.filter_;
+
+            _restat();
+          }
+
+          return *this;
+        }
 
       private:
-        _Node* _get_node_of_key(const _TpKey& key) const;
-        void _insert_into_this_node(_Node* p_node,
+        static uint64_t _next_owner() {
+          static uint64_t last_owner = 0;
+          return __atomic_add_fetch(&last_owner, 1, __ATOMIC_RELAXED);
+        }
+
+        /*!
+         * \brief Returns a new reference to the empty leaf that empty trees share as their root.
+         *
+         * It is tagged as no tree's, so the first change copies it as it
+         * would any shared node: a tree that stays empty allocates nothing.
+         * Its first reference is never dropped, so it is never deleted.
+         */
+        static _Node* _empty_root() {
+          _Node* p_empty = _shared_empty_root();
+          p_empty->ref();
+          return p_empty;
+        }
+
+        static _Node* _shared_empty_root() {
+          static _Node* p_empty = new _Node(_next_owner());
+          return p_empty;
+        }
+
+        _Node* _unshare(_Node* p_node);
+        _Node* _own(_Node* p_parent, const uint8_t& idx);
+        void _own_root();
+        _Node* _own_edge(const bool& right);
+        void _renew_owners(btree* p_other);
+
+        _Node* _get_node_of_key(const _TpKey& key);
+        void _insert_into_this_node(_Node* p_node, const uint8_t& idx,
+            const typename _Node::_TpItem& item,
+            _Node* p_node_next_to_item, const uint8_t& level = 0);
+        void _erase_from_this_node(_Node* p_node, const uint8_t& idx);
+        void _refill(_Node* p_node, uint8_t level);
+        std::pair<_TpKey, _TpValue> _pop(const bool& right);
+
+        /*!
+         * \brief Returns the value of pops_[right] that the count of the edge node at level includes.
+         */
+        const size_t _settled(const bool& right, const uint8_t& level) const {
+          if (level == 0)  // leaves are always exact
+            return pops_[right];
+
+          return (level < settled_[right].size() ? settled_[right][level] : 0);
+        }
+
+        /*!
+         * \brief Returns by how much the count of the edge node at level exceeds its entries.
+         */
+        const size_t _lag(const bool& right, const uint8_t& level) const {
+          return pops_[right] - _settled(right, level);
+        }
+
+        const size_t _count() const {
+          return root_->count() - _lag(false, height_-1) - _lag(true, height_-1);
+        }
+
+        void _copy_lag(const btree& other) {
+          for (int right = 0; right < 2; right++) {
+            pops_[right] = other.pops_[right];
+            settled_[right] = other.settled_[right];
+          }
+        }
+
+        void _clear_lag() {
+          for (int right = 0; right < 2; right++) {
+            pops_[right] = 0;
+            settled_[right].clear();
+          }
+        }
+
+        const bool _on_edge(_Node* p_node, uint8_t level, const bool& right) const;
+        void _relag(_Node* p_node, const uint8_t& level);
+        void _settle();
+        void _add_count_upward(_Node* p_node, const ptrdiff_t& delta);
+        void _reaggregate_upward(_Node* p_node);
+
+        /*!
+         * \brief Tells whether key is below the bound at p_lo (none if NULL), which excludes itself when open.
+         */
+        static const bool _below(const _TpKey& key, const _TpKey* p_lo,
+            const bool& open) {
+          return (p_lo && (open ? !(*p_lo < key) : key < *p_lo));
+        }
+
+        /*!
+         * \brief Tells whether key is above the bound at p_hi, as _below().
+         */
+        static const bool _above(const _TpKey& key, const _TpKey* p_hi,
+            const bool& open) {
+          return (p_hi && (open ? !(key < *p_hi) : *p_hi < key));
+        }
+
+        aggregate_type _aggregate(_Node* p_node, const _TpKey* p_lo,
+            const _TpKey* p_hi, const bool& lo_open,
+            const bool& hi_open) const;
+
+        /*!
+         * \brief Combines the lifted entries it is given into an aggregate.
+         */
+        struct _Lifter {
+          explicit _Lifter(aggregate_type* p_acc) : p_acc_(p_acc) { }
+
+          void operator()(const typename _Node::_TpItem& item) {
+            *p_acc_ = _Aggregate::combine(*p_acc_, _Aggregate::lift(item));
+          }
+
+          aggregate_type* p_acc_;
+        };
+
+        aggregate_type _aggregate_merged(const _TpKey* p_lo,
+            const _TpKey* p_hi) const;
+        const std::pair<_TpKey, _TpValue>& _max_merged() const;
+        void _join3(_Node* p_left, const uint8_t& h_left,
             const typename _Node::_TpItem& item,
-            _Node* p_node_next_to_item);
+            _Node* p_right, const uint8_t& h_right);
+        void _adopt(_Node* p_root, const uint8_t& height);
+
+        /*!
+         * \brief Tells whether the filter, if any, rules key out.
+         */
+        const bool _filtered_out(const _TpKey& key) const {
+          return (filter_.active() && !filter_.may_contain(key));
+        }
+
+        void _filter_in(const _TpKey& key);
+        void _filter_out();
+        void _refilter();
+        void _refilter(_Node* p_node);
+        void _release(_Node* p_node);
+
+        /*!
+         * \brief Where the current compact() pass stands.
+         */
+        struct _Compaction {
+          _Compaction()
+            : p_arena_(NULL), pass_(0), running_(false), has_from_(false) { }
+
+          _BTreeArena* p_arena_;  // the chunk being filled
+          uint64_t pass_;         // the tag of the chunks of this pass
+          bool running_;
+          bool has_from_;         // whether to resume from the subtree after from_
+          _TpKey from_;
+        };
+
+        const bool _compacted(const _Node* p_node) const {
+          return (p_node->arena() &&
+              p_node->arena()->tag() == compaction_.pass_);
+        }
+
+        const bool _compact(_Node* p_parent, const uint8_t& idx,
+            const _TpKey* p_low, const _TpKey* p_from, size_t* p_budget);
+        _Node* _relocate(_Node* p_node, _Node* p_parent, const uint8_t& idx);
+        void _repack(_Node* p_node);
+        void _end_compaction();
+
+        /*!
+         * \brief Returns p_node->lower_index(key), or upper_index(key) when upper.
+         */
+        static const uint8_t _index(const _Node* p_node, const _TpKey& key,
+            const bool& upper) {
+          return (upper ? p_node->upper_index(key) : p_node->lower_index(key));
+        }
+
+        /*!
+         * \brief As above, for a key of another type; see key_probe.
+         */
+        template<typename _TpProbe>
+          static const uint8_t _index(const _Node* p_node,
+              const _TpProbe& key, const bool& upper) {
+            return p_node->probe_index(key, upper);
+          }
+
+        template<typename _TpProbe>
+          iterator _find(const _TpProbe& key);
+        template<typename _TpProbe>
+          iterator _bound(const _TpProbe& key, const bool& upper);
+        template<typename _TpProbe>
+          const int _first_depth(const _TpProbe& key) const;
+        template<typename _TpProbe>
+          _Node* _own_path(const _TpProbe& key, const uint8_t& depth);
+
+        typedef _BTreeBuffer<_TpKey, _TpValue> _Buffer;
+        typedef typename _Buffer::message _Message;
+
+        void _insert(const _TpKey& key, const _TpValue& value);
+        void _insert_sorted(const typename _Node::_TpItem* p_items,
+            const size_t& n);
+        void _store(_Node* p_node,
+            const std::vector<typename _Node::_TpItem>& items,
+            const std::vector<_Node*>& nodes, const uint8_t& level);
+        void _upsert(const _TpKey& key, const _TpValue& value);
+        template<typename _TpProbe>
+          const size_t _erase(const _TpProbe& key);
+        void _buffer(const typename _Message::op& o, const _TpKey& key,
+            const _TpValue& value);
+        const bool _contains(const _TpKey& key) const;
+        void _apply_buffer();
+
+        /*!
+         * \brief Applies the buffered writes, if any; see set_write_buffer().
+         */
+        void _flush() {
+          if (!buffer_.empty())
+            _apply_buffer();
+        }
+        uint8_t _collect_shape(_Node* p_node) const;
+
+        /*!
+         * \brief Collects the shape gauges of the attached stats, if any, from scratch.
+         */
+        void _restat() {
+          if (stats_) {
+            stats_->reset_shape(sizeof(_Node), _Node::MAX_NUM_ITEMS);
+            stats_->set_height(_collect_shape(root_));
+          }
+        }
+
+        static size_t _max_items(const uint8_t& height);
+        _Node* _build(const typename _Node::_TpItem* p_items, const size_t& n,
+            const uint8_t& height, const bool& is_root) const;
+
+        /*!
+         * \brief Sorts one bucket of build_parallel() and builds a subtree from it.
+         *
+         * The highest item of the bucket is kept apart, to be the separator
+         * between this subtree and the next one.
+         */
+        struct _BuildTask {
+          void operator()() {
+            typename _Node::_TpItem* p_items = &(*p_items_)[0];
+            std::sort(p_items + begin_, p_items + end_,
+                _FirstLess<typename _Node::_TpItem>());
+
+            p_root_ = NULL;
+            height_ = 0;
+
+            if (end_ - begin_ > 1) {
+              height_ = 1;
+
+              while (_max_items(height_) < end_ - begin_ - 1)
+                height_++;
+
+              p_root_ = p_tree_->_build(p_items + begin_, end_ - begin_ - 1,
+                  height_, true);
+            }
+          }
+
+          const btree* p_tree_;
+          std::vector<typename _Node::_TpItem>* p_items_;
+          size_t begin_;
+          size_t end_;
+          _Node* p_root_;
+          uint8_t height_;
+        };
+
+        /*!
+         * \brief A unit of parallel work: one item, or a whole subtree.
+         */
+        struct _Piece {
+          _Piece(_Node* p_node, const int& idx, const bool& clipped)
+            : p_node_(p_node), idx_(idx), clipped_(clipped), begin_(0),
+            end_(0) { }
+
+          /*!
+           * \brief Returns the lowest (or, when last, the highest) key of the piece.
+           */
+          const _TpKey& key(const bool& last) const {
+            if (idx_ >= 0)
+              return p_node_->item(idx_).first;
+
+            _Node* p_node = p_node_;
+
+            while (!p_node->is_leaf())
+              p_node = p_node->node(last ? p_node->num_items() : 0);
+
+            return p_node->item(last ? p_node->num_items()-1 : 0).first;
+          }
+
+          _Node* p_node_;  // NULL for buffered writes only
+          int idx_;        // item index, or -1 for the whole subtree
+          bool clipped_;   // whether the subtree may hold keys out of range
+          size_t begin_;   // the buffered writes merged into the piece
+          size_t end_;
+        };
+
+        void _partition(_Node* p_node, const _TpKey* p_lo, const _TpKey* p_hi,
+            const _TpKey* p_node_lo, const _TpKey* p_node_hi,
+            const size_t& grain, std::vector<_Piece>* p_pieces) const;
+        void _share_buffer(const _TpKey* p_lo, const _TpKey* p_hi,
+            std::vector<_Piece>* p_pieces) const;
+
+        template<typename _Fn>
+          static const bool _walk(_Node* p_node, const _TpKey* p_lo,
+              const _TpKey* p_hi, _Fn& fn);
+
+        struct _Appender {
+          explicit _Appender(std::vector<typename _Node::_TpItem>* p_items)
+            : p_items_(p_items) { }
+
+          void operator()(const typename _Node::_TpItem& item) {
+            p_items_->push_back(item);
+          }
+
+          std::vector<typename _Node::_TpItem>* p_items_;
+        };
+
+        template<typename _Fn>
+          struct _PieceTask {
+            _PieceTask(const _Piece& piece, const _Buffer* p_buffer,
+                const _TpKey* p_lo, const _TpKey* p_hi, const _Fn& fn)
+              : piece_(piece), p_buffer_(p_buffer), p_lo_(p_lo), p_hi_(p_hi),
+              fn_(fn) { }
+
+            void operator()() {
+              _BTreeMerger<_TpKey, _TpValue, _Fn> merger(fn_, *p_buffer_,
+                  piece_.begin_, piece_.end_);
+
+              if (!piece_.p_node_)
+                ;
+              else if (piece_.idx_ >= 0)
+                merger(piece_.p_node_->item(piece_.idx_));
+              else if (piece_.clipped_)
+                _walk(piece_.p_node_, p_lo_, p_hi_, merger);
+              else
+                _walk(piece_.p_node_, NULL, NULL, merger);
+
+              merger.finish();
+            }
+
+            _Piece piece_;
+            const _Buffer* p_buffer_;
+            const _TpKey* p_lo_;
+            const _TpKey* p_hi_;
+            _Fn fn_;
+          };
+
+        /*!
+         * \brief Folds the entries of one piece, in key order, for parallel_reduce().
+         */
+        template<typename _Tp, typename _Map, typename _Combine>
+          struct _Reducer {
+            _Reducer(const _Tp& init, _Map map, _Combine combine)
+              : acc_(init), has_value_(false), map_(map), combine_(combine) { }
+
+            void operator()(const std::pair<_TpKey, _TpValue>& item) {
+              if (has_value_) {
+                acc_ = combine_(acc_, map_(item));
+              } else {
+                acc_ = map_(item);
+                has_value_ = true;
+              }
+            }
+
+            _Tp acc_;
+            bool has_value_;
+            _Map map_;
+            _Combine combine_;
+          };
+
+        template<typename _Fn>
+          void _run_pieces(const _TpKey* p_lo, const _TpKey* p_hi,
+              const _Fn& fn, const size_t& threads,
+              std::vector<_PieceTask<_Fn> >* p_tasks) const;
+
+        template<typename _Tp, typename _Map, typename _Combine>
+          _Tp _reduce(const _TpKey* p_lo, const _TpKey* p_hi, const _Tp& init,
+              _Map map, _Combine combine, const size_t& threads) const {
+            typedef _Reducer<_Tp, _Map, _Combine> _Fn;
+            std::vector<_PieceTask<_Fn> > tasks;
+            _run_pieces(p_lo, p_hi, _Fn(init, map, combine), threads, &tasks);
+
+            _Tp result = init;
+
+            for (size_t idx = 0; idx < tasks.size(); idx++) {
+              if (tasks[idx].fn_.has_value_)
+                result = combine(result, tasks[idx].fn_.acc_);
+            }
+
+            return result;
+          }
 
       public:
         iterator begin() {
-          if (!root_->empty()) {
-            _Node* p_node = root_;
+          _flush();
 
-            while (p_node->node(0))
-              p_node = p_node->node(0);
+          if (!root_->empty())
+            return iterator(&root_, leftmost_, 0, false);
+          else
+            return end();
+        }
+        iterator end() { return iterator(&root_); }
 
-            return iterator(p_node);
-          } else {
-            return iterator();
-          }
+        reverse_iterator rbegin() {
+          _flush();
+
+          if (!root_->empty())
+            return reverse_iterator(iterator(&root_, rightmost_,
+                  rightmost_->num_items()-1, true));
+          else
+            return rend();
+        }
+        reverse_iterator rend() { return reverse_iterator(end()); }
+
+        /*!
+         * \brief Returns an unpositioned cursor; see _BTreeCursor.
+         */
+        cursor make_cursor() const {
+          return cursor(&root_, &buffer_);
         }
-        iterator end() { return iterator(); }
+
+        /*!
+         * \brief Returns an iterator to the first entry whose key is not less than key.
+         */
+        iterator lower_bound(const _TpKey& key) { return _bound(key, false); }
+
+        template<typename _TpProbe>
+          typename _BTreeEnableIf<key_probe<_TpKey, _TpProbe>::ENABLED,
+                   iterator>::type lower_bound(const _TpProbe& key) {
+            return _bound(_BTreeProbeView<_TpKey, _TpProbe>::of(key), false);
+          }
+
+        /*!
+         * \brief Returns an iterator to the first entry whose key is greater than key.
+         */
+        iterator upper_bound(const _TpKey& key) { return _bound(key, true); }
+
+        template<typename _TpProbe>
+          typename _BTreeEnableIf<key_probe<_TpKey, _TpProbe>::ENABLED,
+                   iterator>::type upper_bound(const _TpProbe& key) {
+            return _bound(_BTreeProbeView<_TpKey, _TpProbe>::of(key), true);
+          }
+
+        /*!
+         * \brief Calls fn on every entry with key in [lo, hi], in ascending key order.
+         */
+        template<typename _Fn>
+          _Fn scan(const _TpKey& lo, const _TpKey& hi, _Fn fn) {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+
+            for (iterator it = lower_bound(lo); it != end() && !(hi < it->first); ++it)
+              fn(*it);
+
+            return fn;
+          }
+
+        /*!
+         * \brief Calls fn on every entry with key in [lo, hi], in descending key order.
+         */
+        template<typename _Fn>
+          _Fn reverse_scan(const _TpKey& hi, const _TpKey& lo, _Fn fn) {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+            iterator it = upper_bound(hi);
+
+            if (empty() || it == begin())
+              return fn;
+
+            for (--it; it != end() && !(it->first < lo); --it)
+              fn(*it);
+
+            return fn;
+          }
+
+        /*!
+         * \brief Calls copies of fn on every entry from up to threads threads (0: one per processor).
+         *
+         * The tree is cut into subtrees at its upper levels, and the threads
+         * share them out by work stealing; the threads come from a pool that
+         * is created on first use and kept for later calls. Entries are visited in no
+         * particular order and concurrently, so fn must be safe to run on
+         * several threads; the tree must not change meanwhile.
+         */
+        template<typename _Fn>
+          void parallel_for_each(_Fn fn, const size_t& threads = 0) const {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+            std::vector<_PieceTask<_Fn> > tasks;
+            _run_pieces(NULL, NULL, fn, threads, &tasks);
+          }
+
+        /*!
+         * \brief As parallel_for_each(fn, threads), over the entries with key in [lo, hi].
+         */
+        template<typename _Fn>
+          void parallel_for_each(const _TpKey& lo, const _TpKey& hi, _Fn fn,
+              const size_t& threads = 0) const {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+            std::vector<_PieceTask<_Fn> > tasks;
+            _run_pieces(&lo, &hi, fn, threads, &tasks);
+          }
+
+        /*!
+         * \brief Returns init combined with map(entry) of every entry, in key order.
+         *
+         * The work is split as in parallel_for_each(), but the partial results
+         * are combined in key order, so combine needs to be associative only.
+         */
+        template<typename _Tp, typename _Map, typename _Combine>
+          _Tp parallel_reduce(const _Tp& init, _Map map, _Combine combine,
+              const size_t& threads = 0) const {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+            return _reduce(NULL, NULL, init, map, combine, threads);
+          }
+
+        /*!
+         * \brief As parallel_reduce(init, map, combine, threads), over the entries with key in [lo, hi].
+         */
+        template<typename _Tp, typename _Map, typename _Combine>
+          _Tp parallel_reduce(const _TpKey& lo, const _TpKey& hi,
+              const _Tp& init, _Map map, _Combine combine,
+              const size_t& threads = 0) const {
+            _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+            return _reduce(&lo, &hi, init, map, combine, threads);
+          }
+
         iterator find(const _TpKey& key) {
-          _Node* p_node = _get_node_of_key(key);
+          _BTreeOpTimer timer(stats_, btree_stats::FIND);
 
-          uint8_t idx = 0;
+          if (buffer_.has(key))
+            _flush();
 
-          while (idx < p_node->num_items() && p_node->item(idx).first < key)
-            idx++;
+          if (_filtered_out(key))
+            return end();
 
-          if (idx < p_node->num_items() && p_node->item(idx).first == key)
-            return iterator(p_node, idx);
-          else
-            return iterator();
+          _Node* p_node = root_;
+          iterator it = end();
+
+          while (true) {
+            if (_Node::HAS_FINGERPRINTS && p_node->is_leaf()) {
+              int idx = p_node->find(key);
+
+              if (idx < 0)
+                return end();
+
+              it._push(p_node, idx);
+              return it;
+            }
+
+            uint8_t idx = p_node->lower_index(key);
+            it._push(p_node, idx);
+
+            if (idx < p_node->num_items() && p_node->item(idx).first == key)
+              return it;
+            else if (p_node->is_leaf())
+              return end();
+
+            p_node = p_node->node(idx);
+          }
         }
 
+        /*!
+         * \brief As find(const _TpKey&), for a key of another type, without converting it; see key_probe.
+         */
+        template<typename _TpProbe>
+          typename _BTreeEnableIf<key_probe<_TpKey, _TpProbe>::ENABLED,
+                   iterator>::type find(const _TpProbe& key) {
+            _BTreeOpTimer timer(stats_, btree_stats::FIND);
+            _flush();
+            return _find(_BTreeProbeView<_TpKey, _TpProbe>::of(key));
+          }
+
         void insert(const _TpKey& key, const _TpValue& value);
-        const bool empty() const { return root_->empty(); }
+        void upsert(const _TpKey& key, const _TpValue& value);
+
+        template<typename _InputIterator>
+          void insert_batch(_InputIterator first, _InputIterator last);
+        const size_t erase(const _TpKey& key);
+
+        /*!
+         * \brief As erase(const _TpKey&), for a key of another type; see key_probe.
+         *
+         * A buffered erase would need a _TpKey, so this one applies the
+         * write buffer, if any, and removes the entry at once.
+         */
+        template<typename _TpProbe>
+          typename _BTreeEnableIf<key_probe<_TpKey, _TpProbe>::ENABLED,
+                   const size_t>::type erase(const _TpProbe& key) {
+            _BTreeOpTimer timer(stats_, btree_stats::ERASE);
+            _flush();
+            return _erase(_BTreeProbeView<_TpKey, _TpProbe>::of(key));
+          }
+
+        /*!
+         * \brief Turns write buffering on, for up to capacity writes, or off with 0.
+         *
+         * insert(), upsert() and erase() then queue their changes in a
+         * buffer above the root, as in a B-epsilon tree. A full buffer is
+         * applied in one pass in key order, so that consecutive writes share
+         * the nodes of their descent while they are still in cache. find()
+         * looks the key up in the buffer first and only applies the buffer
+         * when the key is there. Const reads never apply the buffer: they
+         * merge it with the tree as they go (see cbt/btree_buffer.h), so
+         * they may still run from several threads at once. Other reads,
+         * such as begin() and the bounds, apply it first.
+         *
+         * upsert() and erase() still look the key up, to tell an update
+         * from an insert and to report whether there was an entry to
+         * remove; the change itself is deferred. Copies take the buffer
+         * along, which makes them O(capacity) instead of O(1).
+         */
+        void set_write_buffer(const size_t& capacity) {
+          buffer_capacity_ = capacity;
+
+          if (buffer_.size() >= capacity)
+            _flush();
+
+          buffer_.reserve(capacity);
+        }
+        const size_t write_buffer() const { return buffer_capacity_; }
+
+        /*!
+         * \brief Applies every buffered write.
+         */
+        void flush() { _flush(); }
+
+        /*!
+         * \brief Returns the aggregate of every entry, in O(1) (O(m log n) with m buffered writes).
+         */
+        aggregate_type aggregate() const {
+          if (buffer_.empty())
+            return root_->aggregate();
+
+          return _aggregate_merged(NULL, NULL);
+        }
+
+        /*!
+         * \brief Returns the aggregate of the entries with key in [lo, hi], in O(log n).
+         *
+         * Each buffered write within [lo, hi] adds O(log n).
+         */
+        aggregate_type aggregate(const _TpKey& lo, const _TpKey& hi) const {
+          if (buffer_.upper(hi) <= buffer_.lower(lo))
+            return _aggregate(root_, &lo, &hi, false, false);
+
+          return _aggregate_merged(&lo, &hi);
+        }
+
+        const bool empty() const { return (size() == 0); }
+        const size_t size() const { return _count() + buffer_.delta(); }
+
+        /*!
+         * \brief Returns a copy of this tree in O(1) (O(m) with m buffered writes).
+         *
+         * Both trees share their nodes until one of them changes; each change
+         * then copies only the nodes on its way. A tree and its clones can be
+         * changed from different threads, but the clone() call itself counts
+         * as a change of this tree.
+         */
+        btree clone() const { return btree(*this); }
+
+        frozen_btree<_TpKey, _TpValue> freeze() const;
+
+        const bool compact(const size_t& max_nodes);
+
+        /*!
+         * \brief Runs compact(max_nodes) without a bound, finishing the pass under way if any.
+         */
+        void compact() { compact(static_cast<size_t>(-1)); }
+
+        /*!
+         * \brief Makes compact() move nodes into 2 MiB chunks meant for huge pages, or into ordinary ones.
+         *
+         * With nodes packed into huge pages, a descent through a large tree
+         * needs far fewer TLB entries; see _BTreeArena. Chunks already
+         * filled are kept as they are until their nodes move again.
+         */
+        void set_huge_pages(const bool& huge_pages) {
+          huge_pages_ = huge_pages;
+        }
+        const bool huge_pages() const { return huge_pages_; }
+
+        /*!
+         * \brief Turns the membership filter on or off; see cbt/btree_filter.h.
+         *
+         * find() and erase() then test the key against the filter before
+         * descending, so that most keys that are not in the tree are found
+         * missing at the cost of one cache miss. The filter is built from
+         * the entries in O(n) and learns every key inserted afterwards. It
+         * is built again, for twice the entries, when the tree outgrows it,
+         * and when the keys erased since it was built reach half the
+         * entries it was sized for. split_at(), join() and build_parallel()
+         * build it again too, which makes them O(n) with a filter. Clones
+         * and assigned trees share the filter until either tree changes.
+         * Keys of other types (see key_probe) are not filtered.
+         *
+         * Throws std::invalid_argument when key_hash<_TpKey> is not
+         * enabled.
+         */
+        void set_filter(const bool& filter) {
+          _flush();
+
+          if (filter)
+            _refilter();
+          else
+            filter_.clear();
+        }
+        const bool filter() const { return filter_.active(); }
+
+        void split_at(const _TpKey& key, btree* p_right);
+        void join(btree* p_right);
+
+        template<typename _InputIterator>
+          void build_parallel(_InputIterator first, _InputIterator last,
+              const size_t& threads);
+
+        /*!
+         * \brief Returns the entry with the lowest key; the tree must not be empty.
+         */
+        const std::pair<_TpKey, _TpValue>& min() const {
+          if (buffer_.empty())
+            return leftmost_->item(0);
+
+          cursor c(&root_, &buffer_);
+          c.first();
+          return *c;
+        }
+
+        /*!
+         * \brief Returns the entry with the highest key; the tree must not be empty.
+         */
+        const std::pair<_TpKey, _TpValue>& max() const {
+          if (buffer_.empty())
+            return rightmost_->item(rightmost_->num_items()-1);
+
+          return _max_merged();
+        }
+
+        std::pair<_TpKey, _TpValue> pop_min() {
+          if (empty())
+            throw std::out_of_range("cbt::btree::pop_min: empty tree");
+
+          return _pop(false);
+        }
+
+        std::pair<_TpKey, _TpValue> pop_max() {
+          if (empty())
+            throw std::out_of_range("cbt::btree::pop_max: empty tree");
+
+          return _pop(true);
+        }
+
+        /*!
+         * \brief Attaches (or, with NULL, detaches) operation statistics.
+         *
+         * The btree_stats object is owned by the caller and must outlive
+         * the tree or be detached first.
+         */
+        void set_stats(btree_stats* p_stats) {
+          _flush();
+          stats_ = p_stats;
+          _restat();
+        }
+        btree_stats* stats() const { return stats_; }
 
       private:
         _Node* root_;
+        _Node* leftmost_;
+        _Node* rightmost_;
+        uint8_t height_;
+        mutable uint64_t owner_;
+        size_t pops_[2];  // from the leftmost [0] and rightmost [1] leaf, see _settle()
+        std::vector<size_t> settled_[2];
+        btree_stats* stats_;
+        _Buffer buffer_;
+        size_t buffer_capacity_;
+        _Compaction compaction_;
+        bool huge_pages_;
+        _BTreeFilter<_TpKey> filter_;
     };
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
-    _BTreeNode<_TpKey, _TpValue, _order>* btree<_TpKey,
-    _TpValue, _order>::_get_node_of_key(const _TpKey& key) const {
-      _Node* p_node = root_;
+  /*!
+   * \brief Returns p_node, or a copy of it if it is shared, owned by this tree.
+   *
+   * A node that no other tree refers to any more is just tagged again.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_unshare(_Node* p_node) {
+      if (p_node->refs() == 1) {
+        p_node->set_owner(owner_);
+        return p_node;
+      }
 
-      while (!p_node->is_leaf()) {
-        uint8_t idx = 0;
+      _Node* p_copy = p_node->copy(owner_);
 
-        while (idx < p_node->num_items()
-            && p_node->item(idx).first < key)
-          idx++;
+      if (leftmost_ == p_node)
+        leftmost_ = p_copy;
+      if (rightmost_ == p_node)
+        rightmost_ = p_copy;
 
-        p_node = p_node->node(idx);
+      _release(p_node);
+
+      return p_copy;
+    }
+
+  /*!
+   * \brief Returns the node at idx of p_parent, which this tree owns, making it owned too.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_own(_Node* p_parent, const uint8_t& idx) {
+      _Node* p_node = p_parent->node(idx);
+
+      if (p_node->owner() != owner_) {
+        p_node = _unshare(p_node);
+        p_node->set_parent(p_parent);
+        p_parent->set_node(idx, p_node);
+      }
+
+      return p_node;
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_own_root() {
+      if (root_->owner() != owner_) {
+        if (stats_ && root_ == _shared_empty_root()) {  // see _collect_shape()
+          stats_->add_nodes(0, 1);
+          stats_->set_height(1);
+        }
+
+        root_ = _unshare(root_);
+        root_->set_parent(NULL);
+      }
+    }
+
+  /*!
+   * \brief Returns the leftmost (or rightmost) leaf, owning the whole path to it.
+   *
+   * The parent of an owned node is owned too, so an owned leaf needs no
+   * descent at all.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_own_edge(const bool& right) {
+      _Node* p_node = (right ? rightmost_ : leftmost_);
+
+      if (p_node->owner() != owner_) {
+        _own_root();
+
+        for (p_node = root_; !p_node->is_leaf(); )
+          p_node = _own(p_node, (right ? p_node->num_items() : 0));
+      }
+
+      return p_node;
+    }
+
+  /*!
+   * \brief Gives fresh tags to both trees before nodes move between them.
+   *
+   * A node tagged by one tree that moves into the other, and later comes
+   * back, would otherwise look owned while its parent is not. Trees tagged
+   * 0 have never shared a node, so they can keep their tag.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_renew_owners(
+        btree* p_other) {
+      if (owner_ || p_other->owner_) {
+        owner_ = _next_owner();
+        p_other->owner_ = _next_owner();
       }
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_get_node_of_key(const _TpKey& key) {
+      _own_root();
+      _Node* p_node = root_;
+
+      while (!p_node->is_leaf())
+        p_node = _own(p_node, p_node->lower_index(key));
 
       return p_node;
     }
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
-    void btree<_TpKey, _TpValue, _order>::_insert_into_this_node(
-        _Node* p_node, const typename _Node::_TpItem& item,
-        _Node* p_node_next_to_item) {
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_insert_into_this_node(
+        _Node* p_node, const uint8_t& idx, const typename _Node::_TpItem& item,
+        _Node* p_node_next_to_item, const uint8_t& level) {
       if (p_node->num_items() < _Node::MAX_NUM_ITEMS) {
-        p_node->insert(item, p_node_next_to_item);
+        p_node->insert_at(idx, item, p_node_next_to_item);
       } else {  // we need to split this node
         typename _Node::_TpItem item_to_rise = item;
-        p_node->get_median_item_rnode(&item_to_rise, &p_node_next_to_item);
+        _Node* p_new_node_right = p_node->split(idx, &item_to_rise,
+            p_node_next_to_item);
+        p_node->recount();
+        p_new_node_right->recount();
 
-        _Node* p_new_node_right = p_node->split(p_node_next_to_item);
+        if (stats_)
+          stats_->add_nodes(level, 1);
+
+        if (rightmost_ == p_node)
+          rightmost_ = p_new_node_right;
 
         if (root_ == p_node) {  // create new root
-          _Node* new_root = new _Node();
+          _Node* new_root = new _Node(owner_);
+
+          if (stats_) {
+            stats_->add_nodes(level+1, 1);
+            stats_->set_height(level+2);
+          }
+
           new_root->insert(item_to_rise);
           new_root->set_node(0, p_node);
           new_root->set_node(1, p_new_node_right);
 
           p_node->set_parent(new_root);
           p_new_node_right->set_parent(new_root);
+          new_root->recount();
           root_ = new_root;
+          height_++;
         } else {  // insert item into parent
           _Node* p_parent = p_node->parent();
           p_new_node_right->set_parent(p_parent);
 
-          _insert_into_this_node(p_parent, item_to_rise,
-              p_new_node_right);
+          _insert_into_this_node(p_parent, p_parent->index_of(p_node),
+              item_to_rise, p_new_node_right, level+1);
         }
       }
     }
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
-    void btree<_TpKey, _TpValue, _order>::insert(const _TpKey& key,
-        const _TpValue& value) {
-      _insert_into_this_node(_get_node_of_key(key),
-          std::make_pair(key, value), NULL);
+  /*!
+   * \brief Removes the item at idx of a leaf, or replaces an inner item by its predecessor.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_erase_from_this_node(
+        _Node* p_node, const uint8_t& idx) {
+      if (p_node->is_leaf()) {
+        p_node->erase(idx);
+      } else {
+        _Node* p_leaf = _own(p_node, idx);
+
+        while (!p_leaf->is_leaf())
+          p_leaf = _own(p_leaf, p_leaf->num_items());
+
+        p_node->set_item(idx, p_leaf->item(p_leaf->num_items()-1));
+        p_leaf->erase(p_leaf->num_items()-1);
+        p_node = p_leaf;
+      }
+
+      _add_count_upward(p_node, -1);
+      _reaggregate_upward(p_node);
+
+      if (stats_)
+        stats_->add_entries(-1);
+
+      _refill(p_node, 0);
+      _filter_out();
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_add_count_upward(
+        _Node* p_node, const ptrdiff_t& delta) {
+      for (; p_node; p_node = p_node->parent())
+        p_node->add_count(delta);
+    }
+
+  /*!
+   * \brief Recomputes the aggregates from p_node up to the root, once its entries changed.
+   *
+   * Unlike counts, aggregates cannot be adjusted by a delta (think of min),
+   * so this runs after the change, in O(order) per level.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_reaggregate_upward(
+        _Node* p_node) {
+      if (!_Node::HAS_AGGREGATE)
+        return;
+
+      for (; p_node; p_node = p_node->parent())
+        p_node->reaggregate();
+    }
+
+  /*!
+   * \brief Returns the aggregate of the entries of the subtree with key between *p_lo and *p_hi.
+   *
+   * A NULL bound leaves that side open-ended; lo_open (hi_open) excludes
+   * the bound itself. A subtree known to be inside on both sides answers
+   * with its own aggregate, so only the two paths to the bounds are
+   * descended.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    typename btree<_TpKey, _TpValue, _order, _Aggregate>::aggregate_type
+    btree<_TpKey, _TpValue, _order, _Aggregate>::_aggregate(_Node* p_node,
+        const _TpKey* p_lo, const _TpKey* p_hi, const bool& lo_open,
+        const bool& hi_open) const {
+      if (!p_lo && !p_hi)
+        return p_node->aggregate();
+
+      aggregate_type acc = _Aggregate::identity();
+
+      for (uint8_t idx = 0; idx <= p_node->num_items(); idx++) {
+        bool has_item = (idx < p_node->num_items());
+
+        if (idx > 0 && _above(p_node->item(idx-1).first, p_hi, hi_open))
+          break;
+
+        if (!p_node->is_leaf()
+            && !(has_item && _below(p_node->item(idx).first, p_lo, lo_open)))
+          acc = _Aggregate::combine(acc, _aggregate(p_node->node(idx),
+                (idx > 0 && !_below(p_node->item(idx-1).first, p_lo, lo_open)
+                 ? NULL : p_lo),
+                (has_item && !_above(p_node->item(idx).first, p_hi, hi_open)
+                 ? NULL : p_hi),
+                lo_open, hi_open));
+
+        if (has_item && !_below(p_node->item(idx).first, p_lo, lo_open)
+            && !_above(p_node->item(idx).first, p_hi, hi_open))
+          acc = _Aggregate::combine(acc, _Aggregate::lift(p_node->item(idx)));
+      }
+
+      return acc;
+    }
+
+  /*!
+   * \brief Returns the aggregate of the entries with key between *p_lo and *p_hi, buffered writes included.
+   *
+   * Between the keys of the buffered writes, the tree answers with
+   * _aggregate(); the entries with those keys are merged with the writes
+   * one by one.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    typename btree<_TpKey, _TpValue, _order, _Aggregate>::aggregate_type
+    btree<_TpKey, _TpValue, _order, _Aggregate>::_aggregate_merged(
+        const _TpKey* p_lo, const _TpKey* p_hi) const {
+      aggregate_type acc = _Aggregate::identity();
+      _Lifter lifter(&acc);
+      cursor entries(&root_);
+      const _TpKey* p_from = p_lo;
+      bool from_open = false;
+      size_t end = (p_hi ? buffer_.upper(*p_hi) : buffer_.size());
+
+      for (size_t idx = (p_lo ? buffer_.lower(*p_lo) : 0); idx < end; ) {
+        const _TpKey& key = buffer_[idx].item_.first;
+        size_t next = buffer_.upper(key);
+
+        acc = _Aggregate::combine(acc,
+            _aggregate(root_, p_from, &key, from_open, true));
+
+        _BTreeMerger<_TpKey, _TpValue, _Lifter> merger(lifter, buffer_, idx,
+            next);
+
+        if (entries.seek(key)) {
+          do {
+            merger(*entries);
+          } while (entries.next() && !(key < entries.key()));
+        }
+
+        merger.finish();
+
+        p_from = &key;
+        from_open = true;
+        idx = next;
+      }
+
+      return _Aggregate::combine(acc,
+          _aggregate(root_, p_from, p_hi, from_open, false));
+    }
+
+  /*!
+   * \brief Returns the entry with the highest key, buffered writes included.
+   *
+   * The tree and the buffer are walked backwards together. A write that
+   * applies to an entry (see cbt/btree_buffer.h) only does so if the entry
+   * is the first of its key.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const std::pair<_TpKey, _TpValue>& btree<_TpKey, _TpValue, _order,
+    _Aggregate>::_max_merged() const {
+      iterator it(&root_);
+      size_t next = buffer_.size();
+
+      if (!root_->empty())
+        it = iterator(&root_, rightmost_, rightmost_->num_items()-1, true);
+
+      while (true) {
+        if (!next)
+          return *it;
+
+        const _Message& m = buffer_[next-1];
+
+        if (it == iterator(&root_)
+            || (m.op_ == _Message::INSERT && !(m.item_.first < it->first)))
+          return m.item_;
+
+        if (m.op_ == _Message::INSERT || m.item_.first < it->first)
+          return *it;
+
+        iterator prev = it;
+
+        if (--prev != iterator(&root_) && !(prev->first < it->first))
+          return *it;  // the write applies to an entry before this one
+        else if (m.op_ == _Message::UPSERT)
+          return m.item_;
+
+        it = prev;  // both erased
+        next--;
+      }
+    }
+
+  /*!
+   * \brief Restores the minimum occupancy of p_node, at level, and its ancestors.
+   *
+   * An underfull node is merged with its left sibling (its right one, if it
+   * is the first child) when both fit in one node, which takes an item from
+   * the parent and may leave it underfull in turn. Otherwise it borrows
+   * items through the parent from that sibling until it is full enough; a
+   * node that was just grafted by join() may be missing several. Merges
+   * always keep the left node, so the leftmost leaf never changes.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_refill(_Node* p_node,
+        uint8_t level) {
+      while (p_node != root_ && p_node->num_items() < _order) {
+        _Node* p_parent = p_node->parent();
+        uint8_t idx = p_parent->index_of(p_node);
+        uint8_t sep = (idx > 0 ? idx-1 : 0);
+        _Node* p_left = _own(p_parent, sep);
+        _Node* p_right = _own(p_parent, sep+1);
+
+        if (p_left->num_items() + 1 + p_right->num_items()
+            > _Node::MAX_NUM_ITEMS) {  // borrow through the parent
+          while (p_left->num_items() < _order) {
+            p_left->push_back(p_parent->item(sep), p_right->node(0));
+            p_parent->set_item(sep, p_right->item(0));
+            p_right->pop_front();
+          }
+
+          while (p_right->num_items() < _order) {
+            uint8_t last = p_left->num_items()-1;
+            p_right->push_front(p_parent->item(sep), p_left->node(last+1));
+            p_parent->set_item(sep, p_left->item(last));
+            p_left->erase(last);
+          }
+
+          p_left->recount();
+          p_right->recount();
+          _relag(p_left, level);
+          _relag(p_right, level);
+          return;
+        }
+
+        p_left->merge(p_parent->item(sep), p_right);
+        p_parent->erase(sep);
+        p_left->recount();
+
+        if (rightmost_ == p_right)
+          rightmost_ = p_left;
+
+        _relag(p_left, level);
+
+        _Node::destroy(p_right);
+
+        if (stats_)
+          stats_->add_nodes(level, -1);
+
+        p_node = p_parent;
+        level++;
+      }
+
+      if (root_->empty() && !root_->is_leaf()) {  // drop the empty root
+        _Node* p_old_root = root_;
+        root_ = _own(root_, 0);
+        root_->set_parent(NULL);
+        _Node::destroy(p_old_root);
+        height_--;
+
+        if (stats_) {
+          stats_->add_nodes(height_, -1);
+          stats_->set_height(height_);
+        }
+      }
+    }
+
+  /*!
+   * \brief Removes the lowest (or highest) entry from the cached leaf, leaving the counts above it to lag.
+   *
+   * Only the leaf and, when it runs short, its nearest ancestors are
+   * touched; the counts of the others still include the entry until
+   * _settle(). A node at level runs short once every O(order^level) pops
+   * or so, which makes the pops amortized O(1).
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    std::pair<_TpKey, _TpValue> btree<_TpKey, _TpValue, _order,
+    _Aggregate>::_pop(const bool& right) {
+      _BTreeOpTimer timer(stats_, btree_stats::ERASE);
+      _flush();
+
+      _Node* p_leaf = _own_edge(right);
+      uint8_t idx = (right ? p_leaf->num_items()-1 : 0);
+      std::pair<_TpKey, _TpValue> item = p_leaf->item(idx);
+
+      if (_Node::HAS_AGGREGATE || p_leaf == root_) {
+        _erase_from_this_node(p_leaf, idx);
+        return item;
+      }
+
+      p_leaf->erase(idx);
+      p_leaf->add_count(-1);
+      pops_[right]++;
+
+      if (stats_)
+        stats_->add_entries(-1);
+
+      _refill(p_leaf, 0);
+      _filter_out();
+      return item;
+    }
+
+  /*!
+   * \brief Tells whether p_node, at level, is an ancestor of the leftmost (or rightmost) leaf.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const bool btree<_TpKey, _TpValue, _order, _Aggregate>::_on_edge(
+        _Node* p_node, uint8_t level, const bool& right) const {
+      for (; level > 0; level--)
+        p_node = p_node->node(right ? p_node->num_items() : 0);
+
+      return (p_node == (right ? rightmost_ : leftmost_));
+    }
+
+  /*!
+   * \brief Records that p_node, at level and just recounted, lags as much as its children do.
+   *
+   * Only a node on an edge can lag, and only through its edge child.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_relag(_Node* p_node,
+        const uint8_t& level) {
+      for (int right = 0; right < 2; right++) {
+        if (level == 0 || !pops_[right] || !_on_edge(p_node, level, right))
+          continue;
+
+        if (settled_[right].size() <= level)
+          settled_[right].resize(level+1, 0);
+
+        settled_[right][level] = _settled(right, level-1);
+      }
+    }
+
+  /*!
+   * \brief Takes the pops that the edge counts still include off them.
+   *
+   * pop_min() and pop_max() only count themselves in pops_; the count of
+   * an edge node at level still includes pops_ minus _settled() of them.
+   * Everything else but those pops needs exact counts, so it settles
+   * first, in O(log n), which the change it makes costs anyway.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_settle() {
+      for (int right = 0; right < 2; right++) {
+        if (!pops_[right])
+          continue;
+
+        _Node* p_node = _own_edge(right);
+
+        for (uint8_t level = 1; (p_node = p_node->parent()); level++)
+          p_node->add_count(-static_cast<ptrdiff_t>(_lag(right, level)));
+
+        pops_[right] = 0;
+        settled_[right].clear();
+      }
+    }
+
+  /*!
+   * \brief Makes p_root, of the given height, the whole content of this tree.
+   *
+   * The leftmost and rightmost leaves are found again along the spines, and
+   * attached stats are recollected, which is the only part of split_at()
+   * and join() that is not O(log n).
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_adopt(_Node* p_root,
+        const uint8_t& height) {
+      root_ = (p_root ? p_root : _empty_root());
+      height_ = (p_root ? height : 1);
+      _clear_lag();
+
+      if (p_root)
+        root_->set_parent(NULL);
+
+      for (leftmost_ = root_; !leftmost_->is_leaf(); )
+        leftmost_ = leftmost_->node(0);
+
+      for (rightmost_ = root_; !rightmost_->is_leaf(); )
+        rightmost_ = rightmost_->node(rightmost_->num_items());
+
+      _restat();
+
+      if (filter_.active())
+        _refilter();
+    }
+
+  /*!
+   * \brief Adds key, just inserted, to the filter if any, or builds it again if the tree outgrew it.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_filter_in(
+        const _TpKey& key) {
+      if (!filter_.active())
+        return;
+
+      if (root_->count() > filter_.capacity())
+        _refilter();
+      else
+        filter_.add(key);
+    }
+
+  /*!
+   * \brief Tells the filter, if any, about a key just erased, building it again once it is too stale.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_filter_out() {
+      if (filter_.active() && filter_.remove())
+        _refilter();
+    }
+
+  /*!
+   * \brief Builds the filter again from every entry, for twice as many.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_refilter() {
+      filter_.reset(_count());
+      _refilter(root_);
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_refilter(
+        _Node* p_node) {
+      for (uint8_t idx = 0; idx < p_node->num_items(); idx++)
+        filter_.add(p_node->item(idx).first);
+
+      if (!p_node->is_leaf()) {
+        for (uint8_t idx = 0; idx <= p_node->num_items(); idx++)
+          _refilter(p_node->node(idx));
+      }
+    }
+
+  /*!
+   * \brief Makes this tree hold p_left, item and p_right, in this key order.
+   *
+   * Both subtrees must be detached (or NULL, when empty), and their roots
+   * may hold fewer than _order items. The shorter subtree is grafted as the
+   * last (or first) child of the node at its height on the taller one's
+   * right (or left) spine, which costs O(|h_left - h_right| + 1).
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_join3(_Node* p_left,
+        const uint8_t& h_left, const typename _Node::_TpItem& item,
+        _Node* p_right, const uint8_t& h_right) {
+      if (p_left && p_left->owner() != owner_)
+        p_left = _unshare(p_left);
+      if (p_right && p_right->owner() != owner_)
+        p_right = _unshare(p_right);
+
+      if (!p_left && !p_right) {
+        root_ = new _Node(owner_);
+        root_->insert(item);
+        root_->recount();
+        height_ = 1;
+      } else if (!p_right || (p_left && h_left > h_right)) {
+        root_ = p_left;
+        height_ = h_left;
+
+        _Node* p_node = p_left;
+
+        for (uint8_t h = h_left; h > h_right+1; h--)
+          p_node = _own(p_node, p_node->num_items());
+
+        if (p_right)
+          p_right->set_parent(p_node);
+
+        _add_count_upward(p_node, 1 + (p_right ? p_right->count() : 0));
+        _insert_into_this_node(p_node, p_node->num_items(), item, p_right,
+            h_right);
+        _reaggregate_upward(p_node);
+
+        if (p_right)
+          _refill(p_right, h_right-1);
+      } else if (!p_left || h_right > h_left) {
+        root_ = p_right;
+        height_ = h_right;
+
+        _Node* p_node = p_right;
+
+        for (uint8_t h = h_right; h > h_left+1; h--)
+          p_node = _own(p_node, 0);
+
+        // item goes first, with p_left as the node to its left
+        _Node* p_first = p_node->node(0);
+        p_node->attach(0, p_left);
+
+        _add_count_upward(p_node, 1 + (p_left ? p_left->count() : 0));
+        _insert_into_this_node(p_node, 0, item, p_first, h_left);
+        _reaggregate_upward(p_node);
+
+        if (p_left)
+          _refill(p_left, h_left-1);
+      } else if (p_left->num_items() + 1 + p_right->num_items()
+          <= _Node::MAX_NUM_ITEMS) {  // same height, one node is enough
+        p_left->merge(item, p_right);
+        p_left->recount();
+        _Node::destroy(p_right);
+
+        root_ = p_left;
+        height_ = h_left;
+      } else {  // same height, under a new root
+        root_ = new _Node(owner_);
+        root_->attach(0, p_left);
+        root_->insert(item, p_right);
+        p_right->set_parent(root_);
+        root_->recount();
+        height_ = h_left+1;
+
+        _refill(p_left, h_left-1);
+        _refill(p_right, h_left-1);
+      }
+    }
+
+  /*!
+   * \brief Moves every entry with key not less than key into p_right, which must be empty.
+   *
+   * The root-to-leaf path of key is cut: at every level, the items and
+   * subtrees on either side of the path become a fragment, and fragments
+   * are joined bottom-up with _join3(). The heights of the fragments grow
+   * along the way, so the costs of the joins telescope to O(log n).
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::split_at(
+        const _TpKey& key, btree* p_right) {
+      _Node* p_left_frags[MAX_HEIGHT];
+      _Node* p_right_frags[MAX_HEIGHT];
+      uint8_t h_left_frags[MAX_HEIGHT];
+      uint8_t h_right_frags[MAX_HEIGHT];
+      typename _Node::_TpItem left_seps[MAX_HEIGHT];
+      typename _Node::_TpItem right_seps[MAX_HEIGHT];
+      bool has_left_sep[MAX_HEIGHT];
+      bool has_right_sep[MAX_HEIGHT];
+
+      p_right->_flush();
+
+      if (!p_right->empty())
+        throw std::invalid_argument("split_at() needs an empty right tree");
+
+      _flush();
+      _settle();
+      _renew_owners(p_right);
+      _own_root();
+
+      _Node* p_node = root_;
+      uint8_t height = height_;
+      uint8_t depth = 0;
+
+      while (!p_node->is_leaf()) {
+        uint8_t idx = p_node->lower_index(key);
+        uint8_t num_items = p_node->num_items();
+
+        p_left_frags[depth] = p_right_frags[depth] = NULL;
+        h_left_frags[depth] = h_right_frags[depth] = 0;
+
+        _Node* p_child = _own(p_node, idx);
+
+        if (idx == 1) {
+          p_left_frags[depth] = _own(p_node, 0);
+          h_left_frags[depth] = height-1;
+        } else if (idx > 1) {
+          _Node* p_frag = new _Node(owner_);
+          p_frag->attach(0, p_node->node(0));
+
+          for (uint8_t i = 0; i+1 < idx; i++)
+            p_frag->push_back(p_node->item(i), p_node->node(i+1));
+
+          p_frag->recount();
+          p_left_frags[depth] = p_frag;
+          h_left_frags[depth] = height;
+        }
+
+        if (idx > 0)
+          left_seps[depth] = p_node->item(idx-1);
+
+        if (idx+1 == num_items) {
+          p_right_frags[depth] = _own(p_node, num_items);
+          h_right_frags[depth] = height-1;
+        } else if (idx+1 < num_items) {
+          _Node* p_frag = new _Node(owner_);
+          p_frag->attach(0, p_node->node(idx+1));
+
+          for (uint8_t i = idx+1; i < num_items; i++)
+            p_frag->push_back(p_node->item(i), p_node->node(i+1));
+
+          p_frag->recount();
+          p_right_frags[depth] = p_frag;
+          h_right_frags[depth] = height;
+        }
+
+        if (idx < num_items)
+          right_seps[depth] = p_node->item(idx);
+
+        has_left_sep[depth] = (idx > 0);
+        has_right_sep[depth] = (idx < num_items);
+
+        if (p_left_frags[depth])
+          p_left_frags[depth]->set_parent(NULL);
+        if (p_right_frags[depth])
+          p_right_frags[depth]->set_parent(NULL);
+
+        p_child->set_parent(NULL);
+
+        _Node::destroy(p_node);
+        p_node = p_child;
+        height--;
+        depth++;
+      }
+
+      // the leaf is cut in two
+      uint8_t idx = p_node->lower_index(key);
+      _Node* p_leaf_right = NULL;
+
+      if (idx < p_node->num_items()) {
+        p_leaf_right = new _Node(owner_);
+
+        for (uint8_t i = idx; i < p_node->num_items(); i++)
+          p_leaf_right->push_back(p_node->item(i), NULL);
+
+        p_leaf_right->recount();
+      }
+
+      while (p_node->num_items() > idx)
+        p_node->erase(p_node->num_items()-1);
+
+      p_node->recount();
+
+      if (p_node->empty()) {
+        _Node::destroy(p_node);
+        p_node = NULL;
+      }
+
+      _Node* p_left_root = p_node;
+      uint8_t h_left = (p_node ? 1 : 0);
+      _Node* p_right_root = p_leaf_right;
+      uint8_t h_right = (p_leaf_right ? 1 : 0);
+
+      btree_stats* p_stats = stats_;
+      btree_stats* p_right_stats = p_right->stats_;
+      stats_ = p_right->stats_ = NULL;
+      _release(p_right->root_);
+
+      while (depth-- > 0) {
+        if (has_left_sep[depth]) {
+          _join3(p_left_frags[depth], h_left_frags[depth], left_seps[depth],
+              p_left_root, h_left);
+          p_left_root = root_;
+          h_left = height_;
+        }
+
+        if (has_right_sep[depth]) {
+          p_right->_join3(p_right_root, h_right, right_seps[depth],
+              p_right_frags[depth], h_right_frags[depth]);
+          p_right_root = p_right->root_;
+          h_right = p_right->height_;
+        }
+      }
+
+      stats_ = p_stats;
+      p_right->stats_ = p_right_stats;
+      _adopt(p_left_root, h_left);
+      p_right->_adopt(p_right_root, h_right);
+    }
+
+  /*!
+   * \brief Appends every entry of p_right, whose keys must all be greater, leaving it empty.
+   *
+   * The lowest entry of p_right becomes the separator of a single _join3(),
+   * so this costs O(log n).
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::join(btree* p_right) {
+      _flush();
+      p_right->_flush();
+
+      if (p_right->empty())
+        return;
+
+      if (!empty() && !(max().first < p_right->min().first))
+        throw std::invalid_argument("join() needs greater keys on the right");
+
+      _settle();
+      p_right->_settle();
+      _renew_owners(p_right);
+
+      btree_stats* p_stats = stats_;
+      btree_stats* p_right_stats = p_right->stats_;
+      stats_ = p_right->stats_ = NULL;
+
+      _Node* p_first_leaf = p_right->_own_edge(false);
+      typename _Node::_TpItem item = p_first_leaf->item(0);
+      p_right->_erase_from_this_node(p_first_leaf, 0);
+
+      _Node* p_left_root = (empty() ? NULL : root_);
+      _Node* p_right_root = (p_right->empty() ? NULL : p_right->root_);
+
+      if (!p_left_root)
+        _release(root_);
+      if (!p_right_root)
+        _release(p_right->root_);
+
+      _join3(p_left_root, (p_left_root ? height_ : 0), item,
+          p_right_root, (p_right_root ? p_right->height_ : 0));
+
+      stats_ = p_stats;
+      p_right->stats_ = p_right_stats;
+      _adopt(root_, height_);
+      p_right->_adopt(NULL, 0);
+    }
+
+  /*!
+   * \brief Returns the most items a subtree of the given height can hold.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    size_t btree<_TpKey, _TpValue, _order, _Aggregate>::_max_items(
+        const uint8_t& height) {
+      size_t max_items = 1;
+
+      for (uint8_t h = 0; h < height; h++) {
+        if (max_items > static_cast<size_t>(-1) / _Node::MAX_NUM_NODES)
+          return static_cast<size_t>(-1);
+
+        max_items *= _Node::MAX_NUM_NODES;
+      }
+
+      return max_items - 1;
+    }
+
+  /*!
+   * \brief Builds a subtree of the given height from n sorted items.
+   *
+   * An inner node gets as few children as the height allows (but at least
+   * _order+1 below the root), and the items are spread evenly over them,
+   * so every node ends up between half full and full.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_build(
+        const typename _Node::_TpItem* p_items, const size_t& n,
+        const uint8_t& height, const bool& is_root) const {
+      _Node* p_node = new _Node(owner_);
+
+      if (height == 1) {
+        for (size_t idx = 0; idx < n; idx++)
+          p_node->push_back(p_items[idx], NULL);
+      } else {
+        size_t max_child_items = _max_items(height-1);
+        size_t num_children = n / (max_child_items+1) + 1;
+
+        if (!is_root && num_children < _order+1u)
+          num_children = _order+1;
+
+        size_t child_items = n - (num_children-1);
+        size_t pos = 0;
+
+        for (size_t c = 0; c < num_children; c++) {
+          size_t size = child_items / num_children
+            + (c < child_items % num_children ? 1 : 0);
+
+          if (c == 0) {
+            p_node->attach(0, _build(p_items, size, height-1, false));
+          } else {
+            const typename _Node::_TpItem& separator = p_items[pos++];
+            p_node->push_back(separator,
+                _build(p_items + pos, size, height-1, false));
+          }
+
+          pos += size;
+        }
+      }
+
+      p_node->recount();
+
+      return p_node;
+    }
+
+  /*!
+   * \brief Replaces the contents of the tree by the entries of [first, last), in any order.
+   *
+   * The entries are distributed over one key range per thread by a
+   * parallel sample sort; each thread then sorts its range and builds a
+   * subtree from it bottom-up, and the subtrees are joined under a common
+   * root. Inputs too small to be worth the threads are built on the
+   * calling thread.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _InputIterator>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::build_parallel(
+        _InputIterator first, _InputIterator last, const size_t& threads) {
+      static const size_t MIN_ITEMS_PER_THREAD = 4096;
+
+      buffer_.clear();
+
+      std::vector<typename _Node::_TpItem> items(first, last);
+      std::vector<typename _Node::_TpItem> sorted;
+      std::vector<size_t> bounds;
+      size_t num_buckets = threads;
+
+      if (num_buckets < 1 || items.size() < num_buckets * MIN_ITEMS_PER_THREAD)
+        num_buckets = 1;
+
+      if (num_buckets > 1) {
+        _parallel_partition(items, &sorted, num_buckets, &bounds);
+      } else {
+        sorted.swap(items);
+        bounds.push_back(0);
+        bounds.push_back(sorted.size());
+      }
+
+      std::vector<_BuildTask> tasks(num_buckets);
+
+      for (size_t b = 0; b < num_buckets; b++) {
+        tasks[b].p_tree_ = this;
+        tasks[b].p_items_ = &sorted;
+        tasks[b].begin_ = bounds[b];
+        tasks[b].end_ = bounds[b+1];
+      }
+
+      if (!sorted.empty())
+        _run_tasks(tasks);
+
+      btree_stats* p_stats = stats_;
+      stats_ = NULL;
+      _release(root_);
+      _clear_lag();
+
+      _Node* p_root = NULL;
+      uint8_t height = 0;
+
+      for (size_t b = 0; b < num_buckets; b++) {
+        if (tasks[b].begin_ == tasks[b].end_)
+          continue;
+
+        if (tasks[b].begin_ > 0) {
+          // the separator is the highest item of the previous bucket
+          _join3(p_root, height, sorted[tasks[b].begin_-1],
+              tasks[b].p_root_, tasks[b].height_);
+          p_root = root_;
+          height = height_;
+        } else {
+          p_root = tasks[b].p_root_;
+          height = tasks[b].height_;
+        }
+      }
+
+      if (!sorted.empty()) {
+        _join3(p_root, height, sorted.back(), NULL, 0);
+        p_root = root_;
+        height = height_;
+      }
+
+      stats_ = p_stats;
+      _adopt(p_root, height);
+    }
+
+  /*!
+   * \brief Cuts the part of the subtree at p_node within [*p_lo, *p_hi] into pieces, in key order.
+   *
+   * Every key of the subtree is known to be within [*p_node_lo, *p_node_hi];
+   * a NULL bound is no bound. Subtrees of at most grain entries become a
+   * single piece; larger ones are cut further, their items becoming pieces
+   * of their own.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_partition(_Node* p_node,
+        const _TpKey* p_lo, const _TpKey* p_hi, const _TpKey* p_node_lo,
+        const _TpKey* p_node_hi, const size_t& grain,
+        std::vector<_Piece>* p_pieces) const {
+      if (p_node->is_leaf() || p_node->count() <= grain) {
+        bool inside = (!p_lo || (p_node_lo && !(*p_node_lo < *p_lo)))
+          && (!p_hi || (p_node_hi && !(*p_hi < *p_node_hi)));
+
+        p_pieces->push_back(_Piece(p_node, -1, !inside));
+        return;
+      }
+
+      for (uint8_t idx = 0; idx <= p_node->num_items(); idx++) {
+        const _TpKey* p_child_lo =
+          (idx > 0 ? &p_node->item(idx-1).first : p_node_lo);
+        const _TpKey* p_child_hi =
+          (idx < p_node->num_items() ? &p_node->item(idx).first : p_node_hi);
+
+        if (p_hi && p_child_lo && *p_hi < *p_child_lo)
+          return;
+
+        if (!(p_lo && p_child_hi && *p_child_hi < *p_lo))
+          _partition(p_node->node(idx), p_lo, p_hi, p_child_lo, p_child_hi,
+              grain, p_pieces);
+
+        if (idx < p_node->num_items() && !(p_lo && *p_child_hi < *p_lo)
+            && !(p_hi && *p_hi < *p_child_hi))
+          p_pieces->push_back(_Piece(p_node, idx, false));
+      }
+    }
+
+  /*!
+   * \brief Hands the buffered writes within [*p_lo, *p_hi] out to the pieces they fall among.
+   *
+   * A write that applies to an entry goes to the first piece that reaches
+   * its key, which holds the first entry of that key; an insert goes to
+   * the last piece that starts at or before its key. Both rules keep the
+   * writes of each piece in one run of the buffer. Writes with no piece
+   * to go to get one of their own.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_share_buffer(
+        const _TpKey* p_lo, const _TpKey* p_hi,
+        std::vector<_Piece>* p_pieces) const {
+      size_t next = (p_lo ? buffer_.lower(*p_lo) : 0);
+      size_t end = (p_hi ? buffer_.upper(*p_hi) : buffer_.size());
+
+      if (next >= end)
+        return;
+
+      if (p_pieces->empty())
+        p_pieces->push_back(_Piece(NULL, -1, false));
+
+      std::vector<_Piece>& pieces = *p_pieces;
+
+      for (size_t idx = 0; idx < pieces.size(); idx++) {
+        bool last = (idx+1 == pieces.size());
+        pieces[idx].begin_ = next;
+
+        for (; next < end; next++) {
+          const _Message& m = buffer_[next];
+
+          if (last)
+            continue;
+          else if (m.op_ == _Message::INSERT
+              ? !(m.item_.first < pieces[idx+1].key(false))
+              : pieces[idx].key(true) < m.item_.first)
+            break;
+        }
+
+        pieces[idx].end_ = next;
+      }
+    }
+
+  /*!
+   * \brief Calls fn on the entries of the subtree within [*p_lo, *p_hi], in key order.
+   *
+   * Returns false once an entry above *p_hi is met.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _Fn>
+    const bool btree<_TpKey, _TpValue, _order, _Aggregate>::_walk(_Node* p_node,
+        const _TpKey* p_lo, const _TpKey* p_hi, _Fn& fn) {
+      for (uint8_t idx = 0; idx <= p_node->num_items(); idx++) {
+        bool has_item = (idx < p_node->num_items());
+
+        if (!p_node->is_leaf()
+            && !(p_lo && has_item && p_node->item(idx).first < *p_lo)
+            && !_walk(p_node->node(idx), p_lo, p_hi, fn))
+          return false;
+
+        if (has_item) {
+          const std::pair<_TpKey, _TpValue>& item = p_node->item(idx);
+
+          if (p_hi && *p_hi < item.first)
+            return false;
+
+          if (!(p_lo && item.first < *p_lo))
+            fn(item);
+        }
+      }
+
+      return true;
+    }
+
+  /*!
+   * \brief Runs fn over the pieces of the tree within the range, on the work-stealing threads.
+   *
+   * There are about PIECES_PER_THREAD pieces per thread, so that stealing
+   * has something to even out, but no fewer than MIN_GRAIN entries each.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _Fn>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_run_pieces(
+        const _TpKey* p_lo, const _TpKey* p_hi, const _Fn& fn,
+        const size_t& threads, std::vector<_PieceTask<_Fn> >* p_tasks) const {
+      static const size_t PIECES_PER_THREAD = 8;
+      static const size_t MIN_GRAIN = 1024;
+
+      size_t num_threads = _num_threads(threads);
+      size_t grain = _count() / (num_threads * PIECES_PER_THREAD);
+
+      if (grain < MIN_GRAIN)
+        grain = MIN_GRAIN;
+
+      std::vector<_Piece> pieces;
+
+      if (!root_->empty())
+        _partition(root_, p_lo, p_hi, NULL, NULL, grain, &pieces);
+
+      _share_buffer(p_lo, p_hi, &pieces);
+
+      for (size_t idx = 0; idx < pieces.size(); idx++)
+        p_tasks->push_back(_PieceTask<_Fn>(pieces[idx], &buffer_, p_lo, p_hi,
+              fn));
+
+      _run_stealing(*p_tasks, num_threads);
+    }
+
+  /*!
+   * \brief Finds an entry with a key of another type; see key_probe.
+   *
+   * The leaves only keep fingerprints of _TpKey, so they are searched
+   * like inner nodes.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _TpProbe>
+    _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate> btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_find(const _TpProbe& key) {
+      _Node* p_node = root_;
+      iterator it = end();
+
+      while (true) {
+        uint8_t idx = p_node->probe_index(key, false);
+        it._push(p_node, idx);
+
+        if (idx < p_node->num_items() && p_node->item(idx).first == key)
+          return it;
+        else if (p_node->is_leaf())
+          return end();
+
+        p_node = p_node->node(idx);
+      }
+    }
+
+  /*!
+   * \brief Finds the first entry with key >= key (or > key, when upper).
+   *
+   * Along the descent, the deepest node holding a qualifying item holds
+   * the smallest one; the path below it is dropped.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _TpProbe>
+    _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate> btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_bound(const _TpProbe& key,
+        const bool& upper) {
+      _flush();
+
+      _Node* p_node = root_;
+      iterator it = end();
+      uint8_t levels = 0;
+
+      while (true) {
+        uint8_t idx = _index(p_node, key, upper);
+        it._push(p_node, idx);
+
+        if (idx < p_node->num_items())
+          levels = it._levels();
+
+        if (p_node->is_leaf()) {
+          it._truncate(levels);
+          return it;
+        }
+
+        p_node = p_node->node(idx);
+      }
+    }
+
+  /*!
+   * \brief Drops one reference to p_node, deleting its subtree if it was the last one.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_release(_Node* p_node) {
+      if (!p_node->unref())
+        return;
+
+      if (!p_node->is_leaf()) {
+        for (uint8_t idx = 0; idx <= p_node->num_items(); idx++)
+          _release(p_node->node(idx));
+      }
+
+      _Node::destroy(p_node);
+    }
+
+  /*!
+   * \brief Accounts every node of the subtree in stats_ and returns its height.
+   *
+   * The empty root shared by empty trees belongs to none of them, so it
+   * counts as no node and no level; the tree accounts for its own copy of
+   * it when it takes one, see _own_root().
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    uint8_t btree<_TpKey, _TpValue, _order, _Aggregate>::_collect_shape(
+        _Node* p_node) const {
+      if (p_node == _shared_empty_root())
+        return 0;
+
+      uint8_t height = 1;
+
+      if (!p_node->is_leaf()) {
+        for (uint8_t idx = 0; idx <= p_node->num_items(); idx++)
+          height = _collect_shape(p_node->node(idx)) + 1;
+      }
+
+      stats_->add_nodes(height-1, 1);
+      stats_->add_entries(p_node->num_items());
+
+      return height;
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::insert(const _TpKey& key,
+        const _TpValue& value) {
+      _BTreeOpTimer timer(stats_, btree_stats::INSERT);
+
+      if (buffer_capacity_)
+        _buffer(_Message::INSERT, key, value);
+      else
+        _insert(key, value);
+    }
+
+  /*!
+   * \brief Sets the value of the first entry with key, inserting one if there is none.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::upsert(const _TpKey& key,
+        const _TpValue& value) {
+      _BTreeOpTimer timer(stats_, btree_stats::INSERT);
+
+      if (!buffer_capacity_) {
+        _upsert(key, value);
+        return;
+      }
+
+      if (buffer_.has(key))
+        _flush();
+
+      _buffer((_contains(key) ? _Message::UPSERT : _Message::INSERT), key,
+          value);
+    }
+
+  /*!
+   * \brief Removes one entry with the given key, returning how many were removed.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const size_t btree<_TpKey, _TpValue, _order, _Aggregate>::erase(
+        const _TpKey& key) {
+      _BTreeOpTimer timer(stats_, btree_stats::ERASE);
+
+      if (!buffer_capacity_)
+        return (_filtered_out(key) ? 0 : _erase(key));
+
+      if (buffer_.has(key))
+        _flush();
+
+      if (!_contains(key))
+        return 0;
+
+      _buffer(_Message::ERASE, key, _TpValue());
+      return 1;
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_insert(
+        const _TpKey& key, const _TpValue& value) {
+      _settle();
+      _Node* p_node = _get_node_of_key(key);
+
+      uint8_t idx = p_node->upper_index(key);
+
+      _add_count_upward(p_node, 1);
+      _insert_into_this_node(p_node, idx, std::make_pair(key, value), NULL);
+      _reaggregate_upward(p_node);
+
+      if (stats_)
+        stats_->add_entries(1);
+
+      _filter_in(key);
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_upsert(
+        const _TpKey& key, const _TpValue& value) {
+      _settle();
+
+      int depth = _first_depth(key);
+      _Node* p_node = _own_path(key, (depth < 0 ? height_-1 : depth));
+      uint8_t idx = p_node->lower_index(key);
+
+      if (depth >= 0) {
+        p_node->item(idx).second = value;
+        _reaggregate_upward(p_node);
+        return;
+      }
+
+      // the leaf insert() would pick
+      _add_count_upward(p_node, 1);
+      _insert_into_this_node(p_node, idx, std::make_pair(key, value), NULL);
+      _reaggregate_upward(p_node);
+
+      if (stats_)
+        stats_->add_entries(1);
+
+      _filter_in(key);
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _TpProbe>
+    const size_t btree<_TpKey, _TpValue, _order, _Aggregate>::_erase(
+        const _TpProbe& key) {
+      int depth = _first_depth(key);
+
+      if (depth < 0)  // copy nothing, not even a shared empty root
+        return 0;
+
+      _settle();
+      _Node* p_node = _own_path(key, depth);
+      _erase_from_this_node(p_node, _index(p_node, key, false));
+      return 1;
+    }
+
+  /*!
+   * \brief Returns the depth of the first entry with key, in key order, or -1 if there is none.
+   *
+   * A descent stops at the first node holding key, but with equal keys
+   * the subtree to its left may hold more of them; the first one is the
+   * deepest the descent meets when it goes on.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _TpProbe>
+    const int btree<_TpKey, _TpValue, _order, _Aggregate>::_first_depth(
+        const _TpProbe& key) const {
+      int depth = -1;
+      _Node* p_node = root_;
+
+      for (int d = 0; ; d++) {
+        uint8_t idx = _index(p_node, key, false);
+
+        if (idx < p_node->num_items() && p_node->item(idx).first == key)
+          depth = d;
+
+        if (p_node->is_leaf())
+          return depth;
+
+        p_node = p_node->node(idx);
+      }
+    }
+
+  /*!
+   * \brief Owns the nodes on the way to key, down to depth, and returns the last one.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _TpProbe>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_own_path(const _TpProbe& key,
+        const uint8_t& depth) {
+      _own_root();
+      _Node* p_node = root_;
+
+      for (uint8_t d = 0; d < depth; d++)
+        p_node = _own(p_node, _index(p_node, key, false));
+
+      return p_node;
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_buffer(
+        const typename _Message::op& o, const _TpKey& key,
+        const _TpValue& value) {
+      buffer_.add(o, key, value);
+
+      if (buffer_.size() >= buffer_capacity_)
+        _apply_buffer();
+    }
+
+  /*!
+   * \brief Tells whether the tree, leaving the buffer aside, has an entry with key.
+   *
+   * This is a lookup only, which a buffered upsert() or erase() needs to
+   * tell what its write will do; the write itself is deferred.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const bool btree<_TpKey, _TpValue, _order, _Aggregate>::_contains(
+        const _TpKey& key) const {
+      if (_filtered_out(key))
+        return false;
+
+      _Node* p_node = root_;
+
+      while (true) {
+        uint8_t idx = p_node->lower_index(key);
+
+        if (idx < p_node->num_items() && p_node->item(idx).first == key)
+          return true;
+        else if (p_node->is_leaf())
+          return false;
+
+        p_node = p_node->node(idx);
+      }
+    }
+
+  /*!
+   * \brief Applies the buffered writes in key order.
+   *
+   * The buffer is kept sorted, with the writes to the same key in the
+   * order they were made. Consecutive inserts are applied by a single
+   * _insert_sorted() sweep.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_apply_buffer() {
+      _Buffer messages;
+      messages.swap(buffer_);
+      buffer_.reserve(buffer_capacity_);
+
+      std::vector<typename _Node::_TpItem> inserts;
+
+      for (size_t idx = 0; idx < messages.size(); idx++) {
+        const typename _Node::_TpItem& item = messages[idx].item_;
+
+        switch (messages[idx].op_) {
+          case _Message::INSERT:  // a run of inserts goes in as one sweep
+            inserts.push_back(item);
+
+            if (idx+1 == messages.size()
+                || messages[idx+1].op_ != _Message::INSERT) {
+              _insert_sorted(&inserts[0], inserts.size());
+              inserts.clear();
+            }
+
+            break;
+          case _Message::UPSERT:
+            _upsert(item.first, item.second);
+            break;
+          case _Message::ERASE:
+            _erase(item.first);
+            break;
+        }
+      }
+    }
+
+  /*!
+   * \brief Inserts the entries of [first, last), sorting them first unless they already are.
+   *
+   * See _insert_sorted(). Entries with equal keys keep their order, after
+   * the entries already in the tree. Attached stats count one insert per
+   * entry, each timed as the mean of the batch.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    template<typename _InputIterator>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::insert_batch(
+        _InputIterator first, _InputIterator last) {
+      std::vector<typename _Node::_TpItem> items(first, last);
+      _BTreeOpTimer timer(stats_, btree_stats::INSERT, items.size());
+      _FirstLess<typename _Node::_TpItem> less;
+
+      for (size_t idx = 1; idx < items.size(); idx++) {
+        if (less(items[idx], items[idx-1])) {
+          std::stable_sort(items.begin(), items.end(), less);
+          break;
+        }
+      }
+
+      _flush();
+
+      if (!items.empty())
+        _insert_sorted(&items[0], items.size());
+    }
+
+  /*!
+   * \brief Inserts n entries sorted by key in one left-to-right sweep.
+   *
+   * Each descent finds a leaf and the separator bounding it on the right;
+   * the entries up to that separator are merged into the leaf at once. A
+   * leaf that overflows is cut into as many nodes as needed in one go, and
+   * so is its parent if the new separators overflow it, and so on.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_insert_sorted(
+        const typename _Node::_TpItem* p_items, const size_t& n) {
+      std::vector<typename _Node::_TpItem> merged;
+      std::vector<_Node*> no_nodes;
+      size_t next = 0;
+
+      _settle();
+
+      while (next < n) {
+        _own_root();
+        _Node* p_node = root_;
+        _TpKey hi;
+        bool has_hi = false;
+
+        while (!p_node->is_leaf()) {  // after the entries with equal keys
+          uint8_t idx = p_node->upper_index(p_items[next].first);
+
+          if (idx < p_node->num_items()) {
+            hi = p_node->item(idx).first;
+            has_hi = true;
+          }
+
+          p_node = _own(p_node, idx);
+        }
+
+        size_t end = next;
+
+        while (end < n && (!has_hi || p_items[end].first < hi))
+          end++;
+
+        merged.resize(p_node->num_items() + (end - next));
+        std::merge(&p_node->item(0), &p_node->item(0) + p_node->num_items(),
+            p_items + next, p_items + end, merged.begin(),
+            _FirstLess<typename _Node::_TpItem>());
+
+        if (stats_)
+          stats_->add_entries(end - next);
+
+        _store(p_node, merged, no_nodes, 0);
+
+        for (p_node = p_node->parent(); p_node; p_node = p_node->parent())
+          p_node->recount();
+
+        next = end;
+      }
+
+      for (size_t idx = 0; idx < n; idx++)
+        _filter_in(p_items[idx].first);
+    }
+
+  /*!
+   * \brief Makes p_node, at level, hold items and nodes (none, for a leaf), splitting it as needed.
+   *
+   * When they do not fit, p_node keeps the first of k even parts, each of
+   * them at least half full, and the separators and the k-1 new nodes are
+   * stored into the parent the same way. A root that splits gets a new
+   * root above it. Every node stored to is recounted; the ancestors above
+   * the last split are left to the caller.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_store(_Node* p_node,
+        const std::vector<typename _Node::_TpItem>& items,
+        const std::vector<_Node*>& nodes, const uint8_t& level) {
+      size_t m = items.size();
+
+      if (m <= _Node::MAX_NUM_ITEMS) {
+        p_node->assign(&items[0], m, nodes.empty() ? NULL : &nodes[0]);
+        p_node->recount();
+        return;
+      }
+
+      size_t k = (m + _Node::MAX_NUM_ITEMS + 1) / (_Node::MAX_NUM_ITEMS + 1);
+      size_t per_node = (m - (k-1)) / k, extra = (m - (k-1)) % k;
+      std::vector<typename _Node::_TpItem> separators;
+      std::vector<_Node*> new_nodes;
+      size_t pos = 0;
+
+      for (size_t c = 0; c < k; c++) {
+        size_t size = per_node + (c < extra ? 1 : 0);
+        _Node* p_part = (c == 0 ? p_node : new _Node(owner_));
+
+        p_part->assign(&items[pos], size, nodes.empty() ? NULL : &nodes[pos]);
+        p_part->recount();
+        pos += size;
+
+        if (c > 0)
+          new_nodes.push_back(p_part);
+
+        if (c+1 < k)
+          separators.push_back(items[pos++]);
+      }
+
+      if (stats_)
+        stats_->add_nodes(level, k-1);
+
+      if (rightmost_ == p_node)
+        rightmost_ = new_nodes.back();
+
+      std::vector<typename _Node::_TpItem> parent_items;
+      std::vector<_Node*> parent_nodes;
+      _Node* p_parent = p_node->parent();
+
+      if (p_parent) {
+        uint8_t idx = p_parent->index_of(p_node);
+
+        for (uint8_t i = 0; i < p_parent->num_items(); i++) {
+          if (i == idx)
+            parent_items.insert(parent_items.end(), separators.begin(),
+                separators.end());
+
+          parent_items.push_back(p_parent->item(i));
+        }
+
+        if (idx == p_parent->num_items())
+          parent_items.insert(parent_items.end(), separators.begin(),
+              separators.end());
+
+        for (uint8_t i = 0; i <= p_parent->num_items(); i++) {
+          parent_nodes.push_back(p_parent->node(i));
+
+          if (i == idx)
+            parent_nodes.insert(parent_nodes.end(), new_nodes.begin(),
+                new_nodes.end());
+        }
+      } else {  // create new root
+        p_parent = root_ = new _Node(owner_);
+        height_++;
+
+        if (stats_) {
+          stats_->add_nodes(level+1, 1);
+          stats_->set_height(level+2);
+        }
+
+        parent_items = separators;
+        parent_nodes.push_back(p_node);
+        parent_nodes.insert(parent_nodes.end(), new_nodes.begin(),
+            new_nodes.end());
+      }
+
+      _store(p_parent, parent_items, parent_nodes, level+1);
+    }
+
+  /*!
+   * \brief Returns an immutable snapshot of the entries, laid out for fast lookups; see frozen_btree.
+   *
+   * The tree itself is left as it was. Later changes to either do not
+   * show in the other.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    frozen_btree<_TpKey, _TpValue> btree<_TpKey, _TpValue, _order,
+    _Aggregate>::freeze() const {
+      _BTreeOpTimer timer(stats_, btree_stats::SCAN);
+      std::vector<typename _Node::_TpItem> items;
+      _Appender appender(&items);
+      _BTreeMerger<_TpKey, _TpValue, _Appender> merger(appender, buffer_, 0,
+          buffer_.size());
+
+      items.reserve(size());
+      _walk(root_, NULL, NULL, merger);
+      merger.finish();
+
+      return frozen_btree<_TpKey, _TpValue>(items);
+    }
+
+  /*!
+   * \brief Moves up to max_nodes nodes into contiguous chunks; returns true when a pass is over.
+   *
+   * Nodes allocated one by one end up scattered over the heap, and a scan
+   * then misses the cache and the TLB on almost every node. A pass visits
+   * the tree depth-first, parents before children, and moves every node
+   * into the next slot of a _BTreeArena chunk, so that each subtree ends
+   * up in one run of memory in key order. Before its leaves are moved, a
+   * parent of leaves spreads their entries over as few leaves as the node
+   * occupancy rules allow, and frees the others; entries never move
+   * between leaves of different parents, so a parent that is itself at
+   * its minimum keeps all of its leaves.
+   *
+   * A pass may be spread over several calls, each moving at most max_nodes
+   * nodes, for instance from idle time. The tree may change in between: a
+   * call resumes after the last subtree it finished, by key, and nodes
+   * created meanwhile behind that point wait for the next pass. The first
+   * call after a pass is over starts a new one. Nodes shared with clones
+   * are left where they are.
+   *
+   * Every iterator and cursor is invalidated.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const bool btree<_TpKey, _TpValue, _order, _Aggregate>::compact(
+        const size_t& max_nodes) {
+      _flush();
+      _settle();
+
+      if (!compaction_.running_) {
+        compaction_.pass_ = _next_owner();  // any tag not used before will do
+        compaction_.running_ = true;
+        compaction_.has_from_ = false;
+      }
+
+      size_t budget = max_nodes;
+      _TpKey from = compaction_.from_;
+
+      if (!_compact(NULL, 0, NULL, compaction_.has_from_ ? &from : NULL,
+            &budget))
+        return false;
+
+      _end_compaction();
+      return true;
+    }
+
+  /*!
+   * \brief Compacts the subtree at idx of p_parent (the root if NULL), returning false when out of budget.
+   *
+   * p_low is the separator just before the subtree, NULL at the left edge,
+   * and is what the pass resumes from when it stops before the subtree.
+   * p_from, when not NULL, skips the children before the one holding it.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    const bool btree<_TpKey, _TpValue, _order, _Aggregate>::_compact(
+        _Node* p_parent, const uint8_t& idx, const _TpKey* p_low,
+        const _TpKey* p_from, size_t* p_budget) {
+      _Node* p_node = (p_parent ? p_parent->node(idx) : root_);
+
+      if (p_node->owner() != owner_)
+        return true;
+
+      if (!_compacted(p_node)) {
+        if (*p_budget == 0) {
+          compaction_.has_from_ = (p_low != NULL);
+
+          if (p_low)
+            compaction_.from_ = *p_low;
+
+          return false;
+        }
+
+        if (!p_node->is_leaf() && p_node->node(0)->is_leaf())
+          _repack(p_node);
+
+        p_node = _relocate(p_node, p_parent, idx);
+        (*p_budget)--;
+      }
+
+      if (p_node->is_leaf())
+        return true;
+
+      uint8_t first = (p_from ? p_node->upper_index(*p_from) : 0);
+
+      for (uint8_t i = first; i <= p_node->num_items(); i++) {
+        if (!_compact(p_node, i, (i > 0 ? &p_node->item(i-1).first : p_low),
+              (i == first ? p_from : NULL), p_budget))
+          return false;
+      }
+
+      return true;
+    }
+
+  /*!
+   * \brief Replaces p_node, at idx of p_parent (the root if NULL), by a copy in the current chunk.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    _BTreeNode<_TpKey, _TpValue, _order, _Aggregate>* btree<_TpKey,
+    _TpValue, _order, _Aggregate>::_relocate(_Node* p_node, _Node* p_parent,
+        const uint8_t& idx) {
+      _BTreeArena*& p_arena = compaction_.p_arena_;
+
+      if (!p_arena || p_arena->full()) {
+        if (p_arena)
+          p_arena->close();
+
+        p_arena = new _BTreeArena(sizeof(_Node), compaction_.pass_,
+            huge_pages_);
+      }
+
+      _Node* p_copy = p_node->relocate(p_arena);
+
+      if (p_parent)
+        p_parent->set_node(idx, p_copy);
+      else
+        root_ = p_copy;
+
+      if (!p_copy->is_leaf()) {
+        for (uint8_t i = 0; i <= p_copy->num_items(); i++)
+          p_copy->attach(i, p_copy->node(i));
+      }
+
+      if (leftmost_ == p_node)
+        leftmost_ = p_copy;
+      if (rightmost_ == p_node)
+        rightmost_ = p_copy;
+
+      _Node::destroy(p_node);
+
+      return p_copy;
+    }
+
+  /*!
+   * \brief Spreads the entries of the leaves of p_node over as few of them as possible.
+   *
+   * The leaves are filled evenly, keeping at least _order+1 of them (two
+   * at the root) so that p_node keeps enough items. Leaves shared with
+   * clones are not touched.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_repack(_Node* p_node) {
+      uint8_t m = p_node->num_items();
+      std::vector<typename _Node::_TpItem> items;
+
+      for (uint8_t i = 0; i <= m; i++) {
+        _Node* p_leaf = p_node->node(i);
+
+        if (p_leaf->owner() != owner_)
+          return;
+
+        for (uint8_t j = 0; j < p_leaf->num_items(); j++)
+          items.push_back(p_leaf->item(j));
+
+        if (i < m)
+          items.push_back(p_node->item(i));
+      }
+
+      size_t total = items.size();
+      size_t k = (total + _Node::MAX_NUM_ITEMS + 1) / (_Node::MAX_NUM_ITEMS + 1);
+      size_t min_k = (p_node == root_ ? 2 : _order + 1);
+
+      if (k < min_k)
+        k = min_k;
+
+      if (k >= m + 1u)
+        return;
+
+      size_t per_leaf = (total - (k-1)) / k, extra = (total - (k-1)) % k;
+      std::vector<typename _Node::_TpItem> separators;
+      std::vector<_Node*> leaves;
+      size_t pos = 0;
+
+      for (size_t c = 0; c < k; c++) {
+        size_t size = per_leaf + (c < extra ? 1 : 0);
+        _Node* p_leaf = p_node->node(c);
+
+        p_leaf->assign(&items[pos], size, NULL);
+        p_leaf->recount();
+        leaves.push_back(p_leaf);
+        pos += size;
+
+        if (c+1 < k)
+          separators.push_back(items[pos++]);
+      }
+
+      if (rightmost_ == p_node->node(m))
+        rightmost_ = leaves.back();
+
+      for (size_t c = k; c <= m; c++)
+        _Node::destroy(p_node->node(c));
+
+      p_node->assign(&separators[0], k-1, &leaves[0]);
+      p_node->recount();
+
+      if (stats_)
+        stats_->add_nodes(0, -static_cast<int64_t>(m + 1 - k));
+    }
+
+  /*!
+   * \brief Ends the compact() pass under way, if any, closing its chunk.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void btree<_TpKey, _TpValue, _order, _Aggregate>::_end_compaction() {
+      if (compaction_.p_arena_)
+        compaction_.p_arena_->close();
+
+      compaction_.p_arena_ = NULL;
+      compaction_.running_ = false;
     }
 }
 
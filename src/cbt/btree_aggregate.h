@@ -0,0 +1,165 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_aggregate.h
+ * \brief Contains the aggregate policies a btree can keep per subtree.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * An aggregate policy is a monoid over the entries of the tree. It
+ * provides value_type, identity(), an associative combine(a, b), and
+ * lift(entry), which maps an entry to value_type. Every node keeps the
+ * combination, in key order, of the lifted entries of its subtree, so
+ * btree::aggregate(lo, hi) is O(log n). combine() need not be
+ * commutative.
+ */
+
+#ifndef CBTL_CBT_BTREE_AGGREGATE_H_
+#define CBTL_CBT_BTREE_AGGREGATE_H_
+
+#include <stdint.h>
+#include <limits>
+#include <utility>
+
+namespace cbt {
+  /*!
+   * \brief The default aggregate policy: nodes keep nothing, at no cost.
+   */
+  struct no_aggregate { };
+
+  /*!
+   * \brief Sum of the values, as _Tp.
+   */
+  template<typename _Tp>
+    struct sum_aggregate {
+      typedef _Tp value_type;
+
+      static value_type identity() { return _Tp(); }
+
+      static value_type combine(const value_type& a, const value_type& b) {
+        return a + b;
+      }
+
+      template<typename _TpKey, typename _TpValue>
+        static value_type lift(const std::pair<_TpKey, _TpValue>& item) {
+          return item.second;
+        }
+    };
+
+  /*!
+   * \brief Lowest value, as _Tp; the identity is the highest _Tp.
+   */
+  template<typename _Tp>
+    struct min_aggregate {
+      typedef _Tp value_type;
+
+      static value_type identity() { return std::numeric_limits<_Tp>::max(); }
+
+      static value_type combine(const value_type& a, const value_type& b) {
+        return (b < a ? b : a);
+      }
+
+      template<typename _TpKey, typename _TpValue>
+        static value_type lift(const std::pair<_TpKey, _TpValue>& item) {
+          return item.second;
+        }
+    };
+
+  /*!
+   * \brief Highest value, as _Tp; the identity is the lowest _Tp.
+   */
+  template<typename _Tp>
+    struct max_aggregate {
+      typedef _Tp value_type;
+
+      static value_type identity() {
+        return (std::numeric_limits<_Tp>::is_integer
+            ? std::numeric_limits<_Tp>::min()
+            : -std::numeric_limits<_Tp>::max());
+      }
+
+      static value_type combine(const value_type& a, const value_type& b) {
+        return (a < b ? b : a);
+      }
+
+      template<typename _TpKey, typename _TpValue>
+        static value_type lift(const std::pair<_TpKey, _TpValue>& item) {
+          return item.second;
+        }
+    };
+
+  /*!
+   * \class _BTreeAggregateSlot
+   * \brief The aggregate a _BTreeNode keeps of its subtree, as a base class.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * The no_aggregate specialization is empty, so that nodes of trees
+   * without an aggregate do not grow.
+   */
+
+  template<typename _Aggregate>
+    class _BTreeAggregateSlot {
+      public:
+        static const bool HAS_AGGREGATE = true;
+        typedef typename _Aggregate::value_type aggregate_type;
+
+      public:
+        _BTreeAggregateSlot() : aggregate_(_Aggregate::identity()) { }
+
+      public:
+        const aggregate_type& aggregate() const { return aggregate_; }
+
+      protected:
+        template<typename _Node>
+          void _reaggregate(_Node& node) {
+            aggregate_type acc = _Aggregate::identity();
+
+            for (uint8_t idx = 0; idx <= node.num_items(); idx++) {
+              if (!node.is_leaf())
+                acc = _Aggregate::combine(acc, node.node(idx)->aggregate());
+
+              if (idx < node.num_items())
+                acc = _Aggregate::combine(acc,
+                    _Aggregate::lift(node.item(idx)));
+            }
+
+            aggregate_ = acc;
+          }
+
+      private:
+        aggregate_type aggregate_;
+    };
+
+  template<>
+    class _BTreeAggregateSlot<no_aggregate> {
+      public:
+        static const bool HAS_AGGREGATE = false;
+        typedef void aggregate_type;
+
+      protected:
+        template<typename _Node>
+          void _reaggregate(_Node& node) { }
+    };
+}
+
+#endif  // CBTL_CBT_BTREE_AGGREGATE_H_
@@ -0,0 +1,414 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_algorithm.h
+ * \brief Contains sorted set operations and diff over two btrees.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * The set operations walk both trees with cursors. Whenever one tree is
+ * behind, it seeks to the other's key instead of stepping, and the cursor
+ * skips every subtree that lies entirely in between. The work is therefore
+ * proportional to the output (and to the number of alternations between
+ * the trees), not to the size of the inputs. Keys are assumed unique.
+ */
+
+#ifndef CBTL_CBT_BTREE_ALGORITHM_H_
+#define CBTL_CBT_BTREE_ALGORITHM_H_
+
+#include <vector>
+
+#include "cbt/btree.h"
+
+namespace cbt {
+  /*!
+   * \brief Calls fn(item_a, item_b) for every key present in both trees, in key order.
+   */
+  template<typename _TpKey, typename _TpValueA, uint8_t _orderA,
+    typename _AggregateA, typename _TpValueB, uint8_t _orderB,
+    typename _AggregateB, typename _Fn>
+    _Fn merge_join(const btree<_TpKey, _TpValueA, _orderA, _AggregateA>& a,
+        const btree<_TpKey, _TpValueB, _orderB, _AggregateB>& b, _Fn fn) {
+      typename btree<_TpKey, _TpValueA, _orderA, _AggregateA>::cursor ca =
+        a.make_cursor();
+      typename btree<_TpKey, _TpValueB, _orderB, _AggregateB>::cursor cb =
+        b.make_cursor();
+
+      if (!ca.first())
+        return fn;
+
+      cb.seek(ca.key());
+
+      while (ca.valid() && cb.valid()) {
+        if (ca.key() < cb.key()) {
+          ca.seek(cb.key());
+        } else if (cb.key() < ca.key()) {
+          cb.seek(ca.key());
+        } else {
+          fn(*ca, *cb);
+          ca.next();
+        }
+      }
+
+      return fn;
+    }
+
+  template<typename _TpKey, typename _TpValue, typename _Fn>
+    struct _FirstOfJoin {
+      explicit _FirstOfJoin(_Fn fn) : fn_(fn) { }
+
+      template<typename _TpItemB>
+        void operator()(const std::pair<_TpKey, _TpValue>& item,
+            const _TpItemB& item_b) {
+          fn_(item);
+        }
+
+      _Fn fn_;
+    };
+
+  /*!
+   * \brief Calls fn on the entries of a whose keys are also in b, in key order.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _orderA,
+    typename _AggregateA, typename _TpValueB, uint8_t _orderB,
+    typename _AggregateB, typename _Fn>
+    _Fn intersect(const btree<_TpKey, _TpValue, _orderA, _AggregateA>& a,
+        const btree<_TpKey, _TpValueB, _orderB, _AggregateB>& b, _Fn fn) {
+      return merge_join(a, b, _FirstOfJoin<_TpKey, _TpValue, _Fn>(fn)).fn_;
+    }
+
+  /*!
+   * \brief Calls fn on the entries of a whose keys are not in b, in key order.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _orderA,
+    typename _AggregateA, typename _TpValueB, uint8_t _orderB,
+    typename _AggregateB, typename _Fn>
+    _Fn difference(const btree<_TpKey, _TpValue, _orderA, _AggregateA>& a,
+        const btree<_TpKey, _TpValueB, _orderB, _AggregateB>& b, _Fn fn) {
+      typename btree<_TpKey, _TpValue, _orderA, _AggregateA>::cursor ca =
+        a.make_cursor();
+      typename btree<_TpKey, _TpValueB, _orderB, _AggregateB>::cursor cb =
+        b.make_cursor();
+
+      if (!ca.first())
+        return fn;
+
+      cb.seek(ca.key());
+
+      while (ca.valid()) {
+        if (!cb.valid() || ca.key() < cb.key()) {
+          fn(*ca);
+          ca.next();
+        } else if (cb.key() < ca.key()) {
+          cb.seek(ca.key());
+        } else {
+          ca.next();
+        }
+      }
+
+      return fn;
+    }
+
+  /*!
+   * \brief Calls fn once per key present in either tree, in key order.
+   *
+   * When a key is in both trees, the entry of a is passed. (The name union
+   * is reserved in C++.)
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _orderA,
+    typename _AggregateA, uint8_t _orderB, typename _AggregateB,
+    typename _Fn>
+    _Fn unite(const btree<_TpKey, _TpValue, _orderA, _AggregateA>& a,
+        const btree<_TpKey, _TpValue, _orderB, _AggregateB>& b, _Fn fn) {
+      typename btree<_TpKey, _TpValue, _orderA, _AggregateA>::cursor ca =
+        a.make_cursor();
+      typename btree<_TpKey, _TpValue, _orderB, _AggregateB>::cursor cb =
+        b.make_cursor();
+
+      ca.first();
+      cb.first();
+
+      while (ca.valid() && cb.valid()) {
+        if (ca.key() < cb.key()) {
+          fn(*ca);
+          ca.next();
+        } else if (cb.key() < ca.key()) {
+          fn(*cb);
+          cb.next();
+        } else {
+          fn(*ca);
+          ca.next();
+          cb.next();
+        }
+      }
+
+      for (; ca.valid(); ca.next())
+        fn(*ca);
+
+      for (; cb.valid(); cb.next())
+        fn(*cb);
+
+      return fn;
+    }
+
+  /*!
+   * \class _BTreeDiffWalker
+   * \brief Walks a btree in key order, yielding whole subtrees until asked to open them.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * The pending part of the walk is a stack of entries, each being either
+   * an item or a whole subtree; the top of the stack comes first. Buffered
+   * writes are merged in as the walk goes (see cbt/btree_buffer.h), and a
+   * subtree is only yielded whole when none of them falls within it.
+   */
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    class _BTreeDiffWalker {
+      private:
+        typedef _BTreeNode<_TpKey, _TpValue, _order, _Aggregate> _Node;
+        typedef _BTreeBuffer<_TpKey, _TpValue> _Buffer;
+        typedef typename _Buffer::message _Message;
+
+        struct _Entry {
+          _Entry(_Node* p_node, const int& idx) : p_node_(p_node), idx_(idx) { }
+
+          _Node* p_node_;
+          int idx_;  // item index, or -1 for the whole subtree
+        };
+
+        enum _Head {
+          TREE,     // the top of the stack
+          MESSAGE,  // the next buffered write, an insert
+          BOTH      // the next buffered write, in place of the item on top
+        };
+
+      public:
+        explicit _BTreeDiffWalker(
+            const btree<_TpKey, _TpValue, _order, _Aggregate>& tree)
+          : buffer_(tree.buffer_), next_(0), head_(TREE) {
+          if (!tree.root_->empty())
+            stack_.push_back(_Entry(tree.root_, -1));
+
+          _normalize();
+        }
+
+      public:
+        const bool done() const {
+          return (stack_.empty() && next_ == buffer_.size());
+        }
+
+        const bool at_subtree() const {
+          return (head_ == TREE && stack_.back().idx_ < 0);
+        }
+
+        _Node* subtree() const { return stack_.back().p_node_; }
+
+        const std::pair<_TpKey, _TpValue>& item() const {
+          if (head_ != TREE)
+            return buffer_[next_].item_;
+
+          return stack_.back().p_node_->item(stack_.back().idx_);
+        }
+
+        /*!
+         * \brief Returns the lowest key of the subtree on top.
+         */
+        const _TpKey& first_key() const { return _edge_key(false); }
+
+        void pop() {
+          if (head_ != MESSAGE)
+            stack_.pop_back();
+          if (head_ != TREE)
+            next_++;
+
+          _normalize();
+        }
+
+        /*!
+         * \brief Replaces the subtree on top by its items and child subtrees.
+         */
+        void expand() {
+          _expand();
+          _normalize();
+        }
+
+      private:
+        /*!
+         * \brief Returns the lowest (or, when last, the highest) key of the subtree on top.
+         */
+        const _TpKey& _edge_key(const bool& last) const {
+          _Node* p_node = stack_.back().p_node_;
+
+          while (!p_node->is_leaf())
+            p_node = p_node->node(last ? p_node->num_items() : 0);
+
+          return p_node->item(last ? p_node->num_items()-1 : 0).first;
+        }
+
+        void _expand() {
+          _Node* p_node = stack_.back().p_node_;
+          stack_.pop_back();
+
+          for (int idx = p_node->num_items()-1; idx >= 0; idx--) {
+            if (!p_node->is_leaf())
+              stack_.push_back(_Entry(p_node->node(idx+1), -1));
+
+            stack_.push_back(_Entry(p_node, idx));
+          }
+
+          if (!p_node->is_leaf())
+            stack_.push_back(_Entry(p_node->node(0), -1));
+        }
+
+        /*!
+         * \brief Settles which of the stack and the buffer comes next.
+         *
+         * A subtree that the next write falls within is opened, and erased
+         * items are dropped along with their writes.
+         */
+        void _normalize() {
+          while (next_ < buffer_.size()) {
+            const _Message& m = buffer_[next_];
+            const _TpKey& key = m.item_.first;
+
+            if (stack_.empty()) {
+              head_ = MESSAGE;
+              return;
+            } else if (stack_.back().idx_ < 0) {
+              if (m.op_ == _Message::INSERT && key < _edge_key(false)) {
+                head_ = MESSAGE;
+                return;
+              } else if (_edge_key(true) < key) {
+                head_ = TREE;
+                return;
+              }
+
+              _expand();
+              continue;
+            }
+
+            const _Entry& top = stack_.back();
+
+            switch (m.against(top.p_node_->item(top.idx_))) {
+              case _Message::TAKE_ENTRY:
+                head_ = TREE;
+                return;
+              case _Message::TAKE_MESSAGE:
+                head_ = MESSAGE;
+                return;
+              case _Message::TAKE_BOTH:
+                head_ = BOTH;
+                return;
+              case _Message::SKIP_BOTH:
+                stack_.pop_back();
+                next_++;
+                break;
+            }
+          }
+
+          head_ = TREE;
+        }
+
+      private:
+        const _Buffer& buffer_;
+        size_t next_;  // the next buffered write
+        _Head head_;
+        std::vector<_Entry> stack_;
+    };
+
+  /*!
+   * \brief Reports how b differs from a, in key order.
+   *
+   * on_remove(item_a) is called for keys only in a, on_add(item_b) for
+   * keys only in b, and on_change(item_a, item_b) for keys in both with
+   * different values. Both trees are walked together as sequences of items
+   * and whole subtrees, and a subtree found at the head of both walks is
+   * skipped without being opened. Trees sharing nodes through clone() are
+   * therefore compared in time proportional to the nodes their changes
+   * copied, not to their size. Keys are assumed unique.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate, typename _FnAdd, typename _FnRemove,
+    typename _FnChange>
+    void diff(const btree<_TpKey, _TpValue, _order, _Aggregate>& a,
+        const btree<_TpKey, _TpValue, _order, _Aggregate>& b, _FnAdd on_add,
+        _FnRemove on_remove, _FnChange on_change) {
+      _BTreeDiffWalker<_TpKey, _TpValue, _order, _Aggregate> wa(a), wb(b);
+
+      while (!wa.done() && !wb.done()) {
+        if (wa.at_subtree() && wb.at_subtree()) {
+          if (wa.subtree() == wb.subtree()) {
+            wa.pop();
+            wb.pop();
+          } else if (wa.subtree()->count() >= wb.subtree()->count()) {
+            wa.expand();
+          } else {
+            wb.expand();
+          }
+        } else if (wa.at_subtree()) {  // b's item may come before it
+          if (wb.item().first < wa.first_key()) {
+            on_add(wb.item());
+            wb.pop();
+          } else {
+            wa.expand();
+          }
+        } else if (wb.at_subtree()) {
+          if (wa.item().first < wb.first_key()) {
+            on_remove(wa.item());
+            wa.pop();
+          } else {
+            wb.expand();
+          }
+        } else if (wa.item().first < wb.item().first) {
+          on_remove(wa.item());
+          wa.pop();
+        } else if (wb.item().first < wa.item().first) {
+          on_add(wb.item());
+          wb.pop();
+        } else {
+          if (!(wa.item().second == wb.item().second))
+            on_change(wa.item(), wb.item());
+
+          wa.pop();
+          wb.pop();
+        }
+      }
+
+      for (; !wa.done(); wa.pop()) {
+        while (wa.at_subtree())
+          wa.expand();
+
+        on_remove(wa.item());
+      }
+
+      for (; !wb.done(); wb.pop()) {
+        while (wb.at_subtree())
+          wb.expand();
+
+        on_add(wb.item());
+      }
+    }
+}
+
+#endif  // CBTL_CBT_BTREE_ALGORITHM_H_
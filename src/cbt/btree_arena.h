@@ -0,0 +1,168 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_arena.h
+ * \brief Contains _BTreeArena, the contiguous chunks btree::compact() moves nodes into.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_ARENA_H_
+#define CBTL_CBT_BTREE_ARENA_H_
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <cstddef>
+#include <new>
+
+namespace cbt {
+  /*!
+   * \class _BTreeArena
+   * \brief A chunk of memory handing out equally sized node slots, in address order.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Slots are never reused: a chunk counts the slots still in use, plus
+   * one for whoever is filling it, and frees itself when that drops to
+   * zero. Nodes in a chunk may end up shared with clones living in other
+   * threads, so the count is atomic.
+   *
+   * A chunk comes from the heap, or is a 2 MiB mapping meant to be backed
+   * by a single huge page, so that all of its nodes take one TLB entry.
+   * The mapping comes from hugetlbfs when pages are reserved there, and
+   * otherwise is aligned to 2 MiB and marked MADV_HUGEPAGE for transparent
+   * huge pages, which the kernel may or may not grant.
+   */
+
+  class _BTreeArena {
+    public:
+      static const size_t CHUNK_SIZE = 64 * 1024;
+      static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    public:
+      /*!
+       * \brief Makes a chunk of slot_size slots, tagged with the compaction pass it belongs to.
+       */
+      _BTreeArena(const size_t& slot_size, const uint64_t& tag,
+          const bool& huge_pages = false)
+        : slot_size_(slot_size), used_(0), live_(1), tag_(tag),
+        huge_pages_(huge_pages) {
+        size_t chunk_size = (huge_pages ? HUGE_PAGE_SIZE : CHUNK_SIZE);
+        num_slots_ = (slot_size < chunk_size ? chunk_size / slot_size : 1);
+        bytes_ = slot_size_ * num_slots_;
+
+        if (huge_pages) {
+          bytes_ = (bytes_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE
+            * HUGE_PAGE_SIZE;
+          p_memory_ = _map_huge_pages(bytes_);
+        } else {
+          p_memory_ = static_cast<char*>(::operator new(bytes_));
+        }
+      }
+
+    private:
+      ~_BTreeArena() {
+        if (huge_pages_)
+          munmap(p_memory_, bytes_);
+        else
+          ::operator delete(p_memory_);
+      }
+
+      /*!
+       * \brief Maps bytes, a multiple of HUGE_PAGE_SIZE, to be backed by huge pages if possible.
+       */
+      static char* _map_huge_pages(const size_t& bytes) {
+        void* p_map = MAP_FAILED;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        // 2 MiB pages (log2 is 21), whatever the default huge page size is
+        p_map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE
+            | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+#endif
+
+        if (p_map != MAP_FAILED)
+          return static_cast<char*>(p_map);
+
+        // map more than needed, so that an aligned range can be kept
+        size_t span = bytes + HUGE_PAGE_SIZE;
+        p_map = mmap(NULL, span, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p_map == MAP_FAILED)
+          throw std::bad_alloc();
+
+        char* p_span = static_cast<char*>(p_map);
+        char* p_memory = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(p_span) + HUGE_PAGE_SIZE - 1)
+            & ~static_cast<uintptr_t>(HUGE_PAGE_SIZE - 1));
+
+        if (p_memory > p_span)
+          munmap(p_span, p_memory - p_span);
+
+        if (p_span + span > p_memory + bytes)
+          munmap(p_memory + bytes, (p_span + span) - (p_memory + bytes));
+
+#ifdef MADV_HUGEPAGE
+        madvise(p_memory, bytes, MADV_HUGEPAGE);
+#endif
+
+        return p_memory;
+      }
+
+    public:
+      const uint64_t tag() const { return tag_; }
+      const bool full() const { return (used_ == num_slots_); }
+
+      /*!
+       * \brief Returns the next free slot; the chunk must not be full.
+       */
+      void* allocate() {
+        __atomic_add_fetch(&live_, 1, __ATOMIC_RELAXED);
+        return p_memory_ + slot_size_ * used_++;
+      }
+
+      /*!
+       * \brief Gives one slot back, freeing the chunk after the last one.
+       */
+      void release() {
+        if (__atomic_sub_fetch(&live_, 1, __ATOMIC_ACQ_REL) == 0)
+          delete this;
+      }
+
+      /*!
+       * \brief Tells the chunk no more slots will be taken from it.
+       */
+      void close() { release(); }
+
+    private:
+      char* p_memory_;
+      size_t bytes_;
+      size_t slot_size_;
+      size_t num_slots_;
+      size_t used_;
+      uint32_t live_;
+      uint64_t tag_;
+      bool huge_pages_;
+  };
+}
+
+#endif  // CBTL_CBT_BTREE_ARENA_H_
@@ -0,0 +1,158 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_boxed.h
+ * \brief Contains boxed, the handle a btree may hold instead of a large value.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * Nodes hold their entries inline, so with a large _TpValue every node,
+ * inner ones included, is mostly values that descents never read, and
+ * every shift of an item during insert() or a split copies one. A
+ * btree<_TpKey, boxed<_TpValue> > holds a pointer-sized handle instead,
+ * making the node size depend on the key size only.
+ *
+ * value_holder<_TpValue>::type picks boxed<_TpValue> for values larger
+ * than a threshold and _TpValue itself otherwise, and unbox() reads
+ * either one.
+ */
+
+#ifndef CBTL_CBT_BTREE_BOXED_H_
+#define CBTL_CBT_BTREE_BOXED_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace cbt {
+  /*!
+   * \class boxed
+   * \brief A handle to an immutable _Tp stored apart, shared by every copy of the handle.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Copying a handle copies a pointer and counts one more reference, so
+   * items move between node slots, and nodes are copied for clones,
+   * without touching the value. The count is atomic, as copies may live
+   * in clones changed from other threads. A default constructed handle
+   * refers to no box at all and reads as _Tp(), so that the unused item
+   * slots of a node cost nothing. A value is never changed in place:
+   * assigning to a handle makes it refer to another box.
+   */
+
+  template<typename _Tp>
+    class boxed {
+      private:
+        struct _Box {
+          explicit _Box(const _Tp& value) : value_(value), refs_(1) { }
+
+          _Tp value_;
+          uint32_t refs_;
+        };
+
+      public:
+        boxed() : p_box_(NULL) { }
+        boxed(const _Tp& value) : p_box_(new _Box(value)) { }
+        boxed(const boxed& other) : p_box_(other.p_box_) { _ref(); }
+        ~boxed() { _unref(); }
+
+        boxed& operator=(const boxed& other) {
+          if (p_box_ != other.p_box_) {
+            _unref();
+            p_box_ = other.p_box_;
+            _ref();
+          }
+
+          return *this;
+        }
+
+      private:
+        void _ref() {
+          if (p_box_)
+            __atomic_add_fetch(&p_box_->refs_, 1, __ATOMIC_RELAXED);
+        }
+
+        void _unref() {
+          if (p_box_ &&
+              __atomic_sub_fetch(&p_box_->refs_, 1, __ATOMIC_ACQ_REL) == 0)
+            delete p_box_;
+        }
+
+        static const _Tp& _default() {
+          static const _Tp value = _Tp();
+          return value;
+        }
+
+      public:
+        const _Tp& get() const { return (p_box_ ? p_box_->value_ : _default()); }
+        const _Tp& operator*() const { return get(); }
+        const _Tp* operator->() const { return &get(); }
+
+        /*!
+         * \brief Returns how many handles refer to the value, 0 for a default constructed one.
+         */
+        const uint32_t use_count() const {
+          return (p_box_ ? __atomic_load_n(&p_box_->refs_, __ATOMIC_ACQUIRE)
+              : 0);
+        }
+
+        const bool operator==(const boxed& other) const {
+          return (p_box_ == other.p_box_ || get() == other.get());
+        }
+
+        const bool operator!=(const boxed& other) const {
+          return !(*this == other);
+        }
+
+      private:
+        _Box* p_box_;
+    };
+
+  template<typename _Tp, bool _box>
+    struct _value_holder {
+      typedef _Tp type;
+    };
+
+  template<typename _Tp>
+    struct _value_holder<_Tp, true> {
+      typedef boxed<_Tp> type;
+    };
+
+  /*!
+   * \brief Picks boxed<_Tp> as the value type of a btree when _Tp is larger than _max_inline bytes.
+   */
+  template<typename _Tp, size_t _max_inline = 2 * sizeof(void*)>
+    struct value_holder {
+      typedef typename _value_holder<_Tp, (sizeof(_Tp) > _max_inline)>::type
+        type;
+    };
+
+  /*!
+   * \brief Returns the value a value_holder<_Tp>::type holds, boxed or not.
+   */
+  template<typename _Tp>
+    inline const _Tp& unbox(const _Tp& value) { return value; }
+
+  template<typename _Tp>
+    inline const _Tp& unbox(const boxed<_Tp>& value) { return value.get(); }
+}
+
+#endif  // CBTL_CBT_BTREE_BOXED_H_
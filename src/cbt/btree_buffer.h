@@ -0,0 +1,237 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_buffer.h
+ * \brief Contains the write buffer of a btree and the merged walk over it.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * With write buffering on (see btree::set_write_buffer()), writes wait in
+ * a _BTreeBuffer, sorted by key, until the buffer is full or a non-const
+ * operation needs the tree up to date. Const operations never apply the
+ * buffer: they merge it with the entries of the tree as they go, so they
+ * may run from several threads at once.
+ *
+ * Every buffered write of a key that has entries in the tree (an UPSERT
+ * of an existing key, or an ERASE) applies to the first of those entries,
+ * and comes before the INSERTs of that key, which go after them. Walking
+ * the tree and the buffer together in key order, a write therefore meets
+ * the entry it applies to as soon as their keys are equal.
+ */
+
+#ifndef CBTL_CBT_BTREE_BUFFER_H_
+#define CBTL_CBT_BTREE_BUFFER_H_
+
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace cbt {
+  /*!
+   * \brief A write waiting in the buffer.
+   */
+  template<typename _TpKey, typename _TpValue>
+    struct _BTreeMessage {
+      enum op { INSERT, UPSERT, ERASE };
+
+      /*!
+       * \brief How a message and an entry, both next in a merged walk, go together.
+       */
+      enum step {
+        TAKE_ENTRY,    // the entry comes first
+        TAKE_MESSAGE,  // an inserted entry comes first
+        TAKE_BOTH,     // the message gives the entry its new value
+        SKIP_BOTH      // the message erases the entry
+      };
+
+      _BTreeMessage(const op& o, const _TpKey& key, const _TpValue& value)
+        : op_(o), item_(key, value) { }
+
+      const step against(const std::pair<_TpKey, _TpValue>& entry) const {
+        if (item_.first < entry.first)
+          return TAKE_MESSAGE;
+        else if (entry.first < item_.first || op_ == INSERT)
+          return TAKE_ENTRY;  // inserts of a key go after its entries
+        else
+          return (op_ == ERASE ? SKIP_BOTH : TAKE_BOTH);
+      }
+
+      op op_;
+      std::pair<_TpKey, _TpValue> item_;
+    };
+
+  /*!
+   * \class _BTreeBuffer
+   * \brief The buffered writes of a btree, sorted by key.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Writes of one key keep the order they were made in. delta() tells how
+   * many entries applying the buffer would add (or, if negative, remove).
+   */
+
+  template<typename _TpKey, typename _TpValue>
+    class _BTreeBuffer {
+      public:
+        typedef _BTreeMessage<_TpKey, _TpValue> message;
+
+      public:
+        _BTreeBuffer() : delta_(0) { }
+
+      public:
+        void add(const typename message::op& o, const _TpKey& key,
+            const _TpValue& value) {
+          messages_.insert(messages_.begin() + upper(key),
+              message(o, key, value));
+
+          if (o == message::INSERT)
+            delta_++;
+          else if (o == message::ERASE)
+            delta_--;
+        }
+
+        /*!
+         * \brief Returns the index of the first message with a key not less than key.
+         */
+        const size_t lower(const _TpKey& key) const {
+          size_t lo = 0, hi = messages_.size();
+
+          while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (messages_[mid].item_.first < key)
+              lo = mid + 1;
+            else
+              hi = mid;
+          }
+
+          return lo;
+        }
+
+        /*!
+         * \brief Returns the index of the first message with a key greater than key.
+         */
+        const size_t upper(const _TpKey& key) const {
+          size_t lo = 0, hi = messages_.size();
+
+          while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (key < messages_[mid].item_.first)
+              hi = mid;
+            else
+              lo = mid + 1;
+          }
+
+          return lo;
+        }
+
+        const bool has(const _TpKey& key) const {
+          size_t idx = lower(key);
+          return (idx < messages_.size()
+              && !(key < messages_[idx].item_.first));
+        }
+
+        const message& operator[](const size_t& idx) const {
+          return messages_[idx];
+        }
+
+        const size_t size() const { return messages_.size(); }
+        const bool empty() const { return messages_.empty(); }
+        const ptrdiff_t delta() const { return delta_; }
+
+        void reserve(const size_t& capacity) { messages_.reserve(capacity); }
+
+        void clear() {
+          messages_.clear();
+          delta_ = 0;
+        }
+
+        void swap(_BTreeBuffer& other) {
+          messages_.swap(other.messages_);
+          std::swap(delta_, other.delta_);
+        }
+
+      private:
+        std::vector<message> messages_;
+        ptrdiff_t delta_;
+    };
+
+  /*!
+   * \class _BTreeMerger
+   * \brief Passes entries, given in key order, to fn merged with a range of buffered writes.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * The messages in [begin, end) are the ones that fall among the entries
+   * to come. After the last entry, finish() passes the inserts left over.
+   */
+
+  template<typename _TpKey, typename _TpValue, typename _Fn>
+    class _BTreeMerger {
+      private:
+        typedef _BTreeMessage<_TpKey, _TpValue> _Message;
+
+      public:
+        _BTreeMerger(_Fn& fn, const _BTreeBuffer<_TpKey, _TpValue>& buffer,
+            const size_t& begin, const size_t& end)
+          : fn_(fn), buffer_(buffer), next_(begin), end_(end) { }
+
+      public:
+        void operator()(const std::pair<_TpKey, _TpValue>& entry) {
+          for (; next_ < end_; next_++) {
+            const _Message& m = buffer_[next_];
+
+            switch (m.against(entry)) {
+              case _Message::TAKE_MESSAGE:
+                fn_(m.item_);
+                break;
+              case _Message::TAKE_BOTH:
+                fn_(m.item_);
+                next_++;
+                return;
+              case _Message::SKIP_BOTH:
+                next_++;
+                return;
+              case _Message::TAKE_ENTRY:
+                fn_(entry);
+                return;
+            }
+          }
+
+          fn_(entry);
+        }
+
+        void finish() {
+          for (; next_ < end_; next_++)
+            fn_(buffer_[next_].item_);
+        }
+
+      private:
+        _Fn& fn_;
+        const _BTreeBuffer<_TpKey, _TpValue>& buffer_;
+        size_t next_;
+        size_t end_;
+    };
+}
+
+#endif  // CBTL_CBT_BTREE_BUFFER_H_
@@ -0,0 +1,334 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_cursor.h
+ * \brief Contains _BTreeCursor definition.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_CURSOR_H_
+#define CBTL_CBT_BTREE_CURSOR_H_
+
+#include <stdint.h>
+#include <utility>
+
+#include "glog/logging.h"
+#include "cbt/btree_aggregate.h"
+#include "cbt/btree_buffer.h"
+
+namespace cbt {
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    class _BTreeNode;
+
+  /*!
+   * \class _BTreeCursor
+   * \brief The _BTreeCursor class template.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * A _BTreeCursor keeps the whole root-to-node path of its position. A
+   * seek() first climbs that path only as far as the lowest node whose key
+   * range holds the target, and descends again from there, so a seek near
+   * the previous position costs O(1) to O(log distance) instead of a full
+   * descent from the root.
+   *
+   * At every level above the current one the path records the child that
+   * was taken; at the current level it records the item. Any change to the
+   * tree invalidates the path: call reset() before using the cursor again.
+   * As with iterators, entries are returned as const.
+   *
+   * The writes still waiting in the write buffer of the tree, if any, are
+   * merged in as the cursor goes (see cbt/btree_buffer.h), so the cursor
+   * shows the entries the tree will have once they are applied.
+   */
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate = no_aggregate>
+    class _BTreeCursor {
+      private:
+        typedef _BTreeNode<_TpKey, _TpValue, _order, _Aggregate> _Node;
+        typedef _BTreeBuffer<_TpKey, _TpValue> _Buffer;
+        typedef typename _Buffer::message _Message;
+
+        enum _At { AT_ENTRY, AT_MESSAGE, AT_BOTH, AT_END };
+
+      public:
+        static const uint8_t MAX_DEPTH = 64;
+
+      public:
+        explicit _BTreeCursor(_Node* const* pp_root,
+            const _Buffer* p_buffer = NULL)
+          : pp_root_(pp_root), depth_(0), valid_(false), p_buffer_(p_buffer),
+          next_(0), at_(AT_END) { }
+
+      private:
+        uint8_t _lowest_enclosing_level(const _TpKey& key) const;
+        void _descend(uint8_t level, const _TpKey& key);
+        void _next_entry();
+        void _merge();
+
+        const std::pair<_TpKey, _TpValue>& _entry() const {
+          return nodes_[depth_]->item(idx_[depth_]);
+        }
+
+      public:
+        /*!
+         * \brief Forgets the saved path; the next seek() starts from the root.
+         */
+        void reset() {
+          valid_ = false;
+          at_ = AT_END;
+        }
+
+        /*!
+         * \brief Positions the cursor at the first entry with key not less than key.
+         *
+         * Returns true when that entry's key is equal to key.
+         */
+        const bool seek(const _TpKey& key) {
+          if (valid_) {
+            _descend(_lowest_enclosing_level(key), key);
+          } else {
+            nodes_[0] = *pp_root_;
+            _descend(0, key);
+          }
+
+          next_ = (p_buffer_ ? p_buffer_->lower(key) : 0);
+          _merge();
+
+          return (valid() && !(key < this->key()));
+        }
+
+        /*!
+         * \brief Positions the cursor at the first entry of the tree.
+         */
+        const bool first() {
+          nodes_[0] = *pp_root_;
+          depth_ = 0;
+
+          while (!nodes_[depth_]->is_leaf()) {
+            idx_[depth_] = 0;
+            nodes_[depth_+1] = nodes_[depth_]->node(0);
+            depth_++;
+          }
+
+          idx_[depth_] = 0;
+          valid_ = !nodes_[depth_]->empty();
+          next_ = 0;
+          _merge();
+
+          return valid();
+        }
+
+        /*!
+         * \brief Moves to the next entry, returning false past the last one.
+         */
+        const bool next() {
+          if (at_ == AT_END)
+            return false;
+
+          if (at_ != AT_MESSAGE)
+            _next_entry();
+          if (at_ != AT_ENTRY)
+            next_++;
+
+          _merge();
+          return valid();
+        }
+
+        const bool valid() const { return (at_ != AT_END); }
+
+        const std::pair<_TpKey, _TpValue>& operator*() const {
+          return (at_ == AT_ENTRY ? _entry() : (*p_buffer_)[next_].item_);
+        }
+
+        const std::pair<_TpKey, _TpValue>* operator->() const {
+          return &(operator*());
+        }
+
+        const _TpKey& key() const { return operator*().first; }
+        const _TpValue& value() const { return operator*().second; }
+
+      private:
+        _Node* const* pp_root_;
+        _Node* nodes_[MAX_DEPTH];
+        uint8_t idx_[MAX_DEPTH];
+        uint8_t depth_;
+        bool valid_;  // whether nodes_ and idx_ point at an entry of the tree
+        const _Buffer* p_buffer_;
+        size_t next_;  // the first message not passed yet
+        _At at_;
+    };
+
+  /*!
+   * \brief Moves the tree position to the next entry of the tree.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeCursor<_TpKey, _TpValue, _order, _Aggregate>::_next_entry() {
+      _Node* p_node = nodes_[depth_];
+
+      if (!p_node->is_leaf()) {  // first item of the right subtree
+        idx_[depth_]++;
+
+        do {
+          nodes_[depth_+1] = nodes_[depth_]->node(idx_[depth_]);
+          depth_++;
+          idx_[depth_] = 0;
+        } while (!nodes_[depth_]->is_leaf());
+      } else if (idx_[depth_]+1 < p_node->num_items()) {
+        idx_[depth_]++;
+      } else {  // back to the first ancestor with an item to our right
+        while (depth_ > 0) {
+          depth_--;
+
+          if (idx_[depth_] < nodes_[depth_]->num_items())
+            return;
+        }
+
+        valid_ = false;
+      }
+    }
+
+  /*!
+   * \brief Settles on the next entry of the merged walk, passing the entries erased by messages.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeCursor<_TpKey, _TpValue, _order, _Aggregate>::_merge() {
+      size_t n = (p_buffer_ ? p_buffer_->size() : 0);
+
+      for (; next_ < n; next_++) {
+        if (!valid_) {
+          at_ = AT_MESSAGE;
+          return;
+        }
+
+        switch ((*p_buffer_)[next_].against(_entry())) {
+          case _Message::TAKE_ENTRY:
+            at_ = AT_ENTRY;
+            return;
+          case _Message::TAKE_MESSAGE:
+            at_ = AT_MESSAGE;
+            return;
+          case _Message::TAKE_BOTH:
+            at_ = AT_BOTH;
+            return;
+          case _Message::SKIP_BOTH:
+            _next_entry();
+            break;
+        }
+      }
+
+      at_ = (valid_ ? AT_ENTRY : AT_END);
+    }
+
+  /*!
+   * \brief Returns the deepest level of the path whose subtree range holds key.
+   *
+   * A subtree reached through child c of its parent holds the keys in
+   * (item(c-1), item(c)]; a missing separator means the bound is inherited
+   * from a level further up. Once a bound excludes key, that whole subtree
+   * is dismissed and the bounds of its parent are looked for instead.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    uint8_t _BTreeCursor<_TpKey, _TpValue, _order,
+    _Aggregate>::_lowest_enclosing_level(const _TpKey& key) const {
+      uint8_t level = depth_;
+      bool lo_known = false, hi_known = false;
+
+      for (int d = depth_-1; d >= 0 && !(lo_known && hi_known); d--) {
+        uint8_t c = idx_[d];
+
+        if (!lo_known && c > 0) {
+          lo_known = true;
+
+          if (!(nodes_[d]->item(c-1).first < key)) {
+            level = d;
+            lo_known = hi_known = false;
+            continue;
+          }
+        }
+
+        if (!hi_known && c < nodes_[d]->num_items()) {
+          hi_known = true;
+
+          if (nodes_[d]->item(c).first < key) {
+            level = d;
+            lo_known = hi_known = false;
+          }
+        }
+      }
+
+      return level;
+    }
+
+  /*!
+   * \brief Descends from the node at level, as a lower bound search would.
+   *
+   * The deepest node holding an item not less than key holds the answer.
+   * If no such item is found under level, the answer is the separator to
+   * the right of this subtree in the nearest ancestor that has one.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeCursor<_TpKey, _TpValue, _order, _Aggregate>::_descend(
+        uint8_t level, const _TpKey& key) {
+      int found = -1;
+
+      for (uint8_t d = level; ; d++) {
+        _Node* p_node = nodes_[d];
+        uint8_t idx = p_node->lower_index(key);
+
+        idx_[d] = idx;
+
+        if (idx < p_node->num_items())
+          found = d;
+
+        if (p_node->is_leaf())
+          break;
+
+        nodes_[d+1] = p_node->node(idx);
+      }
+
+      if (found >= 0) {
+        depth_ = found;
+        valid_ = true;
+        return;
+      }
+
+      for (int d = level-1; d >= 0; d--) {
+        if (idx_[d] < nodes_[d]->num_items()) {
+          depth_ = d;
+          valid_ = true;
+          return;
+        }
+      }
+
+      valid_ = false;
+    }
+}
+
+#endif  // CBTL_CBT_BTREE_CURSOR_H_
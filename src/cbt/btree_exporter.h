@@ -0,0 +1,226 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_exporter.h
+ * \brief Contains metrics_exporter definition.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_EXPORTER_H_
+#define CBTL_CBT_BTREE_EXPORTER_H_
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cbt/btree_stats.h"
+
+namespace cbt {
+  /*!
+   * \class metrics_exporter
+   * \brief Renders the btree_stats of many trees as OpenMetrics text.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Every registered tree is rendered with a tree="<name>" label. Rendering
+   * only reads the counters, so writers keep running while it collects; the
+   * figures of one tree may therefore be a few operations apart. add() and
+   * remove() must not race with render().
+   */
+
+  class metrics_exporter {
+    public:
+      explicit metrics_exporter(const std::string& prefix = "cbtl_btree")
+        : prefix_(prefix) { }
+
+    public:
+      void add(const std::string& tree, const btree_stats* p_stats) {
+        sources_.push_back(std::make_pair(_escape(tree), p_stats));
+      }
+
+      void remove(const btree_stats* p_stats) {
+        for (size_t idx = 0; idx < sources_.size(); idx++) {
+          if (sources_[idx].second == p_stats) {
+            sources_.erase(sources_.begin() + idx);
+            return;
+          }
+        }
+      }
+
+      const size_t size() const { return sources_.size(); }
+
+    private:
+      static std::string _escape(const std::string& value) {
+        std::string escaped;
+
+        for (size_t idx = 0; idx < value.size(); idx++) {
+          if (value[idx] == '\\' || value[idx] == '"')
+            escaped += '\\';
+
+          if (value[idx] == '\n')
+            escaped += "\\n";
+          else
+            escaped += value[idx];
+        }
+
+        return escaped;
+      }
+
+      void _family(std::ostream& os, const char* name, const char* type,
+          const char* help, const char* unit = NULL) const {
+        os << "# TYPE " << prefix_ << name << " " << type << "\n";
+
+        if (unit)
+          os << "# UNIT " << prefix_ << name << " " << unit << "\n";
+
+        os << "# HELP " << prefix_ << name << " " << help << "\n";
+      }
+
+      void _sample(std::ostream& os, const char* name, const size_t& src,
+          const std::string& labels = "") const {
+        os << prefix_ << name << "{tree=\"" << sources_[src].first << "\""
+          << labels << "} ";
+      }
+
+    public:
+      void render(std::ostream& os) const {
+        std::streamsize precision = os.precision(9);
+        double secs_per_tick = 1.0 / _ticks_per_second();
+
+        _family(os, "_entries", "gauge", "Number of entries in the tree.");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          _sample(os, "_entries", src);
+          os << sources_[src].second->entries() << "\n";
+        }
+
+        _family(os, "_height", "gauge", "Number of levels in the tree.");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          _sample(os, "_height", src);
+          os << static_cast<int>(sources_[src].second->height()) << "\n";
+        }
+
+        _family(os, "_nodes", "gauge", "Number of nodes per level, leaves being level 0.");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          uint8_t height = sources_[src].second->height();
+
+          for (uint8_t level = 0; level < height; level++) {
+            std::ostringstream labels;
+            labels << ",level=\"" << static_cast<int>(level) << "\"";
+
+            _sample(os, "_nodes", src, labels.str());
+            os << sources_[src].second->nodes(level) << "\n";
+          }
+        }
+
+        _family(os, "_allocated_bytes", "gauge", "Bytes allocated for nodes.",
+            "bytes");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          _sample(os, "_allocated_bytes", src);
+          os << sources_[src].second->allocated_bytes() << "\n";
+        }
+
+        _family(os, "_fill_ratio", "gauge", "Fraction of item slots in use.",
+            "ratio");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          _sample(os, "_fill_ratio", src);
+          os << sources_[src].second->fill_factor() << "\n";
+        }
+
+        _family(os, "_operations", "counter", "Operations performed on the tree.");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          for (int o = 0; o < btree_stats::NUM_OPS; o++) {
+            btree_stats::op op = static_cast<btree_stats::op>(o);
+
+            _sample(os, "_operations_total", src,
+                std::string(",op=\"") + btree_stats::op_name(op) + "\"");
+            os << sources_[src].second->ops(op) << "\n";
+          }
+        }
+
+        _family(os, "_operation_latency_seconds", "summary",
+            "Latency of the sampled operations.", "seconds");
+        for (size_t src = 0; src < sources_.size(); src++) {
+          for (int o = 0; o < btree_stats::NUM_OPS; o++) {
+            btree_stats::op op = static_cast<btree_stats::op>(o);
+            const latency_histogram& h = sources_[src].second->histogram(op);
+            std::string labels = std::string(",op=\"") + btree_stats::op_name(op) + "\"";
+            static const char* quantiles[] = { "0.5", "0.9", "0.99", "0.999" };
+            static const double pcts[] = { 50, 90, 99, 99.9 };
+
+            for (int q = 0; q < 4; q++) {
+              _sample(os, "_operation_latency_seconds", src,
+                  labels + ",quantile=\"" + quantiles[q] + "\"");
+              os << h.percentile(pcts[q]) * secs_per_tick << "\n";
+            }
+
+            _sample(os, "_operation_latency_seconds_sum", src, labels);
+            os << h.sum() * secs_per_tick << "\n";
+            _sample(os, "_operation_latency_seconds_count", src, labels);
+            os << h.count() << "\n";
+          }
+        }
+
+        os << "# EOF\n";
+        os.precision(precision);
+      }
+
+      std::string render() const {
+        std::ostringstream os;
+        render(os);
+        return os.str();
+      }
+
+      /*!
+       * \brief Writes the metrics to a file, replacing it atomically.
+       *
+       * The text is written to "<path>.tmp" and renamed over path, so a
+       * collector reading the file never sees a partial scrape.
+       */
+      const bool write_file(const std::string& path) const {
+        std::string tmp_path = path + ".tmp";
+
+        {
+          std::ofstream file(tmp_path.c_str());
+
+          if (!file)
+            return false;
+
+          render(file);
+
+          if (!file.flush())
+            return false;
+        }
+
+        return (rename(tmp_path.c_str(), path.c_str()) == 0);
+      }
+
+    private:
+      std::string prefix_;
+      std::vector<std::pair<std::string, const btree_stats*> > sources_;
+  };
+}
+
+#endif  // CBTL_CBT_BTREE_EXPORTER_H_
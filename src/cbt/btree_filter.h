@@ -0,0 +1,310 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_filter.h
+ * \brief Contains the membership filter a btree may check before a descent.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * A find() for a key that is not there walks from the root to a leaf,
+ * missing the cache at every level of a large tree. With a filter (see
+ * btree::set_filter()), the tree first tests the key against a blocked
+ * Bloom filter: all the bits of a key are in one 32-byte block, so most
+ * misses cost a single cache miss. Keys never give false negatives, so
+ * the filter only has to learn the keys inserted; an erased key keeps
+ * its bits until the filter is built again.
+ */
+
+#ifndef CBTL_CBT_BTREE_FILTER_H_
+#define CBTL_CBT_BTREE_FILTER_H_
+
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+namespace cbt {
+  /*!
+   * \brief Tells whether _TpKey can be hashed for a btree filter; enabled for integers and std::string.
+   *
+   * A specialization enabling it provides ENABLED = true and a static
+   * of(key) returning a well mixed uint64_t; equal keys must have equal
+   * hashes.
+   */
+  template<typename _TpKey>
+    struct key_hash {
+      static const bool ENABLED = false;
+    };
+
+  /*!
+   * \brief The finalizer of MurmurHash3, spreading every bit of h over the result.
+   */
+  inline uint64_t _mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  template<typename _TpKey>
+    struct _integer_key_hash {
+      static const bool ENABLED = true;
+
+      static uint64_t of(const _TpKey& key) {
+        return _mix_hash(static_cast<uint64_t>(key));
+      }
+    };
+
+  template<> struct key_hash<int> : _integer_key_hash<int> { };
+  template<> struct key_hash<unsigned int>
+    : _integer_key_hash<unsigned int> { };
+  template<> struct key_hash<long> : _integer_key_hash<long> { };
+  template<> struct key_hash<unsigned long>
+    : _integer_key_hash<unsigned long> { };
+  template<> struct key_hash<long long> : _integer_key_hash<long long> { };
+  template<> struct key_hash<unsigned long long>
+    : _integer_key_hash<unsigned long long> { };
+
+  /*!
+   * \brief FNV-1a of the bytes, mixed.
+   */
+  template<>
+    struct key_hash<std::string> {
+      static const bool ENABLED = true;
+
+      static uint64_t of(const std::string& key) {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (size_t idx = 0; idx < key.size(); idx++)
+          h = (h ^ static_cast<uint8_t>(key[idx])) * 1099511628211ULL;
+
+        return _mix_hash(h);
+      }
+    };
+
+  /*!
+   * \class _BTreeFilter
+   * \brief A blocked Bloom filter of the keys of a btree, shared with its clones.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Each block is 8 words of 32 bits, and a key sets one bit in each
+   * word of the block its hash picks, as in the split block Bloom filter
+   * of Parquet. A filter is sized for twice the entries it is built from,
+   * at 12 bits per entry, which keeps false positives at 1% or less until
+   * the tree outgrows it.
+   *
+   * Copies share the bits, with an atomic count, as clones share nodes;
+   * the first add() to a shared filter copies it. The specialization for
+   * keys without key_hash refuses to be built.
+   */
+
+  template<typename _TpKey, bool _enabled = key_hash<_TpKey>::ENABLED>
+    class _BTreeFilter {
+      public:
+        static const size_t MIN_CAPACITY = 1024;
+        static const size_t BITS_PER_ENTRY = 12;
+
+      private:
+        struct _Block {
+          uint32_t words_[8];
+        };
+
+        struct _Data {
+          uint32_t refs_;
+          size_t capacity_;
+          size_t stale_;
+          size_t num_blocks_;
+          _Block* p_blocks_;
+        };
+
+      public:
+        _BTreeFilter() : p_data_(NULL) { }
+        _BTreeFilter(const _BTreeFilter& other) : p_data_(other.p_data_) {
+          _ref();
+        }
+        ~_BTreeFilter() { _unref(); }
+
+        _BTreeFilter& operator=(const _BTreeFilter& other) {
+          if (p_data_ != other.p_data_) {
+            _unref();
+            p_data_ = other.p_data_;
+            _ref();
+          }
+
+          return *this;
+        }
+
+      private:
+        void _ref() {
+          if (p_data_)
+            __atomic_add_fetch(&p_data_->refs_, 1, __ATOMIC_RELAXED);
+        }
+
+        void _unref() {
+          if (p_data_ &&
+              __atomic_sub_fetch(&p_data_->refs_, 1, __ATOMIC_ACQ_REL) == 0) {
+            free(p_data_->p_blocks_);
+            delete p_data_;
+          }
+
+          p_data_ = NULL;
+        }
+
+        static _Data* _new_data(const size_t& capacity,
+            const size_t& num_blocks) {
+          void* p_blocks = NULL;
+
+          if (posix_memalign(&p_blocks, 64, num_blocks * sizeof(_Block)))
+            throw std::bad_alloc();
+
+          _Data* p_data = new _Data;
+          p_data->refs_ = 1;
+          p_data->capacity_ = capacity;
+          p_data->stale_ = 0;
+          p_data->num_blocks_ = num_blocks;
+          p_data->p_blocks_ = static_cast<_Block*>(p_blocks);
+
+          return p_data;
+        }
+
+        /*!
+         * \brief Makes p_data_ this filter's own, copying it if it is shared.
+         */
+        void _own() {
+          if (__atomic_load_n(&p_data_->refs_, __ATOMIC_ACQUIRE) == 1)
+            return;
+
+          _Data* p_copy = _new_data(p_data_->capacity_, p_data_->num_blocks_);
+          p_copy->stale_ = p_data_->stale_;
+          memcpy(p_copy->p_blocks_, p_data_->p_blocks_,
+              p_data_->num_blocks_ * sizeof(_Block));
+
+          _unref();
+          p_data_ = p_copy;
+        }
+
+        /*!
+         * \brief Returns the block of h, picked by its high 32 bits.
+         */
+        _Block& _block_of(const uint64_t& h) const {
+          return p_data_->p_blocks_[((h >> 32) * p_data_->num_blocks_) >> 32];
+        }
+
+        /*!
+         * \brief Returns the bit of h in word idx of its block.
+         */
+        static uint32_t _bit_of(const uint64_t& h, const uint8_t& idx) {
+          static const uint32_t SALT[8] = {
+            0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+            0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+          };
+
+          return 1u << ((static_cast<uint32_t>(h) * SALT[idx]) >> 27);
+        }
+
+      public:
+        const bool active() const { return (p_data_ != NULL); }
+
+        /*!
+         * \brief Returns how many entries the filter was sized for, 0 if it is not active.
+         */
+        const size_t capacity() const {
+          return (p_data_ ? p_data_->capacity_ : 0);
+        }
+
+        /*!
+         * \brief Replaces the filter by an empty one, sized for twice entries.
+         */
+        void reset(const size_t& entries) {
+          size_t capacity = (2 * entries > MIN_CAPACITY ? 2 * entries
+              : MIN_CAPACITY);
+          size_t num_blocks = (capacity * BITS_PER_ENTRY + 255) / 256;
+
+          _Data* p_data = _new_data(capacity, num_blocks);
+          memset(p_data->p_blocks_, 0, num_blocks * sizeof(_Block));
+
+          _unref();
+          p_data_ = p_data;
+        }
+
+        void clear() { _unref(); }
+
+        void add(const _TpKey& key) {
+          _own();
+
+          uint64_t h = key_hash<_TpKey>::of(key);
+          _Block& block = _block_of(h);
+
+          for (uint8_t idx = 0; idx < 8; idx++)
+            block.words_[idx] |= _bit_of(h, idx);
+        }
+
+        /*!
+         * \brief Counts one key removed; returns true once half the capacity is stale and the filter should be built again.
+         */
+        const bool remove() {
+          _own();
+          return (++p_data_->stale_ > p_data_->capacity_ / 2);
+        }
+
+        /*!
+         * \brief Returns false only if key was never added.
+         */
+        const bool may_contain(const _TpKey& key) const {
+          uint64_t h = key_hash<_TpKey>::of(key);
+          const _Block& block = _block_of(h);
+          uint32_t missing = 0;
+
+          for (uint8_t idx = 0; idx < 8; idx++)
+            missing |= _bit_of(h, idx) & ~block.words_[idx];
+
+          return (missing == 0);
+        }
+
+      private:
+        _Data* p_data_;
+    };
+
+  template<typename _TpKey>
+    class _BTreeFilter<_TpKey, false> {
+      public:
+        const bool active() const { return false; }
+        const size_t capacity() const { return 0; }
+
+        void reset(const size_t& entries) {
+          throw std::invalid_argument("set_filter() needs a key_hash for the "
+              "key type");
+        }
+
+        void clear() { }
+        void add(const _TpKey& key) { }
+        const bool remove() { return false; }
+        const bool may_contain(const _TpKey& key) const { return true; }
+    };
+}
+
+#endif  // CBTL_CBT_BTREE_FILTER_H_
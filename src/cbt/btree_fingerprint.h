@@ -0,0 +1,195 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_fingerprint.h
+ * \brief Contains the one-byte key fingerprints leaves may keep for exact lookups.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * Comparing keys such as std::string is far more expensive than comparing
+ * bytes. When key_fingerprint<_TpKey> is enabled, every leaf keeps a byte
+ * of hash per item, and btree::find() looks for its key in a leaf by
+ * matching that byte over the whole leaf first (16 at a time with SSE2).
+ * Only the items whose byte matches are compared, and a missing key
+ * usually costs no key comparison at all in its leaf. Inner nodes keep
+ * none, and ordered operations still use the keys only.
+ *
+ * A leaf has no children, so it keeps its fingerprints where an inner
+ * node keeps its child pointers: they make no node any larger. Keeping
+ * them up to date costs a hash per item a leaf takes in, so they are
+ * disabled for every type until enabled, see key_fingerprint.
+ */
+
+#ifndef CBTL_CBT_BTREE_FINGERPRINT_H_
+#define CBTL_CBT_BTREE_FINGERPRINT_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace cbt {
+  /*!
+   * \brief Tells whether leaves keep fingerprints of _TpKey; disabled unless specialized.
+   *
+   * A specialization enabling them provides ENABLED = true and a static
+   * of(key) returning the fingerprint as uint8_t; equal keys must have
+   * equal fingerprints. For std::string, string_fingerprint is one:
+   *
+   * \code
+   * namespace cbt {
+   *   template<> struct key_fingerprint<std::string> : string_fingerprint { };
+   * }
+   * \endcode
+   *
+   * Enable them for keys that are expensive to compare, and trees mostly
+   * looked up with find(): inserts and erases hash the keys they move into
+   * a leaf, which other searches do not make up for.
+   */
+  template<typename _TpKey>
+    struct key_fingerprint {
+      static const bool ENABLED = false;
+    };
+
+  /*!
+   * \brief FNV-1a of the bytes of a std::string, folded to one byte; see key_fingerprint.
+   */
+  struct string_fingerprint {
+    static const bool ENABLED = true;
+
+    static uint8_t of(const std::string& key) {
+      uint32_t h = 2166136261u;
+
+      for (size_t idx = 0; idx < key.size(); idx++)
+        h = (h ^ static_cast<uint8_t>(key[idx])) * 16777619u;
+
+      return static_cast<uint8_t>(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+    }
+  };
+
+  /*!
+   * \class _BTreeFingerprints
+   * \brief The fingerprint operations of a _BTreeNode, as a base class.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * The node owns the SIZE bytes they are kept in, padded to whole 16-byte
+   * blocks; bytes past the last item are masked off. The specialization
+   * for disabled keys keeps nothing and finds keys plainly.
+   */
+
+  template<typename _TpKey, uint8_t _max,
+    bool _enabled = key_fingerprint<_TpKey>::ENABLED>
+    class _BTreeFingerprints {
+      private:
+        static const uint8_t BLOCK = 16;
+
+      public:
+        static const bool HAS_FINGERPRINTS = true;
+        static const size_t SIZE = (_max + BLOCK - 1) / BLOCK * BLOCK;
+
+      protected:
+        static void _set_fingerprint(uint8_t* p_fps, const uint8_t& idx,
+            const _TpKey& key) {
+          p_fps[idx] = key_fingerprint<_TpKey>::of(key);
+        }
+
+        static void _move_fingerprint(uint8_t* p_fps, const uint8_t& dst,
+            const uint8_t& src) {
+          p_fps[dst] = p_fps[src];
+        }
+
+        /*!
+         * \brief Returns the index of the first of the n items with key, or -1.
+         */
+        template<typename _TpItem>
+          static const int _find(const uint8_t* p_fps, const _TpKey& key,
+              const _TpItem* p_items, const uint8_t& n) {
+            uint8_t fp = key_fingerprint<_TpKey>::of(key);
+
+            for (uint8_t base = 0; base < n; base += BLOCK) {
+              uint32_t mask = _matches(p_fps + base, fp);
+
+              if (n - base < BLOCK)
+                mask &= (1u << (n - base)) - 1;
+
+              for (; mask; mask &= mask - 1) {
+                uint8_t idx = base + __builtin_ctz(mask);
+
+                if (p_items[idx].first == key)
+                  return idx;
+              }
+            }
+
+            return -1;
+          }
+
+      private:
+        /*!
+         * \brief Returns a bit per byte of the block that is equal to fp.
+         */
+        static const uint32_t _matches(const uint8_t* p_block,
+            const uint8_t& fp) {
+#ifdef __SSE2__
+          __m128i block = _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(p_block));
+          return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(fp)));
+#else
+          uint32_t mask = 0;
+
+          for (uint8_t idx = 0; idx < BLOCK; idx++)
+            mask |= static_cast<uint32_t>(p_block[idx] == fp) << idx;
+
+          return mask;
+#endif
+        }
+    };
+
+  template<typename _TpKey, uint8_t _max>
+    class _BTreeFingerprints<_TpKey, _max, false> {
+      public:
+        static const bool HAS_FINGERPRINTS = false;
+        static const size_t SIZE = 0;
+
+      protected:
+        static void _set_fingerprint(uint8_t* p_fps, const uint8_t& idx,
+            const _TpKey& key) { }
+        static void _move_fingerprint(uint8_t* p_fps, const uint8_t& dst,
+            const uint8_t& src) { }
+
+        template<typename _TpItem>
+          static const int _find(const uint8_t* p_fps, const _TpKey& key,
+              const _TpItem* p_items, const uint8_t& n) {
+            for (uint8_t idx = 0; idx < n; idx++) {
+              if (p_items[idx].first == key)
+                return idx;
+            }
+
+            return -1;
+          }
+    };
+}
+
+#endif  // CBTL_CBT_BTREE_FINGERPRINT_H_
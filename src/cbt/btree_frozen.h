@@ -0,0 +1,253 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_frozen.h
+ * \brief Contains frozen_btree, the immutable snapshot btree::freeze() returns.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_FROZEN_H_
+#define CBTL_CBT_BTREE_FROZEN_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace cbt {
+  template<typename _TpKey, typename _TpValue>
+    class frozen_btree;
+
+  /*!
+   * \class _FrozenIterator
+   * \brief The bidirectional iterator of frozen_btree, in key order.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * It holds an Eytzinger position, 0 being end(). The next position in
+   * key order is the leftmost of the right subtree or, without one, the
+   * parent of the first ancestor reached from a left child: amortized O(1)
+   * bit operations, with no key comparison.
+   */
+
+  template<typename _TpKey, typename _TpValue>
+    class _FrozenIterator {
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<_TpKey, _TpValue> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+      public:
+        _FrozenIterator() : p_tree_(NULL), k_(0) { }
+        _FrozenIterator(const frozen_btree<_TpKey, _TpValue>* p_tree,
+            const size_t& k) : p_tree_(p_tree), k_(k) { }
+
+      public:
+        reference operator*() const { return p_tree_->items_[k_]; }
+        pointer operator->() const { return &(operator*()); }
+
+        _FrozenIterator& operator++() {
+          size_t n = p_tree_->size();
+
+          if (2*k_+1 <= n) {
+            k_ = 2*k_+1;
+
+            while (2*k_ <= n)
+              k_ = 2*k_;
+          } else {
+            while (k_ & 1)
+              k_ >>= 1;
+
+            k_ >>= 1;
+          }
+
+          return *this;
+        }
+
+        _FrozenIterator& operator--() {
+          size_t n = p_tree_->size();
+
+          if (k_ == 0) {  // end(): the rightmost position
+            k_ = (n ? 1 : 0);
+
+            while (k_ && 2*k_+1 <= n)
+              k_ = 2*k_+1;
+          } else if (2*k_ <= n) {
+            k_ = 2*k_;
+
+            while (2*k_+1 <= n)
+              k_ = 2*k_+1;
+          } else {
+            while (k_ > 1 && !(k_ & 1))
+              k_ >>= 1;
+
+            k_ >>= 1;
+          }
+
+          return *this;
+        }
+
+        _FrozenIterator operator++(int) {
+          _FrozenIterator it = *this;
+          ++(*this);
+          return it;
+        }
+
+        _FrozenIterator operator--(int) {
+          _FrozenIterator it = *this;
+          --(*this);
+          return it;
+        }
+
+        const bool operator==(const _FrozenIterator& other) const {
+          return (k_ == other.k_ && p_tree_ == other.p_tree_);
+        }
+
+        const bool operator!=(const _FrozenIterator& other) const {
+          return !(*this == other);
+        }
+
+      private:
+        const frozen_btree<_TpKey, _TpValue>* p_tree_;
+        size_t k_;
+    };
+
+  /*!
+   * \class frozen_btree
+   * \brief An immutable, contiguous, pointer-free copy of a btree.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * The entries are laid out in Eytzinger order: the implicit binary search
+   * tree whose root is at position 1 and the children of position k at 2k
+   * and 2k+1. A search is a fixed sequence of one comparison and one shift
+   * per level, with no branch on its outcome, and the keys sit in an array
+   * of their own. Since the 2^d descendants of k at depth d are adjacent,
+   * the search prefetches those that fill a cache line, several levels
+   * ahead of the comparisons. Entries (with their values) are in a parallel
+   * array, touched only once found. Equal keys keep their btree order.
+   */
+
+  template<typename _TpKey, typename _TpValue>
+    class frozen_btree {
+      private:
+        friend class _FrozenIterator<_TpKey, _TpValue>;
+
+      public:
+        typedef _FrozenIterator<_TpKey, _TpValue> iterator;
+
+      public:
+        frozen_btree() : keys_(1), items_(1) { }
+
+        /*!
+         * \brief Builds the snapshot of the entries of the sorted vector.
+         */
+        explicit frozen_btree(const std::vector<std::pair<_TpKey, _TpValue> >&
+            sorted) : keys_(sorted.size()+1), items_(sorted.size()+1) {
+          size_t next = 0;
+          _place(sorted, 1, &next);
+        }
+
+      private:
+        void _place(const std::vector<std::pair<_TpKey, _TpValue> >& sorted,
+            const size_t& k, size_t* p_next) {
+          if (k > size())
+            return;
+
+          _place(sorted, 2*k, p_next);
+          keys_[k] = sorted[*p_next].first;
+          items_[k] = sorted[(*p_next)++];
+          _place(sorted, 2*k+1, p_next);
+        }
+
+        /*!
+         * \brief Returns the number of keys that fill a cache line, rounded down to a power of two.
+         */
+        static const size_t _keys_per_line() {
+          size_t keys = 1;
+
+          while (2 * keys * sizeof(_TpKey) <= 64)
+            keys *= 2;
+
+          return keys;
+        }
+
+        /*!
+         * \brief Returns the position of the first key not less than (or, if _upper, greater than) key, or 0.
+         *
+         * The path taken is the bits of k; the answer is where it last went
+         * left, found by dropping the trailing right turns and that left one.
+         */
+        template<bool _upper>
+          const size_t _search(const _TpKey& key) const {
+            const _TpKey* p_keys = &keys_[0];
+            const size_t n = size();
+            const size_t stride = _keys_per_line();
+            size_t k = 1;
+
+            while (k <= n) {
+              __builtin_prefetch(p_keys + stride * k);
+              k = 2*k + (_upper ? !(key < p_keys[k]) : (p_keys[k] < key));
+            }
+
+            return (k >> __builtin_ffsl(~k));
+          }
+
+      public:
+        iterator begin() const {
+          size_t k = (empty() ? 0 : 1);
+
+          while (k && 2*k <= size())
+            k = 2*k;
+
+          return iterator(this, k);
+        }
+
+        iterator end() const { return iterator(this, 0); }
+
+        iterator lower_bound(const _TpKey& key) const {
+          return iterator(this, _search<false>(key));
+        }
+
+        iterator upper_bound(const _TpKey& key) const {
+          return iterator(this, _search<true>(key));
+        }
+
+        iterator find(const _TpKey& key) const {
+          size_t k = _search<false>(key);
+          return ((k && !(key < keys_[k])) ? iterator(this, k) : end());
+        }
+
+        const size_t size() const { return keys_.size() - 1; }
+        const bool empty() const { return (size() == 0); }
+
+      private:
+        std::vector<_TpKey> keys_;  // position 0 is unused
+        std::vector<std::pair<_TpKey, _TpValue> > items_;
+    };
+}
+
+#endif  // CBTL_CBT_BTREE_FROZEN_H_
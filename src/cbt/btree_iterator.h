@@ -29,49 +29,139 @@
 #ifndef CBTL_CBT_BTREE_ITERATOR_H_
 #define CBTL_CBT_BTREE_ITERATOR_H_
 
+#include <stdint.h>
+#include <cstddef>
+#include <iterator>
 #include <utility>
 
 #include "glog/logging.h"
+#include "cbt/btree_aggregate.h"
 
 namespace cbt {
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
     class _BTreeNode;
 
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    class btree;
+
   /*! 
    * \class _BTreeIterator
    * \brief The _BTreeIterator class template.
    * \author Leandro Costa
    * \date 2011
    *
-   * A _BTreeIterator that points to a tree_node and returns std::pair<_TpKey, _TpValue>.
+   * A bidirectional _BTreeIterator that points to a tree_node and returns
+   * std::pair<_TpKey, _TpValue>. Like _BTreeCursor, it keeps the whole
+   * root-to-node path of its position, so stepping never follows parent
+   * links (which nodes shared with a clone cannot be trusted for) and
+   * never compares keys: it is amortized O(1) per step, whatever the keys.
+   * An iterator returned by begin() or rbegin() knows only its leaf at
+   * first, and walks down the leftmost (or rightmost) spine for the rest
+   * of its path the first time it leaves that leaf.
+   *
+   * Entries may be shared with clones, so they are returned as const. Any
+   * change to the tree invalidates its iterators.
    */
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate = no_aggregate>
     class _BTreeIterator {
       private:
-        typedef _BTreeNode<_TpKey, _TpValue, _order> _Node;
+        typedef _BTreeNode<_TpKey, _TpValue, _order, _Aggregate> _Node;
+
+        template<typename, typename, uint8_t, typename>
+          friend class btree;
+
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<_TpKey, _TpValue> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        static const uint8_t MAX_DEPTH = 64;
+
+      private:
+        enum _Spine { NO_SPINE, LEFT_SPINE, RIGHT_SPINE };
 
       public:
-        _BTreeIterator() : ptr_(NULL), idx_(0) { }
-        _BTreeIterator(_Node* ptr, uint8_t idx = 0) : ptr_(ptr), idx_(idx) { }
+        _BTreeIterator() : pp_root_(NULL), levels_(0), spine_(NO_SPINE) { }
+
+        /*!
+         * \brief Returns end() of the tree whose root is at pp_root.
+         */
+        explicit _BTreeIterator(_Node* const* pp_root)
+          : pp_root_(pp_root), levels_(0), spine_(NO_SPINE) { }
+
+        /*!
+         * \brief Points at idx of the leftmost (or, when right, rightmost) leaf.
+         */
+        _BTreeIterator(_Node* const* pp_root, _Node* p_leaf,
+            const uint8_t& idx, const bool& right)
+          : pp_root_(pp_root), levels_(1),
+          spine_(right ? RIGHT_SPINE : LEFT_SPINE) {
+          nodes_[0] = p_leaf;
+          idx_[0] = idx;
+        }
+
+        _BTreeIterator(const _BTreeIterator& other) { _copy(other); }
+
+        _BTreeIterator& operator=(const _BTreeIterator& other) {
+          _copy(other);
+          return *this;
+        }
 
       private:
+        void _copy(const _BTreeIterator& other) {
+          pp_root_ = other.pp_root_;
+          levels_ = other.levels_;
+          spine_ = other.spine_;
+
+          for (uint8_t d = 0; d < levels_; d++) {
+            nodes_[d] = other.nodes_[d];
+            idx_[d] = other.idx_[d];
+          }
+        }
+
+        /*!
+         * \brief Adds p_node to the path: the child taken, or the item if it is the last level.
+         */
+        void _push(_Node* p_node, const uint8_t& idx) {
+          nodes_[levels_] = p_node;
+          idx_[levels_] = idx;
+          levels_++;
+        }
+
+        /*!
+         * \brief Keeps only the first levels of the path; none makes it end().
+         */
+        void _truncate(const uint8_t& levels) { levels_ = levels; }
+        const uint8_t _levels() const { return levels_; }
+
+        _Node* _node() const { return (levels_ ? nodes_[levels_-1] : NULL); }
+        const uint8_t _idx() const { return (levels_ ? idx_[levels_-1] : 0); }
+
+        void _descend_edge(_Node* p_node, const bool& right);
+        void _find_spine();
         void _incr();
+        void _decr();
 
       public:
         const bool operator==(const _BTreeIterator& other) const {
-          return (ptr_ == other.ptr_ && idx_ == other.idx_);
+          return (_node() == other._node() && _idx() == other._idx());
         }
 
         const bool operator!=(const _BTreeIterator& other) const {
           return !operator==(other);
         }
 
-        std::pair<_TpKey, _TpValue>& operator*() const {
-          return ptr_->item(idx_);
+        reference operator*() const {
+          return nodes_[levels_-1]->item(idx_[levels_-1]);
         }
 
-        std::pair<_TpKey, _TpValue>* operator->() const {
+        pointer operator->() const {
           return &(operator*());
         }
 
@@ -86,39 +176,172 @@ namespace cbt {
           return it;
         }
 
+        _BTreeIterator& operator--() {
+          _decr();
+          return *this;
+        }
+
+        const _BTreeIterator operator--(int i) {
+          _BTreeIterator it = *this;
+          _decr();
+          return it;
+        }
+
       private:
-        _Node* ptr_;
-        uint8_t idx_;
+        _Node* const* pp_root_;
+        _Node* nodes_[MAX_DEPTH];
+        uint8_t idx_[MAX_DEPTH];
+        uint8_t levels_;  // 0 at end()
+        uint8_t spine_;   // the spine the path is still to be found along
     };
 
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
-    void _BTreeIterator<_TpKey, _TpValue, _order>::_incr() {
-      if (idx_+1 < _Node::MAX_NUM_NODES && ptr_->node(idx_+1)) {
-        ptr_ = ptr_->node(idx_+1);
-        idx_ = 0;
+  /*!
+   * \brief Extends the path from p_node down to its first (or, when right, last) item in a leaf.
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate>::_descend_edge(
+        _Node* p_node, const bool& right) {
+      while (!p_node->is_leaf()) {
+        uint8_t idx = (right ? p_node->num_items() : 0);
+        _push(p_node, idx);
+        p_node = p_node->node(idx);
+      }
+
+      _push(p_node, (right ? p_node->num_items()-1 : 0));
+    }
+
+  /*!
+   * \brief Fills in the path above the leaf of begin() or rbegin().
+   */
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate>::_find_spine() {
+      uint8_t idx = idx_[0];
+
+      levels_ = 0;
+      _descend_edge(*pp_root_, spine_ == RIGHT_SPINE);
+      idx_[levels_-1] = idx;
+      spine_ = NO_SPINE;
+    }
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate>::_incr() {
+      uint8_t d = levels_-1;
+      _Node* p_node = nodes_[d];
+
+      if (!p_node->is_leaf()) {  // first item of the right subtree
+        idx_[d]++;
+        _descend_edge(p_node->node(idx_[d]), false);
+      } else if (idx_[d]+1 < p_node->num_items()) {
+        idx_[d]++;
+      } else {  // back to the first ancestor with an item to our right
+        if (spine_ != NO_SPINE)
+          _find_spine();
 
-        while (ptr_->node(0)) {
-          ptr_ = ptr_->node(0);
+        while (--levels_ > 0) {
+          if (idx_[levels_-1] < nodes_[levels_-1]->num_items())
+            return;
         }
-      } else if (idx_+1 < ptr_->num_items()) {
-        idx_++;
-      } else {
-        _TpKey k_old = ptr_->item(idx_).first;
+      }
+    }
 
-        ptr_ = ptr_->parent();
-        idx_ = 0;
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate>
+    void _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate>::_decr() {
+      if (!levels_) {  // end(): last item of the tree
+        _descend_edge(*pp_root_, true);
+        return;
+      }
 
-        while (ptr_ && ptr_->item(idx_).first < k_old) {
-          while (idx_ < ptr_->num_items() && ptr_->item(idx_).first < k_old)
-            idx_++;
+      uint8_t d = levels_-1;
+      _Node* p_node = nodes_[d];
 
-          if (idx_ == ptr_->num_items()) {
-            ptr_ = ptr_->parent();
-            idx_ = 0;
+      if (!p_node->is_leaf()) {  // last item of the left subtree
+        _descend_edge(p_node->node(idx_[d]), true);
+      } else if (idx_[d] > 0) {
+        idx_[d]--;
+      } else {  // back to the first ancestor with an item to our left
+        if (spine_ != NO_SPINE)
+          _find_spine();
+
+        while (--levels_ > 0) {
+          if (idx_[levels_-1] > 0) {
+            idx_[levels_-1]--;
+            return;
           }
         }
       }
     }
+
+  /*! 
+   * \class _BTreeReverseIterator
+   * \brief The _BTreeReverseIterator class template.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Walks a btree from the highest key to the lowest. Unlike
+   * std::reverse_iterator, it points at the item it returns, so
+   * dereferencing does not step the underlying iterator.
+   */
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate = no_aggregate>
+    class _BTreeReverseIterator {
+      private:
+        typedef _BTreeIterator<_TpKey, _TpValue, _order, _Aggregate> _Iterator;
+
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<_TpKey, _TpValue> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+      public:
+        _BTreeReverseIterator() { }
+        explicit _BTreeReverseIterator(const _Iterator& it) : it_(it) { }
+
+      public:
+        const _Iterator base() const { return it_; }
+
+        const bool operator==(const _BTreeReverseIterator& other) const {
+          return (it_ == other.it_);
+        }
+
+        const bool operator!=(const _BTreeReverseIterator& other) const {
+          return !operator==(other);
+        }
+
+        reference operator*() const { return *it_; }
+        pointer operator->() const { return &(*it_); }
+
+        _BTreeReverseIterator& operator++() {
+          --it_;
+          return *this;
+        }
+
+        const _BTreeReverseIterator operator++(int i) {
+          _BTreeReverseIterator it = *this;
+          --it_;
+          return it;
+        }
+
+        _BTreeReverseIterator& operator--() {
+          ++it_;
+          return *this;
+        }
+
+        const _BTreeReverseIterator operator--(int i) {
+          _BTreeReverseIterator it = *this;
+          ++it_;
+          return it;
+        }
+
+      private:
+        _Iterator it_;
+    };
 }
 
 #endif  // CBTL_CBT_BTREE_ITERATOR_H_
@@ -0,0 +1,296 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_key_encoder.h
+ * \brief Contains the order-preserving byte encoding of typed and composite keys.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * A composite key compared field by field costs a chain of branches per
+ * comparison. Encoded, it becomes a std::string whose byte order (that
+ * is, memcmp order) is the order of the original key, so a
+ * btree<std::string, V> holding encoded keys compares them with memcmp
+ * and can also use key_fingerprint, once enabled.
+ *
+ * - Integers are written big-endian, with the sign bit flipped when they
+ *   are signed, in sizeof(T) bytes.
+ * - Floating point numbers are written as their IEEE bits, big-endian,
+ *   with the sign bit flipped when positive and every bit flipped when
+ *   negative. -0.0 comes right before 0.0; NaNs with the sign bit clear
+ *   come after infinity.
+ * - Strings have each 0x00 byte escaped as 0x00 0xff and end with 0x00
+ *   0x01, so a string comes before any longer string it is a prefix of.
+ *
+ * Each field encoding is prefix-free, so fields can simply be appended
+ * one after the other: key_encoder does it for any number of fields,
+ * and key_codec<std::pair<A, B> > for pairs.
+ */
+
+#ifndef CBTL_CBT_BTREE_KEY_ENCODER_H_
+#define CBTL_CBT_BTREE_KEY_ENCODER_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace cbt {
+  /*!
+   * \brief Appends the big-endian n low bytes of bits to *p_out.
+   */
+  inline void _encode_bits(uint64_t bits, const size_t& n, std::string* p_out) {
+    for (size_t shift = 8 * n; shift > 0; shift -= 8)
+      p_out->push_back(static_cast<char>((bits >> (shift - 8)) & 0xff));
+  }
+
+  /*!
+   * \brief Reads n big-endian bytes of in at *p_pos, advancing it.
+   */
+  inline uint64_t _decode_bits(const std::string& in, size_t* p_pos,
+      const size_t& n) {
+    if (in.size() - *p_pos < n)
+      throw std::invalid_argument("truncated key");
+
+    uint64_t bits = 0;
+
+    for (size_t idx = 0; idx < n; idx++)
+      bits = (bits << 8) | static_cast<uint8_t>(in[(*p_pos)++]);
+
+    return bits;
+  }
+
+  /*!
+   * \brief Encoding of the integer type _Tp.
+   */
+  template<typename _Tp>
+    struct _integer_codec {
+      static const uint64_t SIGN = uint64_t(1) << (8 * sizeof(_Tp) - 1);
+
+      static void encode(const _Tp& value, std::string* p_out) {
+        uint64_t bits = static_cast<uint64_t>(value);
+
+        if (std::numeric_limits<_Tp>::is_signed)
+          bits ^= SIGN;
+
+        _encode_bits(bits, sizeof(_Tp), p_out);
+      }
+
+      static void decode(const std::string& in, size_t* p_pos, _Tp* p_value) {
+        uint64_t bits = _decode_bits(in, p_pos, sizeof(_Tp));
+
+        if (std::numeric_limits<_Tp>::is_signed) {
+          bits ^= SIGN;
+
+          if (bits & SIGN)  // sign extension
+            bits |= ~(SIGN - 1);
+        }
+
+        *p_value = static_cast<_Tp>(bits);
+      }
+    };
+
+  /*!
+   * \brief Encoding of the floating point type _Tp, whose bits fit in _TpBits.
+   */
+  template<typename _Tp, typename _TpBits>
+    struct _floating_codec {
+      static const _TpBits SIGN = _TpBits(1) << (8 * sizeof(_Tp) - 1);
+
+      static void encode(const _Tp& value, std::string* p_out) {
+        _TpBits bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits = ((bits & SIGN) ? ~bits : (bits ^ SIGN));
+        _encode_bits(bits, sizeof(bits), p_out);
+      }
+
+      static void decode(const std::string& in, size_t* p_pos, _Tp* p_value) {
+        _TpBits bits = _decode_bits(in, p_pos, sizeof(bits));
+        bits = ((bits & SIGN) ? (bits ^ SIGN) : ~bits);
+        memcpy(p_value, &bits, sizeof(bits));
+      }
+    };
+
+  /*!
+   * \brief How keys of type _Tp are encoded: encode(value, p_out) appends, decode(in, p_pos, p_value) reads.
+   *
+   * Specialized for the integer types, float, double, std::string and
+   * std::pair of encodable types; other types may be added the same way.
+   */
+  template<typename _Tp>
+    struct key_codec;
+
+  template<> struct key_codec<char> : _integer_codec<char> { };
+  template<> struct key_codec<signed char> : _integer_codec<signed char> { };
+  template<> struct key_codec<unsigned char>
+    : _integer_codec<unsigned char> { };
+  template<> struct key_codec<short> : _integer_codec<short> { };
+  template<> struct key_codec<unsigned short>
+    : _integer_codec<unsigned short> { };
+  template<> struct key_codec<int> : _integer_codec<int> { };
+  template<> struct key_codec<unsigned int> : _integer_codec<unsigned int> { };
+  template<> struct key_codec<long> : _integer_codec<long> { };
+  template<> struct key_codec<unsigned long>
+    : _integer_codec<unsigned long> { };
+  template<> struct key_codec<long long> : _integer_codec<long long> { };
+  template<> struct key_codec<unsigned long long>
+    : _integer_codec<unsigned long long> { };
+
+  template<> struct key_codec<float> : _floating_codec<float, uint32_t> { };
+  template<> struct key_codec<double> : _floating_codec<double, uint64_t> { };
+
+  template<>
+    struct key_codec<std::string> {
+      static void encode(const std::string& value, std::string* p_out) {
+        for (size_t idx = 0; idx < value.size(); idx++) {
+          p_out->push_back(value[idx]);
+
+          if (value[idx] == '\0')
+            p_out->push_back('\xff');
+        }
+
+        p_out->push_back('\0');
+        p_out->push_back('\x01');
+      }
+
+      static void decode(const std::string& in, size_t* p_pos,
+          std::string* p_value) {
+        p_value->clear();
+
+        while (true) {
+          if (in.size() - *p_pos < 2)
+            throw std::invalid_argument("truncated key");
+
+          char c = in[(*p_pos)++];
+
+          if (c != '\0') {
+            p_value->push_back(c);
+            continue;
+          }
+
+          c = in[(*p_pos)++];
+
+          if (c == '\xff')
+            p_value->push_back('\0');
+          else if (c == '\x01')
+            return;
+          else
+            throw std::invalid_argument("malformed key");
+        }
+      }
+    };
+
+  template<typename _TpFirst, typename _TpSecond>
+    struct key_codec<std::pair<_TpFirst, _TpSecond> > {
+      static void encode(const std::pair<_TpFirst, _TpSecond>& value,
+          std::string* p_out) {
+        key_codec<_TpFirst>::encode(value.first, p_out);
+        key_codec<_TpSecond>::encode(value.second, p_out);
+      }
+
+      static void decode(const std::string& in, size_t* p_pos,
+          std::pair<_TpFirst, _TpSecond>* p_value) {
+        key_codec<_TpFirst>::decode(in, p_pos, &p_value->first);
+        key_codec<_TpSecond>::decode(in, p_pos, &p_value->second);
+      }
+    };
+
+  /*!
+   * \class key_encoder
+   * \brief Builds an encoded key from any number of fields.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * key_encoder().add(id).add(name).add(score).str() orders as the tuple
+   * (id, name, score) would.
+   */
+
+  class key_encoder {
+    public:
+      template<typename _Tp>
+        key_encoder& add(const _Tp& value) {
+          key_codec<_Tp>::encode(value, &bytes_);
+          return *this;
+        }
+
+      const std::string& str() const { return bytes_; }
+
+    private:
+      std::string bytes_;
+  };
+
+  /*!
+   * \class key_decoder
+   * \brief Reads back, in the same order, the fields of a key built by key_encoder.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Throws std::invalid_argument when the key ends before a field does,
+   * or a string field holds a 0x00 byte followed by neither 0x01 nor 0xff.
+   */
+
+  class key_decoder {
+    public:
+      explicit key_decoder(const std::string& bytes) : bytes_(bytes), pos_(0) { }
+
+    public:
+      template<typename _Tp>
+        key_decoder& get(_Tp* p_value) {
+          key_codec<_Tp>::decode(bytes_, &pos_, p_value);
+          return *this;
+        }
+
+      const bool done() const { return (pos_ == bytes_.size()); }
+
+    private:
+      std::string bytes_;
+      size_t pos_;
+  };
+
+  /*!
+   * \brief Returns the order-preserving encoding of key.
+   */
+  template<typename _Tp>
+    std::string encode_key(const _Tp& key) {
+      std::string bytes;
+      key_codec<_Tp>::encode(key, &bytes);
+      return bytes;
+    }
+
+  /*!
+   * \brief Returns the key encode_key() turned into bytes.
+   */
+  template<typename _Tp>
+    _Tp decode_key(const std::string& bytes) {
+      _Tp key;
+      size_t pos = 0;
+      key_codec<_Tp>::decode(bytes, &pos, &key);
+
+      if (pos != bytes.size())
+        throw std::invalid_argument("trailing bytes in key");
+
+      return key;
+    }
+}
+
+#endif  // CBTL_CBT_BTREE_KEY_ENCODER_H_
@@ -0,0 +1,170 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_key_probe.h
+ * \brief Contains key_probe, telling which types a btree looks up without converting them to its key type.
+ * \author Leandro Costa
+ * \date 2011
+ *
+ * btree::find(), lower_bound(), upper_bound() and erase() take a const
+ * _TpKey&, so looking up a std::string key with a const char* builds a
+ * temporary string, and allocates, for every lookup. For every _TpProbe
+ * that key_probe<_TpKey, _TpProbe> enables, they also take a const
+ * _TpProbe& and compare it with the keys of the nodes as it is, the way
+ * a transparent comparator does for std::map. The one exception is a C
+ * string looked up among std::string keys, which is measured once and
+ * then compared with memcmp().
+ */
+
+#ifndef CBTL_CBT_BTREE_KEY_PROBE_H_
+#define CBTL_CBT_BTREE_KEY_PROBE_H_
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace cbt {
+  /*!
+   * \brief Tells whether a btree of _TpKey looks _TpProbe up as it is; disabled by default.
+   *
+   * A specialization enabling it provides ENABLED = true. key < probe,
+   * probe < key and key == probe must then be defined, and order a probe
+   * among the keys as the _TpKey it stands for would be. Lookups of a
+   * probe do not use the fingerprints of the leaves (see
+   * cbt/btree_node.h), which work on _TpKey.
+   */
+  template<typename _TpKey, typename _TpProbe>
+    struct key_probe {
+      static const bool ENABLED = false;
+    };
+
+  template<> struct key_probe<std::string, const char*> {
+    static const bool ENABLED = true;
+  };
+
+  template<> struct key_probe<std::string, char*> {
+    static const bool ENABLED = true;
+  };
+
+  template<size_t _len> struct key_probe<std::string, char[_len]> {
+    static const bool ENABLED = true;
+  };
+
+#if __cplusplus >= 201703L
+  template<> struct key_probe<std::string, std::string_view> {
+    static const bool ENABLED = true;
+  };
+#endif
+
+  /*!
+   * \class _BTreeCharsProbe
+   * \brief A C string probe, measured once, that std::string keys compare with by memcmp().
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * std::string compares with a const char* by measuring it first, which
+   * a descent would do at every item it passes.
+   */
+  struct _BTreeCharsProbe {
+    explicit _BTreeCharsProbe(const char* p_chars)
+      : p_chars_(p_chars), len_(strlen(p_chars)) { }
+
+    /*!
+     * \brief Returns a three-way comparison of key with the probe.
+     */
+    const int compare(const std::string& key) const {
+      size_t len = (key.size() < len_ ? key.size() : len_);
+      int c = memcmp(key.data(), p_chars_, len);
+
+      if (c != 0)
+        return c;
+
+      return (key.size() < len_ ? -1 : (key.size() > len_ ? 1 : 0));
+    }
+
+    const char* p_chars_;
+    size_t len_;
+  };
+
+  inline bool operator<(const std::string& key, const _BTreeCharsProbe& probe) {
+    return (probe.compare(key) < 0);
+  }
+
+  inline bool operator<(const _BTreeCharsProbe& probe, const std::string& key) {
+    return (probe.compare(key) > 0);
+  }
+
+  inline bool operator==(const std::string& key,
+      const _BTreeCharsProbe& probe) {
+    return (key.size() == probe.len_
+        && memcmp(key.data(), probe.p_chars_, probe.len_) == 0);
+  }
+
+  /*!
+   * \brief Gives what a btree of _TpKey compares its keys with for a _TpProbe: the probe itself.
+   */
+  template<typename _TpKey, typename _TpProbe>
+    struct _BTreeProbeView {
+      typedef const _TpProbe& type;
+
+      static type of(const _TpProbe& probe) { return probe; }
+    };
+
+  /*!
+   * \brief A _BTreeCharsProbe, for C strings looked up among std::string keys.
+   */
+  template<typename _TpProbe>
+    struct _BTreeCharsProbeView {
+      typedef _BTreeCharsProbe type;
+
+      static type of(const _TpProbe& probe) { return _BTreeCharsProbe(probe); }
+    };
+
+  template<>
+    struct _BTreeProbeView<std::string, const char*>
+    : _BTreeCharsProbeView<const char*> { };
+
+  template<>
+    struct _BTreeProbeView<std::string, char*>
+    : _BTreeCharsProbeView<char*> { };
+
+  template<size_t _len>
+    struct _BTreeProbeView<std::string, char[_len]>
+    : _BTreeCharsProbeView<char[_len]> { };
+
+  /*!
+   * \brief Declares type as _Tp only when _enabled, to leave overloads out of overload resolution.
+   */
+  template<bool _enabled, typename _Tp>
+    struct _BTreeEnableIf {
+      typedef _Tp type;
+    };
+
+  template<typename _Tp>
+    struct _BTreeEnableIf<false, _Tp> { };
+}
+
+#endif  // CBTL_CBT_BTREE_KEY_PROBE_H_
@@ -30,14 +30,33 @@
 #define CBTL_CBT_BTREE_NODE_H_
 
 #include <stdint.h>
+#include <cstddef>
 #include <cstring>
+#include <new>
 #include <utility>
 
 #include "glog/logging.h"
+#include "cbt/btree_aggregate.h"
+#include "cbt/btree_arena.h"
+#include "cbt/btree_fingerprint.h"
 
 namespace cbt {
-  template<typename _TpKey, typename _TpValue, uint8_t _order>
-    class _BTreeNode {
+  /*!
+   * \class _BTreeNode
+   * \brief The _BTreeNode class template.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * A node is a leaf as long as it has no first child. A leaf uses none of
+   * its other child slots, and keeps its fingerprints there, if any (see
+   * key_fingerprint), so those slots are only written in inner nodes: a
+   * new node that is to be inner gets its first child before any item.
+   */
+
+  template<typename _TpKey, typename _TpValue, uint8_t _order,
+    typename _Aggregate = no_aggregate>
+    class _BTreeNode : public _BTreeAggregateSlot<_Aggregate>,
+    public _BTreeFingerprints<_TpKey, 2*_order> {
       public:
         static const uint8_t MAX_NUM_ITEMS = 2*_order;
         static const uint8_t MAX_NUM_NODES = MAX_NUM_ITEMS+1;
@@ -46,22 +65,258 @@ namespace cbt {
         typedef std::pair<_TpKey, _TpValue> _TpItem;
 
       public:
-        _BTreeNode() : parent_(NULL), num_items_(0) {
-          memset(&nodes_, 0, MAX_NUM_NODES * sizeof(*nodes_));
+        explicit _BTreeNode(const uint64_t& owner = 0)
+          : parent_(NULL), count_(0), owner_(owner), refs_(1), p_arena_(NULL),
+          num_items_(0) {
+          memset(&nodes_, 0, sizeof(nodes_));
+        }
+
+      private:
+        typedef _BTreeFingerprints<_TpKey, 2*_order> _Fingerprints;
+
+        /*!
+         * \brief The child slots: enough for the children, and for the fingerprints of a leaf past the first.
+         */
+        static const size_t NUM_SLOTS = (MAX_NUM_NODES > 1
+            + (_Fingerprints::SIZE + sizeof(void*) - 1) / sizeof(void*)
+            ? MAX_NUM_NODES
+            : 1 + (_Fingerprints::SIZE + sizeof(void*) - 1) / sizeof(void*));
+
+      private:
+        uint8_t* _fingerprints() {
+          return reinterpret_cast<uint8_t*>(nodes_ + 1);
+        }
+
+        const uint8_t* _fingerprints() const {
+          return reinterpret_cast<const uint8_t*>(nodes_ + 1);
+        }
+
+        /*!
+         * \brief Returns the child at idx, or NULL in a leaf, whose slots may hold fingerprints.
+         */
+        _BTreeNode* _child(const uint8_t& idx) const {
+          return (is_leaf() ? NULL : nodes_[idx]);
+        }
+
+        void _set_parent_of(_BTreeNode* p_node) {
+          if (p_node && p_node->owner_ == owner_)
+            p_node->parent_ = this;
+        }
+
+        void _put(const uint8_t& idx, const _TpItem& item) {
+          items_[idx] = item;
+
+          if (_Fingerprints::HAS_FINGERPRINTS && is_leaf())
+            this->_set_fingerprint(_fingerprints(), idx, item.first);
+        }
+
+        /*!
+         * \brief Moves the item at src to dst, with the node at its right in an inner node.
+         */
+        void _move(const uint8_t& dst, const uint8_t& src) {
+          items_[dst] = items_[src];
+
+          if (!is_leaf())
+            nodes_[dst+1] = nodes_[src+1];
+          else if (_Fingerprints::HAS_FINGERPRINTS)
+            this->_move_fingerprint(_fingerprints(), dst, src);
+        }
+
+        /*!
+         * \brief Resets the items from idx to end, which are no longer in use.
+         *
+         * A stale copy would otherwise keep what the item refers to (say,
+         * a boxed value or a string buffer) alive until the slot is reused.
+         */
+        void _clear(const uint8_t& idx, const uint8_t& end) {
+          for (uint8_t i = idx; i < end; i++)
+            items_[i] = _TpItem();
         }
 
       public:
         _BTreeNode* parent() const { return parent_; }
 
-        _BTreeNode* node(const uint8_t& idx) const { return nodes_[idx]; }
+        _BTreeNode* node(const uint8_t& idx) const {
+          return ((_Fingerprints::HAS_FINGERPRINTS && idx > 0) ? _child(idx)
+              : nodes_[idx]);
+        }
         void set_node(const uint8_t& idx, _BTreeNode* _ptr_node) {
           nodes_[idx] = _ptr_node;
         }
 
         _TpItem& item(const uint8_t& idx) { return items_[idx]; }
+
+        /*!
+         * \brief Replaces the item at idx, whose key may differ.
+         */
+        void set_item(const uint8_t& idx, const _TpItem& item) {
+          _put(idx, item);
+        }
+
+        /*!
+         * \brief Returns the index of the first item whose key is not less than key.
+         */
+        const uint8_t lower_index(const _TpKey& key) const {
+          uint8_t idx = 0;
+
+          while (idx < num_items_ && items_[idx].first < key)
+            idx++;
+
+          return idx;
+        }
+
+        /*!
+         * \brief Returns the index of the first item whose key is greater than key.
+         */
+        const uint8_t upper_index(const _TpKey& key) const {
+          uint8_t idx = 0;
+
+          while (idx < num_items_ && !(key < items_[idx].first))
+            idx++;
+
+          return idx;
+        }
+
+        /*!
+         * \brief As lower_index() (or, if upper, upper_index()), for a key of another type; see key_probe.
+         */
+        template<typename _TpProbe>
+          const uint8_t probe_index(const _TpProbe& key,
+              const bool& upper) const {
+            uint8_t idx = 0;
+
+            while (idx < num_items_ && (upper ? !(key < items_[idx].first)
+                  : items_[idx].first < key))
+              idx++;
+
+            return idx;
+          }
+
+        /*!
+         * \brief Returns the index of the first item with key, or -1; see key_fingerprint.
+         */
+        const int find(const _TpKey& key) const {
+          return this->_find(_fingerprints(), key, items_, num_items_);
+        }
+
         inline const uint8_t num_items() const { return num_items_; }
 
+        /*!
+         * \brief Returns the number of items in the subtree rooted at this node.
+         */
+        const size_t count() const { return count_; }
+        void add_count(const ptrdiff_t& delta) { count_ += delta; }
+
+        /*!
+         * \brief Recomputes count() and aggregate() from the items and the children.
+         */
+        void recount() {
+          count_ = num_items_;
+
+          if (!is_leaf()) {
+            for (uint8_t idx = 0; idx <= num_items_; idx++)
+              count_ += nodes_[idx]->count_;
+          }
+
+          this->_reaggregate(*this);
+        }
+
+        /*!
+         * \brief Recomputes aggregate() only, after the entries of the subtree changed.
+         */
+        void reaggregate() { this->_reaggregate(*this); }
+
         void set_parent(_BTreeNode* p_node) { parent_ = p_node; }
+
+        /*!
+         * \brief Sets the node at idx, and its parent if both have the same owner.
+         *
+         * A node that belongs to another owner may be shared, so its parent
+         * link is left alone; see btree::clone().
+         */
+        void attach(const uint8_t& idx, _BTreeNode* p_node) {
+          nodes_[idx] = p_node;
+          _set_parent_of(p_node);
+        }
+
+        /*!
+         * \brief Returns the tag of the tree allowed to change this node in place.
+         */
+        const uint64_t owner() const { return owner_; }
+        void set_owner(const uint64_t& owner) { owner_ = owner; }
+
+        /*!
+         * \brief Returns how many nodes (or trees, for a root) refer to this node.
+         */
+        const uint32_t refs() const {
+          return __atomic_load_n(&refs_, __ATOMIC_ACQUIRE);
+        }
+        void ref() { __atomic_add_fetch(&refs_, 1, __ATOMIC_RELAXED); }
+
+        /*!
+         * \brief Drops one reference, returning true when it was the last one.
+         */
+        const bool unref() {
+          return (__atomic_sub_fetch(&refs_, 1, __ATOMIC_ACQ_REL) == 0);
+        }
+
+        /*!
+         * \brief Returns a copy owned by owner, which shares every child with this node.
+         */
+        _BTreeNode* copy(const uint64_t& owner) const {
+          _BTreeNode* p_copy = new _BTreeNode(owner);
+
+          for (uint8_t idx = 0; idx < num_items_; idx++)
+            p_copy->items_[idx] = items_[idx];
+
+          if (!is_leaf()) {
+            for (uint8_t idx = 0; idx <= num_items_; idx++) {
+              p_copy->nodes_[idx] = nodes_[idx];
+              nodes_[idx]->ref();
+            }
+          } else if (_Fingerprints::HAS_FINGERPRINTS) {
+            memcpy(p_copy->_fingerprints(), _fingerprints(),
+                _Fingerprints::SIZE);
+          }
+
+          p_copy->count_ = count_;
+          p_copy->num_items_ = num_items_;
+          static_cast<_BTreeAggregateSlot<_Aggregate>&>(*p_copy) = *this;
+
+          return p_copy;
+        }
+
+        /*!
+         * \brief Returns an exact copy of this node built in a slot of p_arena.
+         *
+         * The copy takes over the children and the references of this node,
+         * which is then only to be destroyed; see btree::compact().
+         */
+        _BTreeNode* relocate(_BTreeArena* p_arena) const {
+          _BTreeNode* p_copy = new (p_arena->allocate()) _BTreeNode(*this);
+          p_copy->p_arena_ = p_arena;
+          return p_copy;
+        }
+
+        /*!
+         * \brief Returns the chunk this node lives in, or NULL if it was allocated alone.
+         */
+        _BTreeArena* arena() const { return p_arena_; }
+
+        /*!
+         * \brief Deletes p_node, giving its slot back if it lives in a chunk.
+         */
+        static void destroy(_BTreeNode* p_node) {
+          _BTreeArena* p_arena = p_node->p_arena_;
+
+          if (p_arena) {
+            p_node->~_BTreeNode();
+            p_arena->release();
+          } else {
+            delete p_node;
+          }
+        }
+
         const bool is_leaf() const { return (nodes_[0] == NULL); }
 
         void insert(const _TpItem& item, _BTreeNode* p_node_right = NULL) {
@@ -71,66 +326,206 @@ namespace cbt {
           uint8_t i = num_items_;
 
           while (i > 0 && items_[i-1].first > item.first) {
-            items_[i] = items_[i-1];
-            nodes_[i+1] = nodes_[i];
+            _move(i, i-1);
             i--;
           }
 
-          items_[i] = item;
-          nodes_[i+1] = p_node_right;
+          _put(i, item);
+
+          if (!is_leaf())
+            nodes_[i+1] = p_node_right;
+
+          num_items_++;
+        }
+
+        /*!
+         * \brief Inserts item at idx, with p_node_right becoming the node at its right.
+         */
+        void insert_at(const uint8_t& idx, const _TpItem& item,
+            _BTreeNode* p_node_right) {
+          if (num_items_ == MAX_NUM_ITEMS)
+            throw std::exception();
+
+          for (uint8_t i = num_items_; i > idx; i--)
+            _move(i, i-1);
+
+          _put(idx, item);
+
+          if (!is_leaf())
+            nodes_[idx+1] = p_node_right;
+
           num_items_++;
         }
 
-        _BTreeNode* split(_BTreeNode* p_node_left) {
-          _BTreeNode* p_new_node_right = new _BTreeNode();
+        /*!
+         * \brief Splits a full node while inserting *p_item at idx, as insert_at() would.
+         *
+         * This node keeps the lower half and the upper half goes to the
+         * returned node. On return, *p_item holds the median item, which
+         * separates both halves. Positions are used rather than keys, so
+         * equal keys keep their order across the split.
+         */
+        _BTreeNode* split(const uint8_t& idx, _TpItem* p_item,
+            _BTreeNode* p_node_right) {
+          _TpItem items[MAX_NUM_ITEMS+1];
+          _BTreeNode* nodes[MAX_NUM_NODES+1];
+
+          nodes[0] = nodes_[0];
 
-          for (uint8_t idx = _order; idx < num_items_; idx++) {
-            p_new_node_right->insert(items_[idx], nodes_[idx+1]);
-            nodes_[idx+1] = NULL;
+          for (uint8_t i = 0, j = 0; i <= MAX_NUM_ITEMS; i++) {
+            if (i == idx) {
+              items[i] = *p_item;
+              nodes[i+1] = p_node_right;
+            } else {
+              items[i] = items_[j];
+              nodes[i+1] = _child(j+1);
+              j++;
+            }
           }
 
-          if (p_node_left)
-            p_node_left->parent_ = p_new_node_right;
+          _BTreeNode* p_new_node_right = new _BTreeNode(owner_);
+          p_new_node_right->attach(0, nodes[_order+1]);
+
+          for (uint8_t i = _order+1; i <= MAX_NUM_ITEMS; i++)
+            p_new_node_right->push_back(items[i], nodes[i+1]);
 
-          p_new_node_right->nodes_[0] = p_node_left;
+          for (uint8_t i = 0; i < _order; i++) {
+            _put(i, items[i]);
+
+            if (!is_leaf())
+              attach(i+1, nodes[i+1]);
+          }
+
+          if (!is_leaf()) {
+            for (uint8_t i = _order+1; i < MAX_NUM_NODES; i++)
+              nodes_[i] = NULL;
+          }
+
+          *p_item = items[_order];
+          _clear(_order, num_items_);
           num_items_ = _order;
 
           return p_new_node_right;
         }
 
-        void get_median_item_rnode(_TpItem* p_item, _BTreeNode** pp_node) {
-          for (uint8_t idx = 0; idx < _order; idx++) {
-            if (p_item->first < items_[idx].first) {
-              _TpItem tmp = *p_item;
-              _BTreeNode* p_node_tmp = *pp_node;
+        /*!
+         * \brief Replaces the contents by n items and, unless pp_nodes is NULL, n+1 nodes.
+         */
+        void assign(const _TpItem* p_items, const uint8_t& n,
+            _BTreeNode* const* pp_nodes) {
+          memset(&nodes_, 0, sizeof(nodes_));
 
-              *p_item = items_[idx];
-              *pp_node = nodes_[idx+1];
+          if (pp_nodes) {
+            for (uint8_t idx = 0; idx <= n; idx++)
+              attach(idx, pp_nodes[idx]);
+          }
 
-              items_[idx] = tmp;
-              nodes_[idx+1] = p_node_tmp;
-            }
+          for (uint8_t idx = 0; idx < n; idx++)
+            _put(idx, p_items[idx]);
+
+          _clear(n, num_items_);
+          num_items_ = n;
+        }
+
+        /*!
+         * \brief Removes the item at idx together with the node at its right.
+         */
+        void erase(const uint8_t& idx) {
+          for (uint8_t i = idx; i+1 < num_items_; i++)
+            _move(i, i+1);
+
+          if (!is_leaf())
+            nodes_[num_items_] = NULL;
+
+          num_items_--;
+          _clear(num_items_, num_items_+1);
+        }
+
+        /*!
+         * \brief Prepends an item, with p_node_left becoming the first node.
+         */
+        void push_front(const _TpItem& item, _BTreeNode* p_node_left) {
+          for (uint8_t i = num_items_; i > 0; i--)
+            _move(i, i-1);
+
+          _put(0, item);
+
+          if (!is_leaf()) {
+            nodes_[1] = nodes_[0];
+            nodes_[0] = p_node_left;
           }
 
-          for (uint8_t idx = MAX_NUM_ITEMS-1; idx >= _order; idx--) {
-            if (p_item->first > items_[idx].first) {
-              _TpItem tmp = *p_item;
-              _BTreeNode* p_node_tmp = *pp_node;
+          num_items_++;
 
-              *p_item = items_[idx];
-              *pp_node = nodes_[idx+1];
+          _set_parent_of(p_node_left);
+        }
 
-              items_[idx] = tmp;
-              nodes_[idx+1] = p_node_tmp;
-            }
+        /*!
+         * \brief Removes the first item together with the first node.
+         */
+        void pop_front() {
+          if (!is_leaf()) {
+            nodes_[0] = nodes_[1];
+            nodes_[1] = NULL;
           }
+
+          for (uint8_t i = 0; i+1 < num_items_; i++)
+            _move(i, i+1);
+
+          if (!is_leaf())
+            nodes_[num_items_] = NULL;
+
+          num_items_--;
+          _clear(num_items_, num_items_+1);
+        }
+
+        /*!
+         * \brief Appends an item, with p_node_right becoming the last node.
+         */
+        void push_back(const _TpItem& item, _BTreeNode* p_node_right) {
+          _put(num_items_, item);
+
+          if (!is_leaf())
+            nodes_[num_items_+1] = p_node_right;
+
+          num_items_++;
+
+          _set_parent_of(p_node_right);
+        }
+
+        /*!
+         * \brief Appends separator and every item and node of p_node_right.
+         *
+         * p_node_right is left empty; deleting it is up to the caller.
+         */
+        void merge(const _TpItem& separator, _BTreeNode* p_node_right) {
+          push_back(separator, p_node_right->nodes_[0]);
+
+          for (uint8_t i = 0; i < p_node_right->num_items_; i++)
+            push_back(p_node_right->items_[i], p_node_right->_child(i+1));
+
+          p_node_right->_clear(0, p_node_right->num_items_);
+          p_node_right->num_items_ = 0;
+        }
+
+        const uint8_t index_of(const _BTreeNode* p_node) const {
+          uint8_t idx = 0;
+
+          while (nodes_[idx] != p_node)
+            idx++;
+
+          return idx;
         }
 
         const bool empty() const { return (num_items_ == 0); }
 
       private:
         _BTreeNode* parent_;
-        _BTreeNode* nodes_[MAX_NUM_NODES];
+        _BTreeNode* nodes_[NUM_SLOTS];
+        size_t count_;
+        uint64_t owner_;
+        uint32_t refs_;
+        _BTreeArena* p_arena_;
 
         _TpItem items_[MAX_NUM_ITEMS];
 
@@ -0,0 +1,428 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_parallel.h
+ * \brief Contains the threading helpers behind the parallel btree operations.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_PARALLEL_H_
+#define CBTL_CBT_BTREE_PARALLEL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace cbt {
+  /*!
+   * \class _BTreeThreadPool
+   * \brief The worker threads behind the parallel btree operations.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * There is one pool per process. It starts without threads and creates
+   * them on demand, as run() needs them, then keeps them for later calls;
+   * they wait for work on a condition variable between calls. Threads
+   * that wait for their tasks to finish run queued tasks meanwhile, so a
+   * task may itself use the pool, and every task runs even if no worker
+   * thread could be created.
+   */
+
+  class _BTreeThreadPool {
+    private:
+      struct _Job {
+        void (*run_)(void*);
+        void* p_task_;
+        size_t* p_pending_;
+      };
+
+      template<typename _Task>
+        static void _run_task(void* p_task) {
+          (*static_cast<_Task*>(p_task))();
+        }
+
+      static void* _work(void* p_pool) {
+        static_cast<_BTreeThreadPool*>(p_pool)->_serve();
+        return NULL;
+      }
+
+    private:
+      _BTreeThreadPool() : num_threads_(0) {
+        pthread_mutex_init(&mutex_, NULL);
+        pthread_cond_init(&work_, NULL);
+        pthread_cond_init(&done_, NULL);
+      }
+
+    public:
+      /*!
+       * \brief Returns the pool, which is never destroyed.
+       */
+      static _BTreeThreadPool& instance() {
+        static _BTreeThreadPool* p_pool = new _BTreeThreadPool();
+        return *p_pool;
+      }
+
+      /*!
+       * \brief Runs every task, on the calling thread and up to tasks.size()-1 workers, and waits for all of them.
+       */
+      template<typename _Task>
+        void run(std::vector<_Task>& tasks) {
+          if (tasks.empty())
+            return;
+
+          size_t pending = tasks.size() - 1;
+
+          pthread_mutex_lock(&mutex_);
+          _grow(tasks.size() - 1);
+
+          for (size_t idx = 1; idx < tasks.size(); idx++) {
+            _Job job = { &_run_task<_Task>, &tasks[idx], &pending };
+            jobs_.push_back(job);
+          }
+
+          pthread_cond_broadcast(&work_);
+          pthread_mutex_unlock(&mutex_);
+
+          tasks[0]();
+
+          pthread_mutex_lock(&mutex_);
+
+          while (pending > 0) {
+            if (jobs_.empty())
+              pthread_cond_wait(&done_, &mutex_);
+            else
+              _run_front();
+          }
+
+          pthread_mutex_unlock(&mutex_);
+        }
+
+      /*!
+       * \brief Returns how many worker threads the pool has created so far.
+       */
+      const size_t num_threads() {
+        pthread_mutex_lock(&mutex_);
+        size_t n = num_threads_;
+        pthread_mutex_unlock(&mutex_);
+        return n;
+      }
+
+    private:
+      /*!
+       * \brief Creates workers until there are n, if it can; the mutex must be held.
+       */
+      void _grow(const size_t& n) {
+        while (num_threads_ < n) {
+          pthread_t thread;
+
+          if (pthread_create(&thread, NULL, &_work, this) != 0)
+            return;
+
+          pthread_detach(thread);
+          num_threads_++;
+        }
+      }
+
+      /*!
+       * \brief Runs the first queued job without the mutex, which must be held.
+       */
+      void _run_front() {
+        _Job job = jobs_.front();
+        jobs_.pop_front();
+
+        pthread_mutex_unlock(&mutex_);
+        job.run_(job.p_task_);
+        pthread_mutex_lock(&mutex_);
+
+        --*job.p_pending_;
+        pthread_cond_broadcast(&done_);
+      }
+
+      void _serve() {
+        pthread_mutex_lock(&mutex_);
+
+        while (true) {
+          while (jobs_.empty())
+            pthread_cond_wait(&work_, &mutex_);
+
+          _run_front();
+        }
+      }
+
+    private:
+      pthread_mutex_t mutex_;
+      pthread_cond_t work_;
+      pthread_cond_t done_;
+      std::deque<_Job> jobs_;
+      size_t num_threads_;
+  };
+
+  /*!
+   * \brief Runs every task, each on a thread of its own, and waits for all of them.
+   *
+   * The calling thread runs the first task; the others go to the workers
+   * of _BTreeThreadPool, which outlive the call.
+   */
+  template<typename _Task>
+    void _run_tasks(std::vector<_Task>& tasks) {
+      _BTreeThreadPool::instance().run(tasks);
+    }
+
+  /*!
+   * \brief Returns threads, or the number of online processors when it is 0.
+   */
+  inline size_t _num_threads(const size_t& threads) {
+    if (threads > 0)
+      return threads;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0 ? cpus : 1);
+  }
+
+  /*!
+   * \brief The tasks a _StealWorker has left: [begin_, end_) of the task vector.
+   */
+  struct _StealQueue {
+    pthread_mutex_t mutex_;
+    size_t begin_;
+    size_t end_;
+  };
+
+  /*!
+   * \brief One thread of _run_stealing().
+   *
+   * It runs its own queue from the front. Once that is empty, it steals
+   * the back half of the first non-empty queue of another worker.
+   */
+  template<typename _Task>
+    struct _StealWorker {
+      void operator()() {
+        _StealQueue& own = (*p_queues_)[id_];
+        size_t task;
+
+        while (true) {
+          pthread_mutex_lock(&own.mutex_);
+          bool found = (own.begin_ < own.end_);
+
+          if (found)
+            task = own.begin_++;
+
+          pthread_mutex_unlock(&own.mutex_);
+
+          if (found)
+            (*p_tasks_)[task]();
+          else if (!_steal())
+            return;
+        }
+      }
+
+      const bool _steal() {
+        size_t n = p_queues_->size();
+
+        for (size_t idx = 1; idx < n; idx++) {
+          _StealQueue& victim = (*p_queues_)[(id_ + idx) % n];
+          size_t begin = 0, end = 0;
+
+          pthread_mutex_lock(&victim.mutex_);
+
+          if (victim.begin_ < victim.end_) {
+            end = victim.end_;
+            begin = victim.end_ - (victim.end_ - victim.begin_ + 1) / 2;
+            victim.end_ = begin;
+          }
+
+          pthread_mutex_unlock(&victim.mutex_);
+
+          if (begin < end) {
+            _StealQueue& own = (*p_queues_)[id_];
+
+            pthread_mutex_lock(&own.mutex_);
+            own.begin_ = begin;
+            own.end_ = end;
+            pthread_mutex_unlock(&own.mutex_);
+
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      std::vector<_StealQueue>* p_queues_;
+      std::vector<_Task>* p_tasks_;
+      size_t id_;
+    };
+
+  /*!
+   * \brief Runs every task on up to threads workers that balance the load by stealing.
+   *
+   * Each worker starts with a contiguous block of the tasks, so tasks that
+   * are neighbours (in key order, for the btree) tend to run on the same
+   * thread; tasks that take longer than others are evened out by stealing.
+   */
+  template<typename _Task>
+    void _run_stealing(std::vector<_Task>& tasks, size_t threads) {
+      if (threads > tasks.size())
+        threads = tasks.size();
+
+      if (threads <= 1) {
+        for (size_t idx = 0; idx < tasks.size(); idx++)
+          tasks[idx]();
+
+        return;
+      }
+
+      std::vector<_StealQueue> queues(threads);
+      std::vector<_StealWorker<_Task> > workers(threads);
+
+      for (size_t t = 0; t < threads; t++) {
+        pthread_mutex_init(&queues[t].mutex_, NULL);
+        queues[t].begin_ = t * tasks.size() / threads;
+        queues[t].end_ = (t+1) * tasks.size() / threads;
+
+        workers[t].p_queues_ = &queues;
+        workers[t].p_tasks_ = &tasks;
+        workers[t].id_ = t;
+      }
+
+      _run_tasks(workers);
+
+      for (size_t t = 0; t < threads; t++)
+        pthread_mutex_destroy(&queues[t].mutex_);
+    }
+
+  template<typename _TpItem>
+    struct _FirstLess {
+      bool operator()(const _TpItem& a, const _TpItem& b) const {
+        return (a.first < b.first);
+      }
+    };
+
+  /*!
+   * \brief One thread's share of _parallel_partition().
+   *
+   * The first pass finds the bucket of every item of the chunk and counts
+   * them; the second copies them to the offsets reserved for the chunk.
+   */
+  template<typename _TpItem>
+    struct _PartitionTask {
+      typedef typename _TpItem::first_type _TpKey;
+
+      void operator()() {
+        if (p_offsets_ == NULL) {
+          for (size_t idx = begin_; idx < end_; idx++) {
+            uint32_t bucket = std::upper_bound(p_splitters_->begin(),
+                p_splitters_->end(), (*p_in_)[idx].first) - p_splitters_->begin();
+            (*p_buckets_)[idx] = bucket;
+            (*p_counts_)[bucket]++;
+          }
+        } else {
+          std::vector<size_t> offsets = *p_offsets_;
+
+          for (size_t idx = begin_; idx < end_; idx++)
+            (*p_out_)[offsets[(*p_buckets_)[idx]]++] = (*p_in_)[idx];
+        }
+      }
+
+      const std::vector<_TpItem>* p_in_;
+      std::vector<_TpItem>* p_out_;
+      const std::vector<_TpKey>* p_splitters_;
+      std::vector<uint32_t>* p_buckets_;
+      std::vector<size_t>* p_counts_;
+      const std::vector<size_t>* p_offsets_;
+      size_t begin_;
+      size_t end_;
+    };
+
+  /*!
+   * \brief Distributes in over num_buckets key ranges, as the first half of a sample sort.
+   *
+   * The bucket boundaries are picked from an oversampled, sorted sample
+   * of the keys, and equal keys always share a bucket. On return, bucket b
+   * is out[bounds[b], bounds[b+1]), unsorted; every key in it is not less
+   * than the keys of bucket b-1.
+   */
+  template<typename _TpItem>
+    void _parallel_partition(const std::vector<_TpItem>& in,
+        std::vector<_TpItem>* p_out, const size_t& num_buckets,
+        std::vector<size_t>* p_bounds) {
+      typedef typename _TpItem::first_type _TpKey;
+      static const size_t OVERSAMPLING = 16;
+
+      size_t n = in.size();
+      size_t num_samples = num_buckets * OVERSAMPLING;
+      std::vector<_TpKey> samples, splitters;
+
+      for (size_t idx = 0; idx < num_samples; idx++)
+        samples.push_back(in[idx * (n / num_samples)].first);
+
+      std::sort(samples.begin(), samples.end());
+
+      for (size_t b = 1; b < num_buckets; b++)
+        splitters.push_back(samples[b * OVERSAMPLING]);
+
+      std::vector<uint32_t> buckets(n);
+      std::vector<std::vector<size_t> > counts(num_buckets,
+          std::vector<size_t>(num_buckets, 0));
+      std::vector<std::vector<size_t> > offsets(num_buckets);
+      std::vector<_PartitionTask<_TpItem> > tasks(num_buckets);
+
+      for (size_t t = 0; t < num_buckets; t++) {
+        tasks[t].p_in_ = &in;
+        tasks[t].p_out_ = p_out;
+        tasks[t].p_splitters_ = &splitters;
+        tasks[t].p_buckets_ = &buckets;
+        tasks[t].p_counts_ = &counts[t];
+        tasks[t].p_offsets_ = NULL;
+        tasks[t].begin_ = t * n / num_buckets;
+        tasks[t].end_ = (t+1) * n / num_buckets;
+      }
+
+      _run_tasks(tasks);
+
+      // bucket by bucket, then chunk by chunk within a bucket
+      size_t offset = 0;
+      p_bounds->assign(1, 0);
+
+      for (size_t b = 0; b < num_buckets; b++) {
+        for (size_t t = 0; t < num_buckets; t++) {
+          offsets[t].push_back(offset);
+          offset += counts[t][b];
+        }
+
+        p_bounds->push_back(offset);
+      }
+
+      p_out->resize(n);
+
+      for (size_t t = 0; t < num_buckets; t++)
+        tasks[t].p_offsets_ = &offsets[t];
+
+      _run_tasks(tasks);
+    }
+}
+
+#endif  // CBTL_CBT_BTREE_PARALLEL_H_
@@ -0,0 +1,529 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file cbt/btree_stats.h
+ * \brief Contains latency_histogram and btree_stats definitions.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#ifndef CBTL_CBT_BTREE_STATS_H_
+#define CBTL_CBT_BTREE_STATS_H_
+
+#include <stdint.h>
+#include <cstring>
+#include <ostream>
+
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+namespace cbt {
+  /*!
+   * \brief Loads a counter that another thread may be updating.
+   */
+  template<typename _Tp>
+    inline _Tp _load_relaxed(const _Tp& counter) {
+      return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+    }
+
+  /*!
+   * \brief Updates a counter that has a single writer but concurrent readers.
+   *
+   * This is a plain load/add/store, as cheap as ++, but readers never see
+   * a torn value.
+   */
+  template<typename _Tp, typename _TpDelta>
+    inline void _add_relaxed(_Tp& counter, const _TpDelta& delta) {
+      __atomic_store_n(&counter,
+          __atomic_load_n(&counter, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+    }
+
+  /*!
+   * \brief Updates a counter that several threads may update at once.
+   */
+  template<typename _Tp, typename _TpDelta>
+    inline void _add_atomic(_Tp& counter, const _TpDelta& delta) {
+      __atomic_fetch_add(&counter, delta, __ATOMIC_RELAXED);
+    }
+
+  /*!
+   * \brief Lowers a counter to value, if it is higher, while other threads may do the same.
+   */
+  template<typename _Tp>
+    inline void _min_atomic(_Tp& counter, const _Tp& value) {
+      _Tp current = __atomic_load_n(&counter, __ATOMIC_RELAXED);
+
+      while (value < current && !__atomic_compare_exchange_n(&counter, &current,
+            value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+    }
+
+  /*!
+   * \brief Raises a counter to value, if it is lower, while other threads may do the same.
+   */
+  template<typename _Tp>
+    inline void _max_atomic(_Tp& counter, const _Tp& value) {
+      _Tp current = __atomic_load_n(&counter, __ATOMIC_RELAXED);
+
+      while (value > current && !__atomic_compare_exchange_n(&counter, &current,
+            value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+    }
+
+  template<typename _Tp>
+    inline void _store_relaxed(_Tp& counter, const _Tp& value) {
+      __atomic_store_n(&counter, value, __ATOMIC_RELAXED);
+    }
+
+  /*!
+   * \brief Reads a cheap monotonic tick counter (TSC on x86, nanoseconds elsewhere).
+   */
+  inline uint64_t _ticks() {
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#endif
+  }
+
+  /*!
+   * \brief Returns how many ticks _ticks() advances per second.
+   *
+   * On x86 the TSC rate is measured once against CLOCK_MONOTONIC, which
+   * takes about 10ms on the first call; btree_stats makes that call when
+   * it is built, so that exporters do not stall. Threads making the first
+   * call together each measure the rate, and the last one stores it.
+   */
+  inline double _ticks_per_second() {
+#if defined(__i386__) || defined(__x86_64__)
+    static uint64_t rate = 0;
+    uint64_t known = __atomic_load_n(&rate, __ATOMIC_ACQUIRE);
+
+    if (known == 0) {
+      struct timespec t0, t1, pause = { 0, 10000000 };
+
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      uint64_t c0 = _ticks();
+      nanosleep(&pause, NULL);
+      uint64_t c1 = _ticks();
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+
+      double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+      known = static_cast<uint64_t>((c1 - c0) / secs);
+
+      if (known == 0)
+        known = 1;
+
+      __atomic_store_n(&rate, known, __ATOMIC_RELEASE);
+    }
+
+    return static_cast<double>(known);
+#else
+    return 1e9;
+#endif
+  }
+
+  /*!
+   * \class latency_histogram
+   * \brief A log-linear (HDR-style) histogram of tick counts.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Values below 2*SUB_BUCKETS are counted exactly; above that, every power
+   * of two is split into SUB_BUCKETS linear buckets, so the relative error of
+   * any reported value is below 1/SUB_BUCKETS. Histograms recorded by
+   * different threads are combined with merge(). record() may be called by
+   * several threads at once, and any thread may read the histogram while
+   * it is being recorded; merge() and reset() need a single writer.
+   */
+
+  class latency_histogram {
+    public:
+      static const uint8_t SUB_BUCKET_BITS = 4;
+      static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+      // values with the top bit set fall in one more power of two
+      static const uint32_t NUM_BUCKETS =
+        (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    public:
+      latency_histogram() { reset(); }
+
+    public:
+      static uint32_t bucket_of(const uint64_t& value) {
+        if (value < 2*SUB_BUCKETS)
+          return static_cast<uint32_t>(value);
+
+        uint32_t shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return shift * SUB_BUCKETS + static_cast<uint32_t>(value >> shift);
+      }
+
+      static uint64_t bucket_low(const uint32_t& bucket) {
+        if (bucket < 2*SUB_BUCKETS)
+          return bucket;
+
+        uint32_t shift = bucket / SUB_BUCKETS - 1;
+        return static_cast<uint64_t>(bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+      }
+
+      static uint64_t bucket_high(const uint32_t& bucket) {
+        if (bucket < 2*SUB_BUCKETS)
+          return bucket;
+
+        uint32_t shift = bucket / SUB_BUCKETS - 1;
+        return bucket_low(bucket) + ((1ULL << shift) - 1);
+      }
+
+    public:
+      /*!
+       * \brief Records value n times, as n operations that took value each.
+       */
+      void record(const uint64_t& value, const uint64_t& n = 1) {
+        _add_atomic(counts_[bucket_of(value)], n);
+        _add_atomic(count_, n);
+        _add_atomic(sum_, value * n);
+        _min_atomic(min_, value);
+        _max_atomic(max_, value);
+      }
+
+      void merge(const latency_histogram& other) {
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++)
+          counts_[b] += _load_relaxed(other.counts_[b]);
+
+        count_ += other.count();
+        sum_ += other.sum();
+
+        if (_load_relaxed(other.min_) < min_)
+          min_ = _load_relaxed(other.min_);
+        if (other.max() > max_)
+          max_ = other.max();
+      }
+
+      void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ = 0;
+        min_ = ~0ULL;
+        max_ = 0;
+      }
+
+      const uint64_t count() const { return _load_relaxed(count_); }
+      const uint64_t sum() const { return _load_relaxed(sum_); }
+      const uint64_t min() const { return count() ? _load_relaxed(min_) : 0; }
+      const uint64_t max() const { return _load_relaxed(max_); }
+      const uint64_t count_at(const uint32_t& bucket) const {
+        return _load_relaxed(counts_[bucket]);
+      }
+
+      const double mean() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum()) / n : 0.0;
+      }
+
+      /*!
+       * \brief Returns the highest value equivalent to the given percentile (0-100).
+       */
+      const uint64_t percentile(const double& pct) const {
+        uint64_t n = count();
+
+        if (n == 0)
+          return 0;
+
+        uint64_t rank = static_cast<uint64_t>(pct / 100.0 * n + 0.5);
+
+        if (rank < 1)
+          rank = 1;
+        if (rank > n)
+          rank = n;
+
+        uint64_t seen = 0;
+        uint64_t top = max();
+
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+          seen += count_at(b);
+
+          if (seen >= rank)
+            return bucket_high(b) < top ? bucket_high(b) : top;
+        }
+
+        return top;
+      }
+
+      void print_text(std::ostream& os) const {
+        os << "count=" << count() << " min=" << min()
+          << " mean=" << static_cast<uint64_t>(mean())
+          << " p50=" << percentile(50) << " p90=" << percentile(90)
+          << " p99=" << percentile(99) << " p99.9=" << percentile(99.9)
+          << " max=" << max();
+      }
+
+      void print_json(std::ostream& os) const {
+        os << "{\"count\":" << count() << ",\"min\":" << min()
+          << ",\"max\":" << max() << ",\"sum\":" << sum()
+          << ",\"p50\":" << percentile(50) << ",\"p90\":" << percentile(90)
+          << ",\"p99\":" << percentile(99) << ",\"p999\":" << percentile(99.9)
+          << ",\"buckets\":[";
+
+        bool first = true;
+
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+          uint64_t n = count_at(b);
+
+          if (n) {
+            os << (first ? "" : ",") << "[" << bucket_low(b) << "," << n << "]";
+            first = false;
+          }
+        }
+
+        os << "]}";
+      }
+
+    private:
+      uint64_t counts_[NUM_BUCKETS];
+      uint64_t count_;
+      uint64_t sum_;
+      uint64_t min_;
+      uint64_t max_;
+  };
+
+  /*!
+   * \class btree_stats
+   * \brief Operation counters, sampled latency histograms and shape gauges of a btree.
+   * \author Leandro Costa
+   * \date 2011
+   *
+   * Attach it with btree::set_stats(). Every operation is counted, but only
+   * one in sample_period is timed, which keeps the timing overhead low. While
+   * attached, the tree also keeps the shape gauges (entries, height, nodes
+   * per level, allocated bytes) up to date.
+   *
+   * The operation counters, the sample tick and the histograms are updated
+   * atomically, since const operations such as parallel_for_each() may run
+   * on one tree from several threads at once. The shape gauges have a
+   * single writer, the thread that changes the tree, so a btree_stats must
+   * not be shared by trees changed from different threads; give each
+   * thread its own and merge() them. Any thread may read it concurrently
+   * (see metrics_exporter) without stopping the writers.
+   */
+
+  class btree_stats {
+    public:
+      enum op {
+        INSERT,
+        FIND,
+        ERASE,
+        SCAN,
+        NUM_OPS
+      };
+
+      static const uint8_t MAX_LEVELS = 64;
+
+    public:
+      explicit btree_stats(uint32_t sample_period = 64)
+        : tick_(0), sample_bits_(0) {
+        while ((1u << sample_bits_) < sample_period)
+          sample_bits_++;
+
+        _ticks_per_second();  // calibrates the tick rate now, not on export
+        memset(ops_, 0, sizeof(ops_));
+        reset_shape(0, 0);
+      }
+
+    public:
+      static const char* op_name(const op& o) {
+        static const char* names[NUM_OPS] = { "insert", "find", "erase", "scan" };
+        return names[o];
+      }
+
+      /*!
+       * \brief Returns how many of the next n operations are to be timed.
+       */
+      const uint64_t should_sample(const uint64_t& n = 1) {
+        uint64_t last = __atomic_fetch_add(&tick_, n, __ATOMIC_RELAXED);
+        return (((last + n) >> sample_bits_) - (last >> sample_bits_));
+      }
+      const uint32_t sample_period() const { return 1u << sample_bits_; }
+
+      void count(const op& o, const uint64_t& n = 1) { _add_atomic(ops_[o], n); }
+      const uint64_t ops(const op& o) const { return _load_relaxed(ops_[o]); }
+
+      latency_histogram& histogram(const op& o) { return hist_[o]; }
+      const latency_histogram& histogram(const op& o) const { return hist_[o]; }
+
+    public:
+      /*!
+       * \brief Clears the shape gauges; called by the tree when attached.
+       */
+      void reset_shape(const uint32_t& node_bytes, const uint32_t& node_slots) {
+        entries_ = 0;
+        height_ = 0;
+        node_bytes_ = node_bytes;
+        node_slots_ = node_slots;
+        memset(nodes_, 0, sizeof(nodes_));
+      }
+
+      void add_entries(const int64_t& delta) { _add_relaxed(entries_, delta); }
+
+      /*!
+       * \brief Accounts for nodes allocated (or freed) at a level, leaves being level 0.
+       */
+      void add_nodes(const uint8_t& level, const int64_t& delta) {
+        _add_relaxed(nodes_[level], delta);
+      }
+
+      void set_height(const uint8_t& height) { _store_relaxed(height_, height); }
+
+      const uint64_t entries() const { return _load_relaxed(entries_); }
+      const uint8_t height() const { return _load_relaxed(height_); }
+      const uint64_t nodes(const uint8_t& level) const {
+        return _load_relaxed(nodes_[level]);
+      }
+
+      const uint64_t nodes() const {
+        uint64_t total = 0;
+
+        for (uint8_t level = 0; level < MAX_LEVELS; level++)
+          total += nodes(level);
+
+        return total;
+      }
+
+      const uint64_t allocated_bytes() const { return nodes() * node_bytes_; }
+
+      /*!
+       * \brief Returns the fraction of item slots in use, between 0 and 1.
+       */
+      const double fill_factor() const {
+        uint64_t slots = nodes() * node_slots_;
+        return slots ? static_cast<double>(entries()) / slots : 0.0;
+      }
+
+    public:
+      void merge(const btree_stats& other) {
+        for (int o = 0; o < NUM_OPS; o++) {
+          ops_[o] += other.ops(static_cast<op>(o));
+          hist_[o].merge(other.hist_[o]);
+        }
+
+        entries_ += other.entries();
+
+        for (uint8_t level = 0; level < MAX_LEVELS; level++)
+          nodes_[level] += other.nodes(level);
+
+        if (other.height() > height_)
+          height_ = other.height();
+
+        if (!node_bytes_) {
+          node_bytes_ = other.node_bytes_;
+          node_slots_ = other.node_slots_;
+        }
+      }
+
+      void reset() {
+        for (int o = 0; o < NUM_OPS; o++) {
+          ops_[o] = 0;
+          hist_[o].reset();
+        }
+      }
+
+      void print_text(std::ostream& os) const {
+        os << "entries=" << entries() << " height=" << static_cast<int>(height())
+          << " nodes=" << nodes() << " bytes=" << allocated_bytes()
+          << " fill=" << fill_factor() << "\n";
+
+        for (int o = 0; o < NUM_OPS; o++) {
+          os << op_name(static_cast<op>(o)) << ": ops="
+            << ops(static_cast<op>(o)) << " ";
+          hist_[o].print_text(os);
+          os << "\n";
+        }
+      }
+
+      void print_json(std::ostream& os) const {
+        os << "{\"unit\":\"ticks\",\"sample_period\":" << sample_period()
+          << ",\"entries\":" << entries()
+          << ",\"height\":" << static_cast<int>(height())
+          << ",\"nodes\":" << nodes()
+          << ",\"bytes\":" << allocated_bytes();
+
+        for (int o = 0; o < NUM_OPS; o++) {
+          os << ",\"" << op_name(static_cast<op>(o)) << "\":{\"ops\":"
+            << ops(static_cast<op>(o)) << ",\"latency\":";
+          hist_[o].print_json(os);
+          os << "}";
+        }
+
+        os << "}";
+      }
+
+    private:
+      uint64_t tick_;
+      uint8_t sample_bits_;
+      uint64_t ops_[NUM_OPS];
+      latency_histogram hist_[NUM_OPS];
+
+      uint64_t entries_;
+      uint8_t height_;
+      uint32_t node_bytes_;
+      uint32_t node_slots_;
+      uint64_t nodes_[MAX_LEVELS];
+  };
+
+  /*!
+   * \class _BTreeOpTimer
+   * \brief Scoped timer that counts n operations and times them when sampled.
+   *
+   * n operations done at once, such as the entries of a batch, are timed
+   * together; each sampled one is recorded with the mean time of all n.
+   */
+
+  class _BTreeOpTimer {
+    public:
+      _BTreeOpTimer(btree_stats* p_stats, const btree_stats::op& o,
+          const uint64_t& n = 1)
+        : stats_(p_stats), op_(o), n_(n), samples_(0), start_(0) {
+        if (stats_) {
+          stats_->count(op_, n_);
+          samples_ = stats_->should_sample(n_);
+
+          if (samples_)
+            start_ = _ticks();
+        }
+      }
+
+      ~_BTreeOpTimer() {
+        if (samples_)
+          stats_->histogram(op_).record((_ticks() - start_) / n_, samples_);
+      }
+
+    private:
+      btree_stats* stats_;
+      btree_stats::op op_;
+      uint64_t n_;
+      uint64_t samples_;
+      uint64_t start_;
+  };
+}
+
+#endif  // CBTL_CBT_BTREE_STATS_H_
@@ -0,0 +1,163 @@
+/*
+ * Measures random lookups in a tree whose nodes are scattered over the
+ * heap, then packed by compact() into ordinary chunks, then into chunks
+ * backed by huge pages, counting dTLB load misses with perf_event_open.
+ *
+ * usage: huge_pages_bench [entries [lookups]]
+ *
+ * The counters need /proc/sys/kernel/perf_event_paranoid at 2 or less;
+ * transparent huge pages need /sys/kernel/mm/transparent_hugepage/enabled
+ * at "always" or "madvise" (or pages reserved in vm.nr_hugepages).
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cbt/btree.h"
+
+typedef cbt::btree<uint64_t, uint64_t, 8> Tree;
+
+class PerfCounter {
+    public:
+        PerfCounter(const uint32_t& type, const uint64_t& config) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+        ~PerfCounter() {
+            if (fd_ >= 0)
+                close(fd_);
+        }
+
+        const bool ok() const { return (fd_ >= 0); }
+
+        void start() {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        const uint64_t stop() {
+            uint64_t value = 0;
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+
+            if (read(fd_, &value, sizeof(value)) != sizeof(value))
+                value = 0;
+
+            return value;
+        }
+
+    private:
+        int fd_;
+};
+
+static double Now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t Random() {
+    return (static_cast<uint64_t>(rand()) << 31) ^ rand();
+}
+
+static void Measure(const char* layout, Tree* p_tree,
+        const std::vector<uint64_t>& keys) {
+    PerfCounter dtlb(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    uint64_t sum = 0;
+
+    if (dtlb.ok())
+        dtlb.start();
+
+    double start = Now();
+
+    for (size_t idx = 0; idx < keys.size(); idx++)
+        sum += p_tree->find(keys[idx])->second;
+
+    double elapsed = Now() - start;
+    uint64_t misses = (dtlb.ok() ? dtlb.stop() : 0);
+
+    printf("%-16s %8.1f ns/lookup", layout, elapsed / keys.size() * 1e9);
+
+    if (dtlb.ok())
+        printf(" %8.3f dTLB misses/lookup", double(misses) / keys.size());
+    else
+        printf("      (dTLB counter unavailable)");
+
+    printf("   [%llu]\n", static_cast<unsigned long long>(sum % 10));
+}
+
+static void PrintHugePages() {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+
+    while (std::getline(smaps, line)) {
+        if (line.compare(0, 14, "AnonHugePages:") == 0)
+            std::cout << "                 " << line << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t entries = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000);
+    size_t lookups = (argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000);
+
+    Tree tree;
+    std::vector<uint64_t> keys;
+    std::vector<char*> garbage;
+    srand(1);
+
+    // interleave other allocations, as a long running process would
+    for (size_t idx = 0; idx < entries; idx++) {
+        uint64_t key = Random();
+        tree.insert(key, idx);
+        keys.push_back(key);
+        garbage.push_back(new char[16 + rand() % 256]);
+    }
+
+    for (size_t idx = 0; idx < garbage.size(); idx++)
+        delete[] garbage[idx];
+
+    std::vector<uint64_t> probes;
+
+    for (size_t idx = 0; idx < lookups; idx++)
+        probes.push_back(keys[rand() % keys.size()]);
+
+    printf("%lu entries, %lu lookups, node of %lu bytes\n",
+            static_cast<unsigned long>(tree.size()),
+            static_cast<unsigned long>(lookups),
+            static_cast<unsigned long>(sizeof(cbt::_BTreeNode<uint64_t,
+                    uint64_t, 8>)));
+
+    Measure("heap", &tree, probes);
+
+    tree.compact();
+    Measure("chunks", &tree, probes);
+
+    tree.set_huge_pages(true);
+    tree.compact();
+    Measure("huge page chunks", &tree, probes);
+    PrintHugePages();
+
+    return 0;
+}
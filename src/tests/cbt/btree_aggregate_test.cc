@@ -0,0 +1,184 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_aggregate_test.cc
+ * \brief Tests for btree aggregates.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <map>
+#include <string>
+#include <utility>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+class SumBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            for (int i = 0; i < 5000; i++) {
+                int key = (i * 7919) % 5000;
+                b_.insert(key, key % 100);
+                ref_[key] = key % 100;
+            }
+        }
+
+        long ExpectedSum(const int& lo, const int& hi) const {
+            long sum = 0;
+
+            for (std::map<int, long>::const_iterator it = ref_.lower_bound(lo);
+                    it != ref_.end() && it->first <= hi; ++it)
+                sum += it->second;
+
+            return sum;
+        }
+
+        void ExpectRangeSums() const {
+            for (int lo = -10; lo < 5010; lo += 37) {
+                for (int hi = lo - 1; hi < 5010; hi += 211)
+                    ASSERT_EQ(ExpectedSum(lo, hi), b_.aggregate(lo, hi))
+                        << "[" << lo << ", " << hi << "]";
+            }
+        }
+
+        cbt::btree<int, long, 3, cbt::sum_aggregate<long> > b_;
+        std::map<int, long> ref_;
+};
+
+TEST_F(SumBTree, ShouldSumWholeTree) {
+    EXPECT_EQ(ExpectedSum(0, 5000), b_.aggregate());
+}
+
+TEST_F(SumBTree, ShouldSumRanges) {
+    ExpectRangeSums();
+}
+
+TEST_F(SumBTree, ShouldKeepSumsThroughErases) {
+    for (int key = 0; key < 5000; key += 3) {
+        b_.erase(key);
+        ref_.erase(key);
+    }
+
+    b_.pop_min();
+    ref_.erase(ref_.begin());
+    b_.pop_max();
+    ref_.erase(--ref_.end());
+
+    ExpectRangeSums();
+}
+
+TEST_F(SumBTree, ShouldKeepSumsThroughSplitAndJoin) {
+    cbt::btree<int, long, 3, cbt::sum_aggregate<long> > right;
+    b_.split_at(2500, &right);
+
+    EXPECT_EQ(ExpectedSum(0, 2499), b_.aggregate());
+    EXPECT_EQ(ExpectedSum(2500, 4999), right.aggregate());
+    EXPECT_EQ(ExpectedSum(1000, 2499), b_.aggregate(1000, 3000));
+
+    b_.join(&right);
+
+    ExpectRangeSums();
+}
+
+TEST_F(SumBTree, ShouldKeepCloneSumsApart) {
+    cbt::btree<int, long, 3, cbt::sum_aggregate<long> > c = b_.clone();
+    c.insert(10000, 1000);
+
+    EXPECT_EQ(ExpectedSum(0, 5000), b_.aggregate());
+    EXPECT_EQ(ExpectedSum(0, 5000) + 1000, c.aggregate());
+}
+
+TEST_F(SumBTree, ShouldSumBufferedWrites) {
+    b_.set_write_buffer(100000);
+
+    for (int key = 0; key < 5200; key += 13) {
+        if (key % 2) {
+            b_.erase(key);
+            ref_.erase(key);
+        } else {
+            b_.upsert(key, 1000);
+            ref_[key] = 1000;
+        }
+    }
+
+    EXPECT_EQ(ExpectedSum(-10, 5200), b_.aggregate());
+    ExpectRangeSums();
+
+    cbt::btree<int, long, 3, cbt::sum_aggregate<long> > applied = b_.clone();
+    applied.flush();
+
+    EXPECT_EQ(applied.aggregate(), b_.aggregate());
+    EXPECT_EQ(applied.aggregate(13, 1300), b_.aggregate(13, 1300));
+}
+
+TEST(MinMaxBTree, ShouldTrackMinAndMaxOfValues) {
+    cbt::btree<int, int, 2, cbt::min_aggregate<int> > lo;
+    cbt::btree<int, int, 2, cbt::max_aggregate<int> > hi;
+
+    EXPECT_EQ(std::numeric_limits<int>::max(), lo.aggregate());
+
+    for (int i = 0; i < 1000; i++) {
+        lo.insert(i, (i * 31) % 1000 - 500);
+        hi.insert(i, (i * 31) % 1000 - 500);
+    }
+
+    EXPECT_EQ(-500, lo.aggregate());
+    EXPECT_EQ(499, hi.aggregate());
+
+    lo.erase(0);
+    EXPECT_EQ(-499, lo.aggregate());
+    EXPECT_EQ(-469, lo.aggregate(1, 1));
+}
+
+// not commutative: keeps the keys in the order they were combined
+struct KeyString {
+    typedef std::string value_type;
+
+    static value_type identity() { return ""; }
+
+    static value_type combine(const value_type& a, const value_type& b) {
+        return a + b;
+    }
+
+    static value_type lift(const std::pair<char, int>& item) {
+        return std::string(1, item.first);
+    }
+};
+
+TEST(CustomAggregate, ShouldCombineInKeyOrder) {
+    cbt::btree<char, int, 1, KeyString> b;
+    std::string letters = "qwertyuiopasdfghjklzxcvbnm";
+
+    for (size_t i = 0; i < letters.size(); i++)
+        b.insert(letters[i], 0);
+
+    EXPECT_EQ("abcdefghijklmnopqrstuvwxyz", b.aggregate());
+    EXPECT_EQ("fghijk", b.aggregate('f', 'k'));
+    EXPECT_EQ("", b.aggregate('k', 'f'));
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,317 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_algorithm_test.cc
+ * \brief Tests for btree set operations.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree_algorithm.h"
+
+struct CollectKeys {
+    explicit CollectKeys(std::vector<int>* p_keys) : p_keys_(p_keys) { }
+    void operator()(const std::pair<int, int>& item) {
+        p_keys_->push_back(item.first);
+    }
+    std::vector<int>* p_keys_;
+};
+
+struct CollectJoin {
+    explicit CollectJoin(std::vector<int>* p_keys) : p_keys_(p_keys) { }
+    void operator()(const std::pair<int, int>& a,
+            const std::pair<int, std::string>& b) {
+        EXPECT_EQ(a.first, b.first);
+        p_keys_->push_back(a.second);
+    }
+    std::vector<int>* p_keys_;
+};
+
+struct CollectJoinKeys {
+    explicit CollectJoinKeys(std::vector<int>* p_keys) : p_keys_(p_keys) { }
+    void operator()(const std::pair<int, int>& a,
+            const std::pair<int, int>& b) {
+        EXPECT_EQ(a.first, b.first);
+        p_keys_->push_back(a.first);
+    }
+    std::vector<int>* p_keys_;
+};
+
+class TwoRandomBTrees : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(5);
+
+            // a is dense in a small range, b is sparse over a wide one
+            for (int i = 0; i < 2000; i++) {
+                int key = rand() % 3000;
+
+                if (set_a_.insert(key).second)
+                    a_.insert(key, key * 2);
+            }
+
+            for (int i = 0; i < 300; i++) {
+                int key = rand() % 30000;
+
+                if (set_b_.insert(key).second)
+                    b_.insert(key, key * 3);
+            }
+        }
+
+        std::set<int> set_a_;
+        std::set<int> set_b_;
+        cbt::btree<int, int, 2> a_;
+        cbt::btree<int, int, 3> b_;
+};
+
+TEST_F(TwoRandomBTrees, ShouldIntersect) {
+    std::vector<int> expected, keys;
+    std::set_intersection(set_a_.begin(), set_a_.end(), set_b_.begin(),
+            set_b_.end(), std::back_inserter(expected));
+
+    cbt::intersect(a_, b_, CollectKeys(&keys));
+
+    EXPECT_FALSE(expected.empty());
+    EXPECT_EQ(expected, keys);
+}
+
+TEST_F(TwoRandomBTrees, ShouldUnite) {
+    std::vector<int> expected, keys;
+    std::set_union(set_a_.begin(), set_a_.end(), set_b_.begin(),
+            set_b_.end(), std::back_inserter(expected));
+
+    cbt::unite(a_, b_, CollectKeys(&keys));
+
+    EXPECT_EQ(expected, keys);
+}
+
+TEST_F(TwoRandomBTrees, ShouldSubtractBothWays) {
+    std::vector<int> expected, keys;
+    std::set_difference(set_a_.begin(), set_a_.end(), set_b_.begin(),
+            set_b_.end(), std::back_inserter(expected));
+
+    cbt::difference(a_, b_, CollectKeys(&keys));
+    EXPECT_EQ(expected, keys);
+
+    expected.clear();
+    keys.clear();
+    std::set_difference(set_b_.begin(), set_b_.end(), set_a_.begin(),
+            set_a_.end(), std::back_inserter(expected));
+
+    cbt::difference(b_, a_, CollectKeys(&keys));
+    EXPECT_EQ(expected, keys);
+}
+
+TEST(MergeJoin, ShouldPassMatchingEntriesOfBothTrees) {
+    cbt::btree<int, int> a;
+    cbt::btree<int, std::string> b;
+
+    for (int key = 0; key < 100; key++)
+        a.insert(key, key + 1000);
+
+    b.insert(-1, "X");
+    b.insert(10, "A");
+    b.insert(55, "B");
+    b.insert(99, "C");
+    b.insert(150, "D");
+
+    std::vector<int> values;
+    cbt::merge_join(a, b, CollectJoin(&values));
+
+    ASSERT_EQ(3u, values.size());
+    EXPECT_EQ(1010, values[0]);
+    EXPECT_EQ(1055, values[1]);
+    EXPECT_EQ(1099, values[2]);
+}
+
+TEST(MergeJoin, ShouldHandleEmptyTrees) {
+    cbt::btree<int, int> a, b;
+    std::vector<int> keys;
+
+    a.insert(1, 1);
+
+    cbt::intersect(a, b, CollectKeys(&keys));
+    cbt::intersect(b, a, CollectKeys(&keys));
+    cbt::difference(b, a, CollectKeys(&keys));
+    EXPECT_TRUE(keys.empty());
+
+    cbt::difference(a, b, CollectKeys(&keys));
+    cbt::unite(b, a, CollectKeys(&keys));
+    EXPECT_EQ(2u, keys.size());
+}
+
+struct CountingValue {
+    explicit CountingValue(int v = 0) : v_(v) { }
+    bool operator==(const CountingValue& other) const {
+        compares_++;
+        return (v_ == other.v_);
+    }
+
+    int v_;
+    static int compares_;
+};
+
+int CountingValue::compares_ = 0;
+
+typedef std::pair<int, CountingValue> CountingItem;
+
+struct CollectDiff {
+    explicit CollectDiff(std::vector<int>* p_keys, int sign)
+        : p_keys_(p_keys), sign_(sign) { }
+    void operator()(const CountingItem& item) {
+        p_keys_->push_back(sign_ * item.first);
+    }
+    void operator()(const CountingItem& a, const CountingItem& b) {
+        EXPECT_NE(a.second.v_, b.second.v_);
+        p_keys_->push_back(a.first);
+    }
+    std::vector<int>* p_keys_;
+    int sign_;
+};
+
+class DiffBTrees : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            for (int i = 0; i < 10000; i++)
+                a_.insert(2 * i, CountingValue(i));
+        }
+
+        void Diff(const cbt::btree<int, CountingValue, 3>& b) {
+            keys_.clear();
+            CountingValue::compares_ = 0;
+            cbt::diff(a_, b, CollectDiff(&keys_, 1), CollectDiff(&keys_, -1),
+                    CollectDiff(&keys_, 1));
+        }
+
+        cbt::btree<int, CountingValue, 3> a_;
+        std::vector<int> keys_;
+};
+
+TEST_F(DiffBTrees, ShouldReportAddsRemovesAndChanges) {
+    cbt::btree<int, CountingValue, 3> b = a_.clone();
+    b.insert(7, CountingValue(-1));
+    b.erase(100);
+    b.erase(5000);
+    b.insert(5000, CountingValue(-1));
+    b.insert(30000, CountingValue(-1));
+
+    Diff(b);
+
+    ASSERT_EQ(4u, keys_.size());
+    EXPECT_EQ(7, keys_[0]);
+    EXPECT_EQ(-100, keys_[1]);
+    EXPECT_EQ(5000, keys_[2]);
+    EXPECT_EQ(30000, keys_[3]);
+}
+
+TEST_F(DiffBTrees, ShouldSkipSubtreesSharedWithClones) {
+    cbt::btree<int, CountingValue, 3> b = a_.clone();
+    Diff(b);
+
+    EXPECT_TRUE(keys_.empty());
+    EXPECT_EQ(0, CountingValue::compares_);
+
+    b.erase(1234);
+    Diff(b);
+
+    ASSERT_EQ(1u, keys_.size());
+    EXPECT_EQ(-1234, keys_[0]);
+    EXPECT_GT(100, CountingValue::compares_);
+}
+
+TEST_F(DiffBTrees, ShouldMergeBufferedWrites) {
+    cbt::btree<int, CountingValue, 3> b = a_.clone();
+    b.set_write_buffer(100);
+    b.insert(7, CountingValue(-1));
+    b.erase(100);
+    b.upsert(5000, CountingValue(-1));
+    b.insert(30000, CountingValue(-1));
+
+    a_.set_write_buffer(100);
+    a_.insert(7, CountingValue(-1));
+
+    Diff(b);
+
+    ASSERT_EQ(3u, keys_.size());
+    EXPECT_EQ(-100, keys_[0]);
+    EXPECT_EQ(5000, keys_[1]);
+    EXPECT_EQ(30000, keys_[2]);
+    EXPECT_GT(400, CountingValue::compares_);
+}
+
+TEST_F(DiffBTrees, ShouldCompareUnrelatedTreesEntryByEntry) {
+    cbt::btree<int, CountingValue, 3> b;
+
+    for (int i = 1; i < 20000; i += 2)
+        b.insert(i, CountingValue(i));
+
+    Diff(b);
+    EXPECT_EQ(20000u, keys_.size());
+
+    Diff(cbt::btree<int, CountingValue, 3>());
+    EXPECT_EQ(10000u, keys_.size());
+    EXPECT_EQ(-19998, keys_.back());
+}
+
+TEST(AggregateBTrees, ShouldUniteAndDiff) {
+    typedef cbt::btree<int, int, 2, cbt::sum_aggregate<int> > SumBTree;
+    SumBTree a, b;
+    std::vector<int> keys;
+
+    for (int i = 0; i < 1000; i++) {
+        a.insert(2 * i, 1);
+        b.insert(3 * i, 1);
+    }
+
+    cbt::unite(a, b, CollectKeys(&keys));
+    EXPECT_EQ(1666u, keys.size());
+    EXPECT_TRUE(std::adjacent_find(keys.begin(), keys.end(),
+                std::greater_equal<int>()) == keys.end());
+
+    SumBTree c = a.clone();
+    c.erase(10);
+    c.upsert(20, 5);
+    EXPECT_EQ(1003, c.aggregate());
+
+    std::vector<int> removed, changed;
+    keys.clear();
+    cbt::diff(a, c, CollectKeys(&keys), CollectKeys(&removed),
+            CollectJoinKeys(&changed));
+
+    EXPECT_TRUE(keys.empty());
+    EXPECT_EQ(std::vector<int>(1, 10), removed);
+    EXPECT_EQ(std::vector<int>(1, 20), changed);
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,159 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_boxed_test.cc
+ * \brief Tests for boxed values.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+struct Payload {
+    Payload() : id_(-1) { live_++; }
+    explicit Payload(const int& id) : id_(id) { live_++; }
+    Payload(const Payload& other) : id_(other.id_) { live_++; }
+    ~Payload() { live_--; }
+
+    bool operator==(const Payload& other) const { return id_ == other.id_; }
+
+    int id_;
+    char padding_[256];
+
+    static int live_;
+};
+
+int Payload::live_ = 0;
+
+typedef cbt::btree<int, cbt::boxed<Payload>, 2> BoxedTree;
+
+class BoxedBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            live_before_ = Payload::live_;
+            srand(17);
+
+            for (int i = 0; i < 2000; i++) {
+                int key = rand() % 4000;
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, Payload(i));
+            }
+        }
+
+        void ExpectSameContents() {
+            EXPECT_EQ(map_.size(), btree_.size());
+
+            std::map<int, int>::iterator it_map = map_.begin();
+            BoxedTree::iterator it = btree_.begin();
+
+            for (; it_map != map_.end(); ++it_map, ++it) {
+                ASSERT_NE(btree_.end(), it);
+                EXPECT_EQ(it_map->first, it->first);
+                EXPECT_EQ(it_map->second, it->second->id_);
+            }
+
+            EXPECT_EQ(btree_.end(), it);
+        }
+
+        int live_before_;
+        std::map<int, int> map_;
+        BoxedTree btree_;
+};
+
+TEST(Boxed, ShouldKeepItemsAsSmallAsAPointer) {
+    EXPECT_EQ(sizeof(std::pair<int, void*>),
+            sizeof(std::pair<int, cbt::boxed<Payload> >));
+}
+
+TEST(Boxed, ShouldPickBoxOnlyForLargeValues) {
+    EXPECT_EQ(sizeof(void*),
+            sizeof(cbt::value_holder<Payload>::type));
+    EXPECT_EQ(sizeof(double), sizeof(cbt::value_holder<double>::type));
+    EXPECT_EQ(3.5, cbt::unbox(cbt::value_holder<double>::type(3.5)));
+    EXPECT_EQ(7, cbt::unbox(cbt::value_holder<Payload>::type(Payload(7))).id_);
+}
+
+TEST(Boxed, ShouldShareTheValueBetweenCopies) {
+    cbt::boxed<Payload> a(Payload(1));
+    cbt::boxed<Payload> b = a;
+    cbt::boxed<Payload> c;
+
+    EXPECT_EQ(2u, a.use_count());
+    EXPECT_EQ(&a.get(), &b.get());
+    EXPECT_EQ(0u, c.use_count());
+    EXPECT_EQ(-1, c->id_);
+
+    b = cbt::boxed<Payload>(Payload(2));
+
+    EXPECT_EQ(1u, a.use_count());
+    EXPECT_EQ(1, a->id_);
+    EXPECT_EQ(2, (*b).id_);
+}
+
+TEST_F(BoxedBTree, ShouldKeepContentsWhileErasing) {
+    for (int i = 0; i < 1000; i++) {
+        int key = rand() % 4000;
+        EXPECT_EQ(map_.erase(key), btree_.erase(key));
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(BoxedBTree, ShouldReplaceValuesOnUpsert) {
+    btree_.upsert(map_.begin()->first, Payload(-5));
+    map_.begin()->second = -5;
+
+    ExpectSameContents();
+}
+
+TEST_F(BoxedBTree, ShouldShareValuesWithClones) {
+    BoxedTree copy = btree_.clone();
+    int key = map_.begin()->first;
+
+    EXPECT_EQ(&copy.find(key)->second.get(), &btree_.find(key)->second.get());
+
+    btree_.upsert(key, Payload(-7));
+
+    EXPECT_EQ(map_[key], copy.find(key)->second->id_);
+    EXPECT_EQ(-7, btree_.find(key)->second->id_);
+}
+
+TEST_F(BoxedBTree, ShouldFreeEveryValue) {
+    btree_.compact();
+
+    while (!btree_.empty())
+        btree_.pop_min();
+
+    EXPECT_EQ(live_before_, Payload::live_);
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
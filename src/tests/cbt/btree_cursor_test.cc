@@ -0,0 +1,159 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_cursor_test.cc
+ * \brief Tests for _BTreeCursor class.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <cstdlib>
+#include <map>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+class EvenKeysBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            for (int key = 0; key < 200; key += 2)
+                btree_.insert(key, key * 10);
+        }
+
+        cbt::btree<int, int> btree_;
+};
+
+TEST_F(EvenKeysBTree, ShouldSeekExactKey) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+
+    EXPECT_TRUE(c.seek(42));
+    EXPECT_EQ(42, c.key());
+    EXPECT_EQ(420, c.value());
+}
+
+TEST_F(EvenKeysBTree, ShouldSeekToNextKeyWhenMissing) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+
+    EXPECT_FALSE(c.seek(43));
+    ASSERT_TRUE(c.valid());
+    EXPECT_EQ(44, c->first);
+}
+
+TEST_F(EvenKeysBTree, ShouldBecomeInvalidPastLastKey) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+
+    EXPECT_FALSE(c.seek(199));
+    EXPECT_FALSE(c.valid());
+}
+
+TEST_F(EvenKeysBTree, ShouldSeekBackwards) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+
+    EXPECT_TRUE(c.seek(150));
+    EXPECT_TRUE(c.seek(2));
+    EXPECT_EQ(2, c.key());
+    EXPECT_FALSE(c.seek(-1));
+    EXPECT_EQ(0, c.key());
+}
+
+TEST_F(EvenKeysBTree, ShouldIterateFromFirstWithNext) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+    int expected = 0;
+
+    for (bool ok = c.first(); ok; ok = c.next()) {
+        EXPECT_EQ(expected, c.key());
+        expected += 2;
+    }
+
+    EXPECT_EQ(200, expected);
+}
+
+TEST_F(EvenKeysBTree, ShouldContinueWithNextAfterSeek) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+    c.seek(97);
+
+    for (int key = 98; key < 200; key += 2) {
+        EXPECT_EQ(key, c.key());
+        c.next();
+    }
+
+    EXPECT_FALSE(c.valid());
+}
+
+TEST_F(EvenKeysBTree, ShouldSeekAgainAfterReset) {
+    cbt::btree<int, int>::cursor c = btree_.make_cursor();
+    c.seek(10);
+
+    for (int key = 200; key < 400; key += 2)
+        btree_.insert(key, key);
+
+    c.reset();
+    EXPECT_TRUE(c.seek(398));
+}
+
+TEST(EmptyBTreeCursor, ShouldNeverBeValid) {
+    cbt::btree<int, int> b;
+    cbt::btree<int, int>::cursor c = b.make_cursor();
+
+    EXPECT_FALSE(c.first());
+    EXPECT_FALSE(c.seek(1));
+    EXPECT_FALSE(c.valid());
+}
+
+TEST(RandomBTreeCursor, ShouldMatchMapLowerBoundOnEverySeek) {
+    srand(11);
+
+    std::map<int, int> m;
+    cbt::btree<int, int, 2> b;
+
+    for (int i = 0; i < 3000; i++) {
+        int key = rand() % 10000;
+
+        if (m.insert(std::make_pair(key, i)).second)
+            b.insert(key, i);
+    }
+
+    cbt::btree<int, int, 2>::cursor c = b.make_cursor();
+    int key = 0;
+
+    for (int i = 0; i < 5000; i++) {
+        // mostly short hops forward, sometimes long jumps either way
+        key = (rand() % 8 ? key + rand() % 40 - 5 : rand() % 10100);
+
+        std::map<int, int>::iterator it = m.lower_bound(key);
+        bool found = c.seek(key);
+
+        if (it == m.end()) {
+            EXPECT_FALSE(c.valid());
+        } else {
+            ASSERT_TRUE(c.valid());
+            EXPECT_EQ(it->first, c.key());
+            EXPECT_EQ(it->first == key, found);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
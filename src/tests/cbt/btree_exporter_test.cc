@@ -0,0 +1,143 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_exporter_test.cc
+ * \brief Tests for metrics_exporter class.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <fstream>
+#include <sstream>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+#include "cbt/btree_exporter.h"
+
+class TwoTreesExporter : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            users_.set_stats(&users_stats_);
+            events_.set_stats(&events_stats_);
+
+            for (int i = 0; i < 3; i++)
+                users_.insert(i, i);
+
+            events_.find(1);
+
+            exporter_.add("users", &users_stats_);
+            exporter_.add("ev\"ents", &events_stats_);
+        }
+
+        cbt::btree<int, int> users_;
+        cbt::btree<int, int> events_;
+        cbt::btree_stats users_stats_;
+        cbt::btree_stats events_stats_;
+        cbt::metrics_exporter exporter_;
+};
+
+TEST_F(TwoTreesExporter, ShouldRenderEntriesOfEveryTree) {
+    std::string text = exporter_.render();
+
+    EXPECT_NE(std::string::npos, text.find("# TYPE cbtl_btree_entries gauge\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_entries{tree=\"users\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_entries{tree=\"ev\\\"ents\"} 0\n"));
+}
+
+TEST_F(TwoTreesExporter, ShouldRenderNodesPerLevel) {
+    std::string text = exporter_.render();
+
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_height{tree=\"users\"} 2\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_nodes{tree=\"users\",level=\"0\"} 2\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_nodes{tree=\"users\",level=\"1\"} 1\n"));
+}
+
+TEST_F(TwoTreesExporter, ShouldRenderOperationCountsAndLatencies) {
+    std::string text = exporter_.render();
+
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_operations_total{tree=\"users\",op=\"insert\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_operations_total{tree=\"ev\\\"ents\",op=\"find\"} 1\n"));
+    EXPECT_NE(std::string::npos, text.find("# TYPE cbtl_btree_operation_latency_seconds summary\n"));
+    EXPECT_NE(std::string::npos, text.find("cbtl_btree_operation_latency_seconds{tree=\"users\",op=\"insert\",quantile=\"0.99\"} "));
+}
+
+TEST_F(TwoTreesExporter, ShouldEndWithEofMarker) {
+    std::string text = exporter_.render();
+
+    EXPECT_EQ(text.size() - 6, text.rfind("# EOF\n"));
+}
+
+TEST_F(TwoTreesExporter, ShouldStopRenderingRemovedTree) {
+    exporter_.remove(&events_stats_);
+
+    EXPECT_EQ(1u, exporter_.size());
+    EXPECT_EQ(std::string::npos, exporter_.render().find("ev\\\"ents"));
+}
+
+TEST_F(TwoTreesExporter, ShouldWriteFile) {
+    std::string path = "cbtl_exporter_test.prom";
+
+    ASSERT_TRUE(exporter_.write_file(path));
+
+    std::ifstream file(path.c_str());
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    EXPECT_EQ(exporter_.render(), contents.str());
+    remove(path.c_str());
+}
+
+
+static void* insert_many(void* p_arg) {
+    cbt::btree<int, int>* p_btree = static_cast<cbt::btree<int, int>*>(p_arg);
+
+    for (int i = 0; i < 100000; i++)
+        p_btree->insert(i, i);
+
+    return NULL;
+}
+
+TEST(MetricsExporter, ShouldRenderWhileTreeIsBeingWritten) {
+    cbt::btree<int, int> b;
+    cbt::btree_stats stats;
+    cbt::metrics_exporter exporter;
+
+    b.set_stats(&stats);
+    exporter.add("busy", &stats);
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, insert_many, &b);
+
+    for (int i = 0; i < 20; i++)
+        EXPECT_NE(std::string::npos, exporter.render().find("# EOF\n"));
+
+    pthread_join(writer, NULL);
+
+    EXPECT_NE(std::string::npos, exporter.render().find("cbtl_btree_entries{tree=\"busy\"} 100000\n"));
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,233 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_filter_test.cc
+ * \brief Tests for the membership filter.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+typedef cbt::btree<int, int, 2> Tree;
+
+class FilteredBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(41);
+            btree_.set_filter(true);
+        }
+
+        void Insert(const int& count, const int& range) {
+            for (int i = 0; i < count; i++) {
+                int key = rand() % range;
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+            }
+        }
+
+        void Erase(const int& count, const int& range) {
+            for (int i = 0; i < count; i++) {
+                int key = rand() % range;
+                EXPECT_EQ(map_.erase(key), btree_.erase(key));
+            }
+        }
+
+        void ExpectSameLookups(Tree* p_tree, const std::map<int, int>& map,
+                const int& range) {
+            for (int key = -10; key < range + 10; key++) {
+                std::map<int, int>::const_iterator it_map = map.find(key);
+                Tree::iterator it = p_tree->find(key);
+
+                if (it_map == map.end()) {
+                    EXPECT_EQ(p_tree->end(), it);
+                } else {
+                    ASSERT_NE(p_tree->end(), it);
+                    EXPECT_EQ(it_map->second, it->second);
+                }
+            }
+        }
+
+        std::map<int, int> map_;
+        Tree btree_;
+};
+
+TEST(Filter, ShouldNeverRuleOutAddedKeys) {
+    cbt::_BTreeFilter<int> filter;
+    filter.reset(10000);
+
+    for (int key = 0; key < 20000; key++)
+        filter.add(key);
+
+    for (int key = 0; key < 20000; key++)
+        EXPECT_TRUE(filter.may_contain(key));
+}
+
+TEST(Filter, ShouldRuleOutMostOtherKeys) {
+    cbt::_BTreeFilter<std::string> filter;
+    filter.reset(5000);
+    size_t positives = 0;
+
+    for (int key = 0; key < 10000; key++)
+        filter.add(std::string(1, 'a') + char('a' + key % 26)
+                + char('a' + key / 26 % 26) + char('a' + key / 676));
+
+    for (int key = 0; key < 10000; key++) {
+        if (filter.may_contain(std::string(1, 'b') + char('a' + key % 26)
+                    + char('a' + key / 26 % 26) + char('a' + key / 676)))
+            positives++;
+    }
+
+    EXPECT_GT(200u, positives);
+}
+
+TEST(Filter, ShouldCopySharedBitsOnAdd) {
+    cbt::_BTreeFilter<long> filter;
+    filter.reset(0);
+    filter.add(1);
+
+    cbt::_BTreeFilter<long> copy = filter;
+    copy.add(2);
+
+    EXPECT_TRUE(copy.may_contain(1));
+    EXPECT_TRUE(copy.may_contain(2));
+    EXPECT_FALSE(filter.may_contain(2));
+}
+
+TEST(Filter, ShouldRefuseKeysWithoutHash) {
+    cbt::btree<double, int> btree;
+
+    EXPECT_THROW(btree.set_filter(true), std::invalid_argument);
+    EXPECT_FALSE(btree.filter());
+}
+
+TEST_F(FilteredBTree, ShouldFindEveryEntryWhileGrowing) {
+    Insert(20000, 40000);
+
+    EXPECT_TRUE(btree_.filter());
+    ExpectSameLookups(&btree_, map_, 40000);
+}
+
+TEST_F(FilteredBTree, ShouldFindEveryEntryWhileErasing) {
+    Insert(20000, 40000);
+    Erase(30000, 40000);
+    Insert(5000, 40000);
+
+    ExpectSameLookups(&btree_, map_, 40000);
+
+    while (!btree_.empty())
+        map_.erase(btree_.pop_min().first);
+
+    EXPECT_TRUE(map_.empty());
+    ExpectSameLookups(&btree_, map_, 40000);
+}
+
+TEST_F(FilteredBTree, ShouldFilterTreesBuiltBefore) {
+    btree_.set_filter(false);
+    Insert(5000, 10000);
+    btree_.set_filter(true);
+
+    ExpectSameLookups(&btree_, map_, 10000);
+}
+
+TEST_F(FilteredBTree, ShouldFindBufferedAndBatchedEntries) {
+    btree_.set_write_buffer(64);
+    Insert(3000, 10000);
+    Erase(1000, 10000);
+
+    std::vector<std::pair<int, int> > items;
+
+    for (int key = 10000; key < 12000; key += 3) {
+        items.push_back(std::make_pair(key, key));
+        map_.insert(std::make_pair(key, key));
+    }
+
+    btree_.insert_batch(items.begin(), items.end());
+
+    ExpectSameLookups(&btree_, map_, 12000);
+}
+
+TEST_F(FilteredBTree, ShouldKeepFiltersOfClonesApart) {
+    Insert(5000, 10000);
+
+    Tree copy = btree_.clone();
+    std::map<int, int> copy_map = map_;
+
+    Insert(2000, 20000);
+    copy.insert(-5, 5);
+    copy_map.insert(std::make_pair(-5, 5));
+
+    EXPECT_TRUE(copy.filter());
+    ExpectSameLookups(&btree_, map_, 20000);
+    ExpectSameLookups(&copy, copy_map, 20000);
+}
+
+TEST_F(FilteredBTree, ShouldTakeFilterOfAssignedTree) {
+    Insert(5000, 10000);
+
+    Tree copy;
+    copy = btree_;
+
+    EXPECT_TRUE(copy.filter());
+    ExpectSameLookups(&copy, map_, 10000);
+
+    Tree unfiltered;
+    unfiltered.insert(1, 1);
+    copy = unfiltered;
+
+    EXPECT_FALSE(copy.filter());
+    EXPECT_EQ(1u, copy.size());
+}
+
+TEST_F(FilteredBTree, ShouldFilterBothSidesOfSplitAndJoin) {
+    Insert(5000, 10000);
+
+    Tree right;
+    right.set_filter(true);
+    btree_.split_at(5000, &right);
+
+    std::map<int, int> right_map(map_.lower_bound(5000), map_.end());
+    std::map<int, int> left_map(map_.begin(), map_.lower_bound(5000));
+
+    ExpectSameLookups(&btree_, left_map, 10000);
+    ExpectSameLookups(&right, right_map, 10000);
+
+    btree_.join(&right);
+
+    ExpectSameLookups(&btree_, map_, 10000);
+    ExpectSameLookups(&right, std::map<int, int>(), 10000);
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,143 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_frozen_test.cc
+ * \brief Tests for btree::freeze() and frozen_btree.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+class FrozenBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(13);
+
+            for (int i = 0; i < 5000; i++) {
+                int key = rand() % 20000;
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+            }
+
+            frozen_ = btree_.freeze();
+        }
+
+        std::map<int, int> map_;
+        cbt::btree<int, int, 2> btree_;
+        cbt::frozen_btree<int, int> frozen_;
+};
+
+TEST_F(FrozenBTree, ShouldIterateInKeyOrder) {
+    EXPECT_EQ(map_.size(), frozen_.size());
+
+    std::map<int, int>::iterator it_map = map_.begin();
+    cbt::frozen_btree<int, int>::iterator it = frozen_.begin();
+
+    for (; it_map != map_.end(); ++it_map, ++it) {
+        ASSERT_NE(frozen_.end(), it);
+        EXPECT_EQ(it_map->first, it->first);
+        EXPECT_EQ(it_map->second, it->second);
+    }
+
+    EXPECT_EQ(frozen_.end(), it);
+}
+
+TEST_F(FrozenBTree, ShouldIterateBackwardsFromEnd) {
+    std::map<int, int>::reverse_iterator it_map = map_.rbegin();
+    cbt::frozen_btree<int, int>::iterator it = frozen_.end();
+
+    for (; it_map != map_.rend(); ++it_map) {
+        ASSERT_NE(frozen_.begin(), it);
+        EXPECT_EQ(it_map->first, (--it)->first);
+    }
+
+    EXPECT_EQ(frozen_.begin(), it);
+}
+
+TEST_F(FrozenBTree, ShouldMatchMapLookups) {
+    for (int key = -1; key <= 20000; key++) {
+        std::map<int, int>::iterator lower = map_.lower_bound(key);
+        std::map<int, int>::iterator upper = map_.upper_bound(key);
+
+        if (lower == map_.end())
+            EXPECT_EQ(frozen_.end(), frozen_.lower_bound(key));
+        else
+            EXPECT_EQ(lower->first, frozen_.lower_bound(key)->first);
+
+        if (upper == map_.end())
+            EXPECT_EQ(frozen_.end(), frozen_.upper_bound(key));
+        else
+            EXPECT_EQ(upper->first, frozen_.upper_bound(key)->first);
+
+        if (map_.count(key))
+            EXPECT_EQ(map_[key], frozen_.find(key)->second);
+        else
+            EXPECT_EQ(frozen_.end(), frozen_.find(key));
+    }
+}
+
+TEST_F(FrozenBTree, ShouldNotSeeLaterChangesOfTheTree) {
+    btree_.insert(-5, 0);
+    btree_.erase(map_.begin()->first);
+
+    EXPECT_EQ(frozen_.end(), frozen_.find(-5));
+    EXPECT_EQ(map_.begin()->second, frozen_.find(map_.begin()->first)->second);
+}
+
+TEST(FrozenBTreeDuplicates, ShouldFindFirstOfEqualKeys) {
+    cbt::btree<std::string, int> b;
+
+    for (int i = 0; i < 30; i++)
+        b.insert(std::string(1, 'a' + i % 3), i);
+
+    cbt::frozen_btree<std::string, int> frozen = b.freeze();
+    cbt::frozen_btree<std::string, int>::iterator it = frozen.lower_bound("b");
+
+    EXPECT_EQ("a", (--it)->first);
+    EXPECT_EQ("b", (++it)->first);
+    EXPECT_EQ("c", frozen.upper_bound("b")->first);
+    EXPECT_EQ(30u, frozen.size());
+}
+
+TEST(FrozenBTreeEmpty, ShouldHaveBeginEqualToEnd) {
+    cbt::btree<int, int> b;
+    cbt::frozen_btree<int, int> frozen = b.freeze();
+
+    EXPECT_TRUE(frozen.empty());
+    EXPECT_EQ(frozen.end(), frozen.begin());
+    EXPECT_EQ(frozen.end(), frozen.find(1));
+    EXPECT_EQ(frozen.end(), frozen.lower_bound(1));
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,195 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_key_encoder_test.cc
+ * \brief Tests for the order-preserving key encoding.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+#include "cbt/btree_key_encoder.h"
+
+template<typename _Tp>
+void ExpectOrderPreserved(const std::vector<_Tp>& values) {
+    for (size_t i = 0; i < values.size(); i++) {
+        std::string a = cbt::encode_key(values[i]);
+        EXPECT_TRUE(values[i] == cbt::decode_key<_Tp>(a));
+
+        for (size_t j = 0; j < values.size(); j++) {
+            std::string b = cbt::encode_key(values[j]);
+            EXPECT_EQ(values[i] < values[j], a < b);
+        }
+    }
+}
+
+TEST(KeyEncoder, ShouldPreserveOrderOfSignedIntegers) {
+    std::vector<int> ints;
+    ints.push_back(std::numeric_limits<int>::min());
+    ints.push_back(-65536);
+    ints.push_back(-1);
+    ints.push_back(0);
+    ints.push_back(1);
+    ints.push_back(255);
+    ints.push_back(256);
+    ints.push_back(std::numeric_limits<int>::max());
+
+    ExpectOrderPreserved(ints);
+
+    std::vector<signed char> chars;
+
+    for (int c = -128; c < 128; c += 17)
+        chars.push_back(c);
+
+    ExpectOrderPreserved(chars);
+}
+
+TEST(KeyEncoder, ShouldPreserveOrderOfUnsignedIntegers) {
+    std::vector<unsigned long long> values;
+    values.push_back(0);
+    values.push_back(1);
+    values.push_back(1ull << 32);
+    values.push_back(1ull << 63);
+    values.push_back(std::numeric_limits<unsigned long long>::max());
+
+    ExpectOrderPreserved(values);
+    EXPECT_EQ(8u, cbt::encode_key(values[0]).size());
+}
+
+TEST(KeyEncoder, ShouldPreserveOrderOfDoubles) {
+    std::vector<double> values;
+    values.push_back(-std::numeric_limits<double>::infinity());
+    values.push_back(-1e300);
+    values.push_back(-2.5);
+    values.push_back(-std::numeric_limits<double>::denorm_min());
+    values.push_back(0.0);
+    values.push_back(std::numeric_limits<double>::denorm_min());
+    values.push_back(1.0);
+    values.push_back(1e300);
+    values.push_back(std::numeric_limits<double>::infinity());
+
+    ExpectOrderPreserved(values);
+
+    EXPECT_LT(cbt::encode_key(-0.0), cbt::encode_key(0.0));
+    EXPECT_LT(cbt::encode_key(-1.5f), cbt::encode_key(0.25f));
+}
+
+TEST(KeyEncoder, ShouldPreserveOrderOfStringsWithZeroBytes) {
+    std::vector<std::string> values;
+    values.push_back("");
+    values.push_back(std::string("\0", 1));
+    values.push_back(std::string("\0\0", 2));
+    values.push_back(std::string("\0\x01", 2));
+    values.push_back("\x01");
+    values.push_back("a");
+    values.push_back(std::string("a\0", 2));
+    values.push_back("ab");
+    values.push_back("b");
+    values.push_back("\xff");
+
+    ExpectOrderPreserved(values);
+}
+
+TEST(KeyEncoder, ShouldOrderCompositeKeysFieldByField) {
+    std::vector<std::pair<int, std::string> > values;
+    values.push_back(std::make_pair(-1, std::string("zz")));
+    values.push_back(std::make_pair(0, std::string("")));
+    values.push_back(std::make_pair(0, std::string("a")));
+    values.push_back(std::make_pair(0, std::string("ab")));
+    values.push_back(std::make_pair(1, std::string("")));
+
+    ExpectOrderPreserved(values);
+}
+
+TEST(KeyEncoder, ShouldDecodeFieldsInOrder) {
+    std::string key = cbt::key_encoder().add(42).add(std::string("url"))
+        .add(-0.5).str();
+
+    int id;
+    std::string name;
+    double score;
+    cbt::key_decoder decoder(key);
+    decoder.get(&id).get(&name).get(&score);
+
+    EXPECT_EQ(42, id);
+    EXPECT_EQ("url", name);
+    EXPECT_EQ(-0.5, score);
+    EXPECT_TRUE(decoder.done());
+}
+
+TEST(KeyEncoder, ShouldRefuseTruncatedKeys) {
+    std::string key = cbt::encode_key(std::make_pair(7, std::string("abc")));
+
+    EXPECT_THROW(cbt::decode_key<int>(key.substr(0, 3)), std::invalid_argument);
+    EXPECT_THROW((cbt::decode_key<std::pair<int, std::string> >(
+                key.substr(0, key.size() - 1))), std::invalid_argument);
+    EXPECT_THROW(cbt::decode_key<int>(key), std::invalid_argument);
+}
+
+TEST(KeyEncoder, ShouldRefuseMalformedStrings) {
+    EXPECT_THROW(cbt::decode_key<std::string>(std::string("a\0\x05", 3)),
+            std::invalid_argument);
+    EXPECT_THROW(cbt::decode_key<std::string>(std::string("a\0\0\x01", 4)),
+            std::invalid_argument);
+    EXPECT_EQ(std::string("a\0b", 3),
+            cbt::decode_key<std::string>(std::string("a\0\xff" "b\0\x01", 6)));
+}
+
+TEST(KeyEncoder, ShouldKeepEncodedKeysInTupleOrderInBTree) {
+    typedef std::pair<int, std::pair<std::string, double> > Tuple;
+    cbt::btree<std::string, int, 3> b;
+    std::vector<Tuple> tuples;
+    srand(3);
+
+    for (int i = 0; i < 2000; i++) {
+        std::string name(1 + rand() % 3, 'a' + rand() % 3);
+        Tuple t(rand() % 5 - 2, std::make_pair(name, (rand() % 9 - 4) / 2.0));
+
+        tuples.push_back(t);
+        b.insert(cbt::encode_key(t), i);
+    }
+
+    std::sort(tuples.begin(), tuples.end());
+
+    size_t idx = 0;
+
+    for (cbt::btree<std::string, int, 3>::iterator it = b.begin();
+            it != b.end(); ++it, ++idx)
+        EXPECT_TRUE(tuples[idx] == cbt::decode_key<Tuple>(it->first));
+
+    EXPECT_EQ(tuples.size(), idx);
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
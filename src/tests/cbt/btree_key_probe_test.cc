@@ -0,0 +1,213 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_key_probe_test.cc
+ * \brief Tests for lookups with keys of another type.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+/*
+ * A key that counts how many times it is built from a const char*.
+ */
+struct Name {
+    Name() { }
+    Name(const char* p_name) : name_(p_name) { conversions_++; }
+
+    bool operator<(const Name& other) const { return name_ < other.name_; }
+    bool operator>(const Name& other) const { return name_ > other.name_; }
+    bool operator==(const Name& other) const { return name_ == other.name_; }
+
+    std::string name_;
+
+    static int conversions_;
+};
+
+int Name::conversions_ = 0;
+
+bool operator<(const Name& name, const char* p_name) {
+    return name.name_ < p_name;
+}
+
+bool operator<(const char* p_name, const Name& name) {
+    return p_name < name.name_;
+}
+
+bool operator==(const Name& name, const char* p_name) {
+    return name.name_ == p_name;
+}
+
+namespace cbt {
+    template<> struct key_probe<Name, const char*> {
+        static const bool ENABLED = true;
+    };
+}
+
+typedef cbt::btree<std::string, int, 2> StringTree;
+
+class KeyProbeBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(37);
+
+            for (int i = 0; i < 3000; i++) {
+                std::string key = Key(rand() % 6000);
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+            }
+        }
+
+        static std::string Key(const int& n) {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "a rather long key prefix %05d", n);
+            return buffer;
+        }
+
+        std::map<std::string, int> map_;
+        StringTree btree_;
+};
+
+TEST_F(KeyProbeBTree, ShouldFindWithCharPointers) {
+    for (int n = 0; n < 6000; n++) {
+        std::string key = Key(n);
+        const char* p_key = key.c_str();
+
+        std::map<std::string, int>::iterator it_map = map_.find(key);
+        StringTree::iterator it = btree_.find(p_key);
+
+        if (it_map == map_.end()) {
+            EXPECT_EQ(btree_.end(), it);
+        } else {
+            ASSERT_NE(btree_.end(), it);
+            EXPECT_EQ(it_map->second, it->second);
+        }
+    }
+}
+
+TEST_F(KeyProbeBTree, ShouldFindWithStringLiterals) {
+    btree_.insert("literal", -1);
+
+    EXPECT_EQ(-1, btree_.find("literal")->second);
+    EXPECT_EQ(btree_.end(), btree_.find("missing"));
+}
+
+TEST_F(KeyProbeBTree, ShouldFindBoundsWithCharPointers) {
+    for (int n = -1; n <= 6000; n++) {
+        std::string key = Key(n);
+        const char* p_key = key.c_str();
+
+        std::map<std::string, int>::iterator it_map = map_.lower_bound(key);
+        StringTree::iterator it = btree_.lower_bound(p_key);
+
+        if (it_map == map_.end()) {
+            EXPECT_EQ(btree_.end(), it);
+        } else {
+            ASSERT_NE(btree_.end(), it);
+            EXPECT_EQ(it_map->first, it->first);
+        }
+
+        it_map = map_.upper_bound(key);
+        it = btree_.upper_bound(p_key);
+
+        if (it_map == map_.end()) {
+            EXPECT_EQ(btree_.end(), it);
+        } else {
+            ASSERT_NE(btree_.end(), it);
+            EXPECT_EQ(it_map->first, it->first);
+        }
+    }
+}
+
+TEST_F(KeyProbeBTree, ShouldEraseWithCharPointers) {
+    btree_.set_write_buffer(16);
+
+    for (int i = 0; i < 2000; i++) {
+        std::string key = Key(rand() % 6000);
+
+        if (i % 3 == 0 && map_.insert(std::make_pair(key, i)).second)
+            btree_.insert(key, i);
+        else
+            EXPECT_EQ(map_.erase(key), btree_.erase(key.c_str()));
+    }
+
+    EXPECT_EQ(map_.size(), btree_.size());
+
+    std::map<std::string, int>::iterator it_map = map_.begin();
+    StringTree::iterator it = btree_.begin();
+
+    for (; it_map != map_.end(); ++it_map, ++it) {
+        ASSERT_NE(btree_.end(), it);
+        EXPECT_EQ(it_map->first, it->first);
+    }
+
+    EXPECT_EQ(btree_.end(), it);
+}
+
+TEST(KeyProbe, ShouldNotConvertEnabledProbes) {
+    cbt::btree<Name, int, 2> btree;
+
+    for (int i = 0; i < 1000; i++) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "name %04d", i);
+        btree.insert(Name(buffer), i);
+    }
+
+    const char* p_name = "name 0500";
+    int before = Name::conversions_;
+
+    EXPECT_EQ(500, btree.find(p_name)->second);
+    EXPECT_EQ(500, btree.lower_bound(p_name)->second);
+    EXPECT_EQ(501, btree.upper_bound(p_name)->second);
+    EXPECT_EQ(1u, btree.erase(p_name));
+    EXPECT_EQ(btree.end(), btree.find(p_name));
+    EXPECT_EQ(before, Name::conversions_);
+
+    btree.find(Name(p_name));  // the _TpKey overload is still there
+    EXPECT_EQ(before + 1, Name::conversions_);
+}
+
+#if __cplusplus >= 201703L
+TEST_F(KeyProbeBTree, ShouldFindWithStringViews) {
+    std::string key = map_.begin()->first;
+
+    EXPECT_EQ(map_.begin()->second,
+            btree_.find(std::string_view(key))->second);
+    EXPECT_EQ(1u, btree_.erase(std::string_view(key)));
+    EXPECT_EQ(btree_.end(), btree_.find(std::string_view(key)));
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,327 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_parallel_test.cc
+ * \brief Tests for the parallel btree operations.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+class UnsortedInput : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(11);
+
+            for (int i = 0; i < 100000; i++)
+                items_.push_back(std::make_pair(rand(), i));
+        }
+
+        template<uint8_t _order>
+            void ExpectSortedContents(cbt::btree<int, int, _order>& b) {
+                std::vector<std::pair<int, int> > sorted = items_;
+                std::sort(sorted.begin(), sorted.end());
+
+                ASSERT_EQ(sorted.size(), b.size());
+
+                size_t idx = 0;
+                typename cbt::btree<int, int, _order>::iterator it = b.begin();
+
+                for (; it != b.end(); ++it, ++idx)
+                    EXPECT_EQ(sorted[idx].first, it->first);
+
+                EXPECT_EQ(sorted.size(), idx);
+                EXPECT_EQ(sorted.back().first, b.rbegin()->first);
+            }
+
+        std::vector<std::pair<int, int> > items_;
+};
+
+TEST_F(UnsortedInput, ShouldBuildOnManyThreads) {
+    cbt::btree<int, int, 4> b;
+    b.build_parallel(items_.begin(), items_.end(), 4);
+
+    ExpectSortedContents(b);
+
+    for (size_t idx = 0; idx < items_.size(); idx += 97)
+        EXPECT_EQ(items_[idx].second, b.find(items_[idx].first)->second);
+}
+
+TEST_F(UnsortedInput, ShouldBuildOnOneThread) {
+    cbt::btree<int, int, 1> b;
+    b.build_parallel(items_.begin(), items_.end(), 1);
+
+    ExpectSortedContents(b);
+}
+
+TEST_F(UnsortedInput, ShouldKeepEqualKeysTogether) {
+    for (size_t idx = 0; idx < items_.size(); idx++)
+        items_[idx].first %= 5;
+
+    cbt::btree<int, int, 2> b;
+    b.build_parallel(items_.begin(), items_.end(), 8);
+
+    ExpectSortedContents(b);
+}
+
+TEST_F(UnsortedInput, ShouldBuildTreeThatKeepsBalanceOnChanges) {
+    cbt::btree_stats stats;
+    cbt::btree<int, int, 3> b;
+    b.insert(-1, -1);
+    b.set_stats(&stats);
+    b.build_parallel(items_.begin(), items_.end(), 3);
+
+    EXPECT_EQ(items_.size(), stats.entries());
+    EXPECT_LE(0.5, stats.fill_factor());
+
+    for (size_t idx = 0; idx < items_.size(); idx += 2) {
+        b.erase(items_[idx].first);
+        items_[idx].first = -items_[idx].first;
+        b.insert(items_[idx].first, items_[idx].second);
+    }
+
+    ExpectSortedContents(b);
+}
+
+TEST(BuildParallel, ShouldBuildSmallInputs) {
+    for (int n = 0; n < 200; n++) {
+        std::vector<std::pair<int, int> > items;
+
+        for (int i = n; i > 0; i--)
+            items.push_back(std::make_pair(i, i));
+
+        cbt::btree<int, int, 2> b;
+        b.build_parallel(items.begin(), items.end(), 2);
+
+        ASSERT_EQ(static_cast<size_t>(n), b.size());
+
+        int key = 1;
+        for (cbt::btree<int, int, 2>::iterator it = b.begin(); it != b.end(); ++it)
+            EXPECT_EQ(key++, it->first);
+    }
+}
+
+
+class FilledBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            for (int i = 0; i < 100000; i++)
+                b_.insert(i, 2*i);
+        }
+
+        cbt::btree<int, int, 3> b_;
+};
+
+struct CountVisits {
+    explicit CountVisits(std::vector<int>* p_visits) : p_visits_(p_visits) { }
+
+    void operator()(const std::pair<int, int>& item) {
+        __atomic_add_fetch(&(*p_visits_)[item.first], 1, __ATOMIC_RELAXED);
+    }
+
+    std::vector<int>* p_visits_;
+};
+
+TEST_F(FilledBTree, ShouldVisitEveryEntryOnce) {
+    std::vector<int> visits(b_.size(), 0);
+    b_.parallel_for_each(CountVisits(&visits), 4);
+
+    EXPECT_EQ(static_cast<ptrdiff_t>(visits.size()),
+            std::count(visits.begin(), visits.end(), 1));
+}
+
+TEST_F(FilledBTree, ShouldVisitOnlyEntriesInRange) {
+    std::vector<int> visits(b_.size(), 0);
+    b_.parallel_for_each(1234, 98765, CountVisits(&visits), 4);
+
+    for (int i = 0; i < static_cast<int>(visits.size()); i++)
+        ASSERT_EQ(i >= 1234 && i <= 98765 ? 1 : 0, visits[i]) << i;
+}
+
+// not commutative: tells whether its entries were combined in key order
+struct Span {
+    Span() : first_(0), last_(0), count_(0), sorted_(true) { }
+
+    int first_;
+    int last_;
+    int count_;
+    bool sorted_;
+};
+
+struct ToSpan {
+    Span operator()(const std::pair<int, int>& item) const {
+        Span s;
+        s.first_ = s.last_ = item.first;
+        s.count_ = 1;
+        return s;
+    }
+};
+
+struct JoinSpans {
+    Span operator()(const Span& a, const Span& b) const {
+        if (a.count_ == 0)
+            return b;
+
+        Span s = a;
+        s.last_ = b.last_;
+        s.count_ += b.count_;
+        s.sorted_ = a.sorted_ && b.sorted_ && a.last_ < b.first_;
+        return s;
+    }
+};
+
+TEST_F(FilledBTree, ShouldReduceInKeyOrder) {
+    Span s = b_.parallel_reduce(Span(), ToSpan(), JoinSpans(), 8);
+
+    EXPECT_TRUE(s.sorted_);
+    EXPECT_EQ(100000, s.count_);
+    EXPECT_EQ(0, s.first_);
+    EXPECT_EQ(99999, s.last_);
+}
+
+struct ValueOf {
+    long operator()(const std::pair<int, int>& item) const { return item.second; }
+};
+
+struct Sum {
+    long operator()(const long& a, const long& b) const { return a + b; }
+};
+
+TEST_F(FilledBTree, ShouldReduceRangeStartingFromInit) {
+    long expected = 7;
+
+    for (int i = 500; i <= 77777; i++)
+        expected += 2*i;
+
+    EXPECT_EQ(expected, b_.parallel_reduce(500, 77777, 7L, ValueOf(), Sum(), 3));
+    EXPECT_EQ(7L, b_.parallel_reduce(200000, 300000, 7L, ValueOf(), Sum()));
+}
+
+TEST_F(FilledBTree, ShouldReduceBufferedWrites) {
+    b_.set_write_buffer(100000);
+
+    for (int i = 0; i < 100000; i += 100)
+        b_.erase(i);
+
+    for (int i = 50; i < 100000; i += 100)
+        b_.upsert(i, 0);
+
+    for (int i = -500; i < 0; i++)
+        b_.insert(i, 1);
+
+    for (int i = 100000; i < 101000; i++)
+        b_.insert(i, 1);
+
+    cbt::btree<int, int, 3> applied = b_.clone();
+    applied.flush();
+
+    Span s = b_.parallel_reduce(Span(), ToSpan(), JoinSpans(), 8);
+
+    EXPECT_TRUE(s.sorted_);
+    EXPECT_EQ(static_cast<int>(applied.size()), s.count_);
+    EXPECT_EQ(-500, s.first_);
+    EXPECT_EQ(100999, s.last_);
+
+    EXPECT_EQ(applied.parallel_reduce(0L, ValueOf(), Sum()),
+            b_.parallel_reduce(0L, ValueOf(), Sum(), 4));
+    EXPECT_EQ(applied.parallel_reduce(-10, 55555, 0L, ValueOf(), Sum()),
+            b_.parallel_reduce(-10, 55555, 0L, ValueOf(), Sum(), 4));
+}
+
+TEST(ParallelReduce, ShouldReduceEmptyAndSmallTrees) {
+    cbt::btree<int, int, 2> b;
+    EXPECT_EQ(0L, b.parallel_reduce(0L, ValueOf(), Sum(), 4));
+
+    for (int i = 1; i <= 10; i++)
+        b.insert(i, i);
+
+    EXPECT_EQ(55L, b.parallel_reduce(0L, ValueOf(), Sum(), 4));
+    EXPECT_EQ(12L, b.parallel_reduce(3, 5, 0L, ValueOf(), Sum(), 4));
+}
+
+TEST(ParallelReduce, ShouldReuseWorkerThreads) {
+    cbt::btree<int, int, 2> b;
+
+    for (int i = 1; i <= 1000; i++)
+        b.insert(i, i);
+
+    EXPECT_EQ(500500L, b.parallel_reduce(0L, ValueOf(), Sum(), 4));
+    size_t threads = cbt::_BTreeThreadPool::instance().num_threads();
+    EXPECT_LE(3u, threads);
+
+    for (int i = 0; i < 20; i++)
+        EXPECT_EQ(500500L, b.parallel_reduce(0L, ValueOf(), Sum(), 4));
+
+    EXPECT_EQ(threads, cbt::_BTreeThreadPool::instance().num_threads());
+}
+
+struct ReduceTask {
+    const cbt::btree<int, int, 3>* p_b_;
+    long result_;
+};
+
+void* ReduceRepeatedly(void* p_arg) {
+    ReduceTask* p_task = static_cast<ReduceTask*>(p_arg);
+
+    for (int i = 0; i < 10; i++)
+        p_task->result_ += p_task->p_b_->parallel_reduce(0L, ValueOf(), Sum(), 4);
+
+    return NULL;
+}
+
+TEST_F(FilledBTree, ShouldReduceFromSeveralThreadsAtOnce) {
+    cbt::btree_stats stats(1);
+    b_.set_stats(&stats);
+
+    ReduceTask tasks[4];
+    pthread_t threads[4];
+
+    for (int t = 0; t < 4; t++) {
+        tasks[t].p_b_ = &b_;
+        tasks[t].result_ = 0;
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, &ReduceRepeatedly, &tasks[t]));
+    }
+
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        EXPECT_EQ(10L * 99999L * 100000L, tasks[t].result_);
+    }
+
+    EXPECT_EQ(40u, stats.ops(cbt::btree_stats::SCAN));
+    EXPECT_EQ(40u, stats.histogram(cbt::btree_stats::SCAN).count());
+    b_.set_stats(NULL);
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
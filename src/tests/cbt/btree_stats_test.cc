@@ -0,0 +1,264 @@
+/*
+ * CBTL - A btree template library for C++
+ * ---------------------------------------
+ * Copyright (C) 2011 Leandro Costa
+ *
+ * This file is part of CBTL.
+ *
+ * CBTL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * CBTL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with CBTL. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file tests/cbt/btree_stats_test.cc
+ * \brief Tests for latency_histogram and btree_stats classes.
+ * \author Leandro Costa
+ * \date 2011
+ */
+
+#include <glog/logging.h>
+#include <sstream>
+#include <vector>
+#include "gtest/gtest.h"
+#include "cbt/btree.h"
+
+TEST(LatencyHistogram, ShouldCountSmallValuesExactly) {
+    cbt::latency_histogram h;
+
+    for (uint64_t v = 0; v < 32; v++)
+        h.record(v);
+
+    EXPECT_EQ(32u, h.count());
+    EXPECT_EQ(0u, h.min());
+    EXPECT_EQ(31u, h.max());
+    EXPECT_EQ(15u, h.percentile(50));
+}
+
+TEST(LatencyHistogram, ShouldMapBucketsContiguously) {
+    for (uint32_t b = 1; b < cbt::latency_histogram::NUM_BUCKETS; b++)
+        EXPECT_EQ(cbt::latency_histogram::bucket_high(b-1) + 1,
+                cbt::latency_histogram::bucket_low(b));
+}
+
+TEST(LatencyHistogram, ShouldRecordTheLargestValue) {
+    cbt::latency_histogram h;
+    h.record(~0ULL);
+
+    EXPECT_EQ(cbt::latency_histogram::NUM_BUCKETS - 1,
+            cbt::latency_histogram::bucket_of(~0ULL));
+    EXPECT_EQ(~0ULL, cbt::latency_histogram::bucket_high(
+                cbt::latency_histogram::NUM_BUCKETS - 1));
+    EXPECT_EQ(1u, h.count_at(cbt::latency_histogram::NUM_BUCKETS - 1));
+    EXPECT_EQ(~0ULL, h.max());
+}
+
+TEST(LatencyHistogram, ShouldKeepRelativeErrorBounded) {
+    cbt::latency_histogram h;
+    h.record(1000000);
+
+    uint64_t p = h.percentile(100);
+    EXPECT_LE(1000000u, p + 1000000u / cbt::latency_histogram::SUB_BUCKETS);
+    EXPECT_GE(1000000u + 1000000u / cbt::latency_histogram::SUB_BUCKETS, p);
+}
+
+TEST(LatencyHistogram, ShouldMergeCountsAndExtremes) {
+    cbt::latency_histogram a, b;
+    a.record(10);
+    a.record(20);
+    b.record(5);
+    b.record(5000);
+
+    a.merge(b);
+
+    EXPECT_EQ(4u, a.count());
+    EXPECT_EQ(5u, a.min());
+    EXPECT_EQ(5000u, a.max());
+    EXPECT_EQ(5035u, a.sum());
+}
+
+TEST(LatencyHistogram, ShouldExportJson) {
+    cbt::latency_histogram h;
+    h.record(3);
+
+    std::ostringstream os;
+    h.print_json(os);
+
+    EXPECT_EQ(0u, os.str().find("{\"count\":1,\"min\":3,\"max\":3,"));
+    EXPECT_NE(std::string::npos, os.str().find("\"buckets\":[[3,1]]"));
+}
+
+
+class StatsBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            p_stats_ = new cbt::btree_stats(1);
+            p_btree_ = new cbt::btree<int, std::string>();
+            p_btree_->set_stats(p_stats_);
+        }
+
+        cbt::btree_stats* p_stats_;
+        cbt::btree<int, std::string>* p_btree_;
+};
+
+TEST_F(StatsBTree, ShouldCountAndTimeInserts) {
+    for (int i = 0; i < 10; i++)
+        p_btree_->insert(i, "A");
+
+    EXPECT_EQ(10u, p_stats_->ops(cbt::btree_stats::INSERT));
+    EXPECT_EQ(10u, p_stats_->histogram(cbt::btree_stats::INSERT).count());
+}
+
+TEST_F(StatsBTree, ShouldCountAndTimeFinds) {
+    p_btree_->insert(1, "A");
+    p_btree_->find(1);
+    p_btree_->find(2);
+
+    EXPECT_EQ(2u, p_stats_->ops(cbt::btree_stats::FIND));
+    EXPECT_EQ(2u, p_stats_->histogram(cbt::btree_stats::FIND).count());
+}
+
+struct IgnoreItem {
+    void operator()(const std::pair<int, std::string>& item) { }
+};
+
+TEST_F(StatsBTree, ShouldCountAndTimeErasesAndScans) {
+    p_btree_->insert(1, "A");
+    p_btree_->insert(2, "B");
+    p_btree_->scan(1, 2, IgnoreItem());
+    p_btree_->reverse_scan(2, 1, IgnoreItem());
+    p_btree_->erase(1);
+    p_btree_->pop_max();
+
+    EXPECT_EQ(2u, p_stats_->ops(cbt::btree_stats::SCAN));
+    EXPECT_EQ(2u, p_stats_->ops(cbt::btree_stats::ERASE));
+    EXPECT_EQ(2u, p_stats_->histogram(cbt::btree_stats::ERASE).count());
+    EXPECT_EQ(0u, p_stats_->entries());
+}
+
+TEST_F(StatsBTree, ShouldStopRecordingWhenDetached) {
+    p_btree_->set_stats(NULL);
+    p_btree_->insert(1, "A");
+
+    EXPECT_EQ(0u, p_stats_->ops(cbt::btree_stats::INSERT));
+}
+
+TEST(BTreeStats, ShouldSampleOneInPeriodOperations) {
+    cbt::btree_stats stats(50);
+    cbt::btree<int, int> b;
+    b.set_stats(&stats);
+
+    for (int i = 0; i < 640; i++)
+        b.insert(i, i);
+
+    EXPECT_EQ(64u, stats.sample_period());
+    EXPECT_EQ(640u, stats.ops(cbt::btree_stats::INSERT));
+    EXPECT_EQ(10u, stats.histogram(cbt::btree_stats::INSERT).count());
+}
+
+TEST(BTreeStats, ShouldCountEveryEntryOfABatch) {
+    cbt::btree_stats stats(4);
+    cbt::btree<int, int> b;
+    b.set_stats(&stats);
+
+    std::vector<std::pair<int, int> > batch;
+
+    for (int i = 0; i < 10; i++)
+        batch.push_back(std::make_pair(i, i));
+
+    b.insert(-1, -1);
+    b.insert_batch(batch.begin(), batch.end());
+
+    // the batch takes ticks 2 to 11, so it holds the 4th and the 8th
+    EXPECT_EQ(11u, stats.ops(cbt::btree_stats::INSERT));
+    EXPECT_EQ(2u, stats.histogram(cbt::btree_stats::INSERT).count());
+}
+
+TEST(BTreeStats, ShouldMergeStatsOfDifferentTrees) {
+    cbt::btree_stats s1(1), s2(1);
+    cbt::btree<int, int> b1, b2;
+    b1.set_stats(&s1);
+    b2.set_stats(&s2);
+
+    b1.insert(1, 1);
+    b2.insert(2, 2);
+    b2.insert(3, 3);
+
+    s1.merge(s2);
+
+    EXPECT_EQ(3u, s1.ops(cbt::btree_stats::INSERT));
+    EXPECT_EQ(3u, s1.histogram(cbt::btree_stats::INSERT).count());
+}
+
+TEST(BTreeStats, ShouldExportTextAndJson) {
+    cbt::btree_stats stats(1);
+    stats.count(cbt::btree_stats::FIND);
+    stats.histogram(cbt::btree_stats::FIND).record(7);
+
+    std::ostringstream text, json;
+    stats.print_text(text);
+    stats.print_json(json);
+
+    EXPECT_NE(std::string::npos, text.str().find("find: ops=1 count=1 min=7"));
+    EXPECT_EQ(0u, json.str().find("{\"unit\":\"ticks\",\"sample_period\":1,"));
+    EXPECT_NE(std::string::npos, json.str().find("\"find\":{\"ops\":1,"));
+}
+
+TEST(BTreeStats, ShouldTrackShapeWhileInserting) {
+    cbt::btree_stats stats;
+    cbt::btree<int, int> b;
+    b.set_stats(&stats);
+
+    // an empty tree shares its root with every other empty tree
+    EXPECT_EQ(0u, stats.height());
+    EXPECT_EQ(0u, stats.nodes());
+    EXPECT_EQ(0u, stats.allocated_bytes());
+
+    b.insert(0, 0);
+    EXPECT_EQ(1u, stats.height());
+    EXPECT_EQ(1u, stats.nodes());
+
+    for (int i = 1; i < 7; i++)
+        b.insert(i, i);
+
+    // order 1: 7 sequential keys end up in 3 levels with 4 leaves
+    EXPECT_EQ(7u, stats.entries());
+    EXPECT_EQ(3u, stats.height());
+    EXPECT_EQ(4u, stats.nodes(0));
+    EXPECT_EQ(2u, stats.nodes(1));
+    EXPECT_EQ(1u, stats.nodes(2));
+    EXPECT_EQ(7u * sizeof(cbt::_BTreeNode<int, int, 1>), stats.allocated_bytes());
+    EXPECT_DOUBLE_EQ(0.5, stats.fill_factor());
+}
+
+TEST(BTreeStats, ShouldCollectShapeWhenAttachedToFilledTree) {
+    cbt::btree_stats live, late;
+    cbt::btree<int, int> b;
+    b.set_stats(&live);
+
+    for (int i = 0; i < 100; i++)
+        b.insert((i * 37) % 100, i);
+
+    b.set_stats(&late);
+
+    EXPECT_EQ(live.entries(), late.entries());
+    EXPECT_EQ(live.height(), late.height());
+
+    for (uint8_t level = 0; level < live.height(); level++)
+        EXPECT_EQ(live.nodes(level), late.nodes(level));
+}
+
+int main(int argc, char* argv[]) {
+    ::google::InitGoogleLogging(argv[0]);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -27,6 +27,13 @@
  */
 
 #include <glog/logging.h>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "gtest/gtest.h"
 #include "cbt/btree.h"
 
@@ -225,6 +232,904 @@ TEST_F(SevenItemsBTree, ShouldReturnCorrectNodeWithFind) {
   EXPECT_EQ(5, p_btree_->find(5)->first);
 }
 
+TEST_F(SevenItemsBTree, ShouldFindEveryKey) {
+  for (int key = 1; key <= 7; key++)
+    EXPECT_EQ(key, p_btree_->find(key)->first);
+}
+
+TEST_F(SevenItemsBTree, ShouldHaveSizeSeven) {
+  EXPECT_EQ(7u, p_btree_->size());
+}
+
+TEST_F(SevenItemsBTree, ShouldReturnMinAndMax) {
+  EXPECT_EQ(1, p_btree_->min().first);
+  EXPECT_EQ("G", p_btree_->min().second);
+  EXPECT_EQ(7, p_btree_->max().first);
+  EXPECT_EQ("B", p_btree_->max().second);
+}
+
+TEST_F(SevenItemsBTree, ShouldPopItemsInKeyOrder) {
+  for (int key = 1; key <= 7; key++)
+    EXPECT_EQ(key, p_btree_->pop_min().first);
+
+  EXPECT_TRUE(p_btree_->empty());
+  EXPECT_EQ(0u, p_btree_->size());
+  EXPECT_EQ(p_btree_->end(), p_btree_->begin());
+}
+
+TEST_F(SevenItemsBTree, ShouldPopItemsInReverseKeyOrder) {
+  for (int key = 7; key >= 1; key--)
+    EXPECT_EQ(key, p_btree_->pop_max().first);
+
+  EXPECT_TRUE(p_btree_->empty());
+}
+
+TEST_F(SevenItemsBTree, ShouldEraseInnerKey) {
+  EXPECT_EQ(1u, p_btree_->erase(4));
+  EXPECT_EQ(p_btree_->end(), p_btree_->find(4));
+  EXPECT_EQ(6u, p_btree_->size());
+
+  cbt::btree<int, std::string>::iterator it = p_btree_->begin();
+  for (int key = 1; key <= 7; key++) {
+    if (key != 4) {
+      EXPECT_EQ(key, (it++)->first);
+    }
+  }
+  EXPECT_EQ(p_btree_->end(), it);
+}
+
+TEST_F(SevenItemsBTree, ShouldNotEraseMissingKey) {
+  EXPECT_EQ(0u, p_btree_->erase(8));
+  EXPECT_EQ(7u, p_btree_->size());
+}
+
+TEST_F(SevenItemsBTree, ShouldPermitIterateBackwardsFromEnd) {
+  cbt::btree<int, std::string>::iterator it = p_btree_->end();
+
+  for (int key = 7; key >= 1; key--)
+    EXPECT_EQ(key, (--it)->first);
+
+  EXPECT_EQ(p_btree_->begin(), it);
+}
+
+TEST_F(SevenItemsBTree, ShouldPermitReverseIterateByItems) {
+  cbt::btree<int, std::string>::reverse_iterator it = p_btree_->rbegin();
+
+  for (int key = 7; key >= 1; key--)
+    EXPECT_EQ(key, (it++)->first);
+
+  EXPECT_EQ(p_btree_->rend(), it);
+}
+
+TEST_F(SevenItemsBTree, ShouldReturnLowerAndUpperBounds) {
+  EXPECT_EQ(4, p_btree_->lower_bound(4)->first);
+  EXPECT_EQ(5, p_btree_->upper_bound(4)->first);
+  EXPECT_EQ(1, p_btree_->lower_bound(0)->first);
+  EXPECT_EQ(p_btree_->end(), p_btree_->lower_bound(8));
+  EXPECT_EQ(p_btree_->end(), p_btree_->upper_bound(7));
+}
+
+struct CollectKeys {
+  explicit CollectKeys(std::vector<int>* p_keys) : p_keys_(p_keys) { }
+  void operator()(const std::pair<int, std::string>& item) {
+    p_keys_->push_back(item.first);
+  }
+  std::vector<int>* p_keys_;
+};
+
+TEST_F(SevenItemsBTree, ShouldScanRangeInKeyOrder) {
+  std::vector<int> keys;
+  p_btree_->scan(3, 5, CollectKeys(&keys));
+
+  ASSERT_EQ(3u, keys.size());
+  EXPECT_EQ(3, keys[0]);
+  EXPECT_EQ(5, keys[2]);
+}
+
+TEST_F(SevenItemsBTree, ShouldScanRangeInReverseKeyOrder) {
+  std::vector<int> keys;
+  p_btree_->reverse_scan(9, 5, CollectKeys(&keys));
+
+  ASSERT_EQ(3u, keys.size());
+  EXPECT_EQ(7, keys[0]);
+  EXPECT_EQ(5, keys[2]);
+}
+
+TEST_F(SevenItemsBTree, ShouldReverseScanNothingBelowFirstKey) {
+  std::vector<int> keys;
+  p_btree_->reverse_scan(0, -5, CollectKeys(&keys));
+
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(EmptyBTree, ShouldHaveRbeginEqualToRend) {
+  EXPECT_EQ(p_btree_->rend(), p_btree_->rbegin());
+}
+
+TEST_F(EmptyBTree, ShouldThrowWhenPoppingFromEmptyTree) {
+  EXPECT_THROW(p_btree_->pop_min(), std::out_of_range);
+  EXPECT_THROW(p_btree_->pop_max(), std::out_of_range);
+}
+
+TEST_F(EmptyBTree, ShouldKeepEmptyTreesApartOnFirstInsert) {
+  cbt::btree<int, std::string> other;
+  cbt::btree<int, std::string> copy = p_btree_->clone();
+
+  EXPECT_EQ(0u, p_btree_->erase(1));
+  p_btree_->insert(1, "A");
+  other.insert(2, "B");
+
+  EXPECT_EQ(1u, p_btree_->size());
+  EXPECT_EQ(p_btree_->end(), p_btree_->find(2));
+  EXPECT_EQ("B", other.find(2)->second);
+  EXPECT_TRUE(copy.empty());
+  EXPECT_TRUE((cbt::btree<int, std::string>().empty()));
+}
+
+TEST_F(EmptyBTree, ShouldBecomeEmptyAgainAfterJoin) {
+  cbt::btree<int, std::string> right;
+  right.insert(5, "E");
+
+  p_btree_->join(&right);
+
+  EXPECT_TRUE(right.empty());
+  EXPECT_EQ(right.end(), right.begin());
+
+  right.insert(6, "F");
+
+  EXPECT_EQ(1u, right.size());
+  EXPECT_EQ(1u, p_btree_->size());
+}
+
+
+class RandomBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(7);
+
+            for (int i = 0; i < 2000; i++) {
+                int key = rand() % 4000;
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+            }
+        }
+
+        void ExpectSameContents() {
+            EXPECT_EQ(map_.size(), btree_.size());
+
+            std::map<int, int>::iterator it_map = map_.begin();
+            cbt::btree<int, int, 2>::iterator it = btree_.begin();
+
+            for (; it_map != map_.end(); ++it_map, ++it) {
+                ASSERT_NE(btree_.end(), it);
+                EXPECT_EQ(it_map->first, it->first);
+                EXPECT_EQ(it_map->second, it->second);
+            }
+
+            EXPECT_EQ(btree_.end(), it);
+
+            if (!map_.empty()) {
+                EXPECT_EQ(map_.begin()->first, btree_.min().first);
+                EXPECT_EQ(map_.rbegin()->first, btree_.max().first);
+            }
+        }
+
+        std::map<int, int> map_;
+        cbt::btree<int, int, 2> btree_;
+};
+
+TEST_F(RandomBTree, ShouldIterateInKeyOrder) {
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldFindEveryKey) {
+    for (std::map<int, int>::iterator it = map_.begin(); it != map_.end(); ++it)
+        EXPECT_EQ(it->second, btree_.find(it->first)->second);
+}
+
+TEST_F(RandomBTree, ShouldReverseIterateInDescendingKeyOrder) {
+    std::map<int, int>::reverse_iterator it_map = map_.rbegin();
+    cbt::btree<int, int, 2>::reverse_iterator it = btree_.rbegin();
+
+    for (; it_map != map_.rend(); ++it_map, ++it) {
+        ASSERT_NE(btree_.rend(), it);
+        EXPECT_EQ(it_map->first, it->first);
+    }
+
+    EXPECT_EQ(btree_.rend(), it);
+}
+
+TEST_F(RandomBTree, ShouldMatchMapBounds) {
+    for (int key = -1; key <= 4001; key += 7) {
+        std::map<int, int>::iterator it_map = map_.lower_bound(key);
+        cbt::btree<int, int, 2>::iterator it = btree_.lower_bound(key);
+
+        if (it_map == map_.end())
+            EXPECT_EQ(btree_.end(), it);
+        else
+            EXPECT_EQ(it_map->first, it->first);
+
+        it_map = map_.upper_bound(key);
+        it = btree_.upper_bound(key);
+
+        if (it_map == map_.end())
+            EXPECT_EQ(btree_.end(), it);
+        else
+            EXPECT_EQ(it_map->first, it->first);
+    }
+}
+
+TEST_F(RandomBTree, ShouldKeepContentsWhileErasing) {
+    for (int i = 0; i < 3000; i++) {
+        int key = rand() % 4000;
+        EXPECT_EQ(map_.erase(key), btree_.erase(key));
+
+        if (i % 500 == 0)
+            ExpectSameContents();
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldKeepContentsWhilePoppingBothEnds) {
+    while (!map_.empty()) {
+        EXPECT_EQ(map_.begin()->first, btree_.pop_min().first);
+        map_.erase(map_.begin());
+
+        if (!map_.empty()) {
+            EXPECT_EQ(map_.rbegin()->first, btree_.pop_max().first);
+            map_.erase(--map_.end());
+        }
+
+        if (map_.size() % 256 == 0)
+            ExpectSameContents();
+    }
+
+    EXPECT_TRUE(btree_.empty());
+}
+
+TEST_F(RandomBTree, ShouldKeepCountsWhenPopsMixWithOtherChanges) {
+    for (int i = 0; i < 400 && !map_.empty(); i++) {
+        for (int pops = rand() % 8; pops > 0 && !map_.empty(); pops--) {
+            if (rand() % 2) {
+                EXPECT_EQ(map_.begin()->first, btree_.pop_min().first);
+                map_.erase(map_.begin());
+            } else {
+                EXPECT_EQ(map_.rbegin()->first, btree_.pop_max().first);
+                map_.erase(--map_.end());
+            }
+        }
+
+        EXPECT_EQ(map_.size(), btree_.size());
+        int key = rand() % 4000;
+
+        if (i % 4 == 0) {
+            if (map_.insert(std::make_pair(key, i)).second)
+                btree_.insert(key, i);
+        } else if (i % 4 == 1) {
+            EXPECT_EQ(map_.erase(key), btree_.erase(key));
+        } else if (i % 4 == 2) {
+            cbt::btree<int, int, 2> right;
+            btree_.split_at(key, &right);
+
+            EXPECT_EQ(static_cast<size_t>(std::distance(map_.lower_bound(key),
+                            map_.end())), right.size());
+            btree_.join(&right);
+        } else {
+            cbt::btree<int, int, 2> clone = btree_.clone();
+            EXPECT_EQ(map_.size(), clone.size());
+
+            if (!clone.empty()) {
+                EXPECT_EQ(map_.begin()->first, clone.pop_min().first);
+                EXPECT_EQ(map_.size()-1, clone.size());
+            }
+        }
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldSplitAndJoinBack) {
+    for (int key = -1; key <= 4001; key += 250) {
+        cbt::btree<int, int, 2> right;
+        btree_.split_at(key, &right);
+
+        std::map<int, int>::iterator it_map = map_.lower_bound(key);
+        EXPECT_EQ(static_cast<size_t>(std::distance(map_.begin(), it_map)),
+                btree_.size());
+        EXPECT_EQ(static_cast<size_t>(std::distance(it_map, map_.end())),
+                right.size());
+
+        if (!right.empty()) {
+            EXPECT_EQ(it_map->first, right.min().first);
+        }
+
+        if (!btree_.empty()) {
+            EXPECT_GT(key, btree_.max().first);
+        }
+
+        btree_.join(&right);
+
+        EXPECT_TRUE(right.empty());
+        ExpectSameContents();
+    }
+}
+
+TEST_F(RandomBTree, ShouldKeepBothHalvesUsableAfterSplit) {
+    cbt::btree<int, int, 2> right;
+    btree_.split_at(1234, &right);
+
+    for (int i = 0; i < 1000; i++) {
+        int key = rand() % 4000;
+
+        if (key < 1234) {
+            map_.erase(key);
+            btree_.erase(key);
+        } else if (map_.insert(std::make_pair(key, i)).second) {
+            right.insert(key, i);
+        }
+    }
+
+    btree_.join(&right);
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldLeaveSourceUnchangedWhenCloneChanges) {
+    cbt::btree<int, int, 2> copy = btree_.clone();
+    std::map<int, int> copy_map = map_;
+
+    for (int i = 0; i < 2000; i++) {
+        int key = rand() % 4000;
+
+        if (i % 2) {
+            EXPECT_EQ(copy_map.erase(key), copy.erase(key));
+        } else if (copy_map.insert(std::make_pair(key, -i)).second) {
+            copy.insert(key, -i);
+        }
+    }
+
+    ExpectSameContents();
+
+    std::map<int, int>::iterator it_map = copy_map.begin();
+    cbt::btree<int, int, 2>::iterator it = copy.begin();
+
+    for (; it_map != copy_map.end(); ++it_map, ++it) {
+        ASSERT_NE(copy.end(), it);
+        EXPECT_EQ(it_map->first, it->first);
+        EXPECT_EQ(it_map->second, it->second);
+    }
+
+    EXPECT_EQ(copy.end(), it);
+    EXPECT_EQ(copy_map.size(), copy.size());
+}
+
+TEST_F(RandomBTree, ShouldLeaveCloneUnchangedWhenSourceChanges) {
+    cbt::btree<int, int, 2>* p_copy = new cbt::btree<int, int, 2>(btree_);
+    std::map<int, int> copy_map = map_;
+
+    while (map_.size() > 500) {
+        EXPECT_EQ(map_.begin()->first, btree_.pop_min().first);
+        map_.erase(map_.begin());
+    }
+
+    ExpectSameContents();
+    EXPECT_EQ(copy_map.size(), p_copy->size());
+    EXPECT_EQ(copy_map.begin()->first, p_copy->min().first);
+    EXPECT_EQ(copy_map.rbegin()->first, p_copy->rbegin()->first);
+
+    // the source takes over the nodes the clone no longer refers to
+    delete p_copy;
+
+    for (int i = 0; i < 500; i++) {
+        EXPECT_EQ(map_.rbegin()->first, btree_.pop_max().first);
+        map_.erase(--map_.end());
+    }
+
+    EXPECT_TRUE(btree_.empty());
+}
+
+TEST_F(RandomBTree, ShouldShareNodesOnAssignment) {
+    cbt::btree<int, int, 2> copy;
+    copy.insert(-1, -1);
+    copy = btree_;
+    btree_.insert(-2, -2);
+
+    EXPECT_EQ(map_.size(), copy.size());
+    EXPECT_EQ(map_.begin()->first, copy.min().first);
+    EXPECT_EQ(-2, btree_.min().first);
+}
+
+TEST_F(RandomBTree, ShouldAssignWhatCopiesCarry) {
+    btree_.set_write_buffer(100);
+    btree_.set_huge_pages(true);
+    btree_.insert(-1, -1);  // still buffered
+
+    cbt::btree<int, int, 2> copy;
+    copy = btree_;
+    cbt::btree<int, int, 2> constructed(btree_);
+
+    EXPECT_EQ(constructed.write_buffer(), copy.write_buffer());
+    EXPECT_EQ(constructed.huge_pages(), copy.huge_pages());
+    EXPECT_EQ(map_.size() + 1, copy.size());
+    EXPECT_EQ(-1, copy.min().first);
+    EXPECT_EQ(-1, copy.find(-1)->second);
+}
+
+TEST(BTree, ShouldIterateDuplicateKeysAfterClone) {
+    typedef cbt::btree<int, int, 2> Tree;
+    Tree source;
+
+    for (int i = 0; i < 200; i++)
+        source.insert(i % 10, i);
+
+    Tree copy(source);
+    Tree* trees[] = { &source, &copy };
+
+    for (int t = 0; t < 2; t++) {
+        size_t n = 0;
+        int last = -1;
+
+        for (Tree::iterator it = trees[t]->begin(); it != trees[t]->end(); ++it, n++) {
+            EXPECT_LE(last, it->first);
+            last = it->first;
+        }
+
+        EXPECT_EQ(200u, n);
+
+        n = 0;
+        last = 10;
+
+        for (Tree::reverse_iterator it = trees[t]->rbegin(); it != trees[t]->rend(); ++it, n++) {
+            EXPECT_GE(last, it->first);
+            last = it->first;
+        }
+
+        EXPECT_EQ(200u, n);
+
+        n = 0;
+
+        for (Tree::iterator it = trees[t]->lower_bound(5); it != trees[t]->end() && it->first == 5; ++it)
+            n++;
+
+        EXPECT_EQ(20u, n);
+    }
+}
+
+TEST_F(RandomBTree, ShouldUpsertExistingAndMissingKeys) {
+    for (int key = 0; key < 4000; key += 7) {
+        btree_.upsert(key, -key);
+        map_[key] = -key;
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldApplyBufferedWritesLikeDirectOnes) {
+    btree_.set_write_buffer(64);
+
+    for (int i = 0; i < 3000; i++) {
+        int key = rand() % 4000;
+
+        switch (i % 3) {
+            case 0:
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+                break;
+            case 1:
+                btree_.upsert(key, i);
+                map_[key] = i;
+                break;
+            case 2:
+                EXPECT_EQ(map_.erase(key), btree_.erase(key));
+                break;
+        }
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldFindBufferedWrites) {
+    btree_.set_write_buffer(1000);
+    btree_.insert(-1, 1);
+    btree_.upsert(map_.begin()->first, 2);
+
+    EXPECT_EQ(1, btree_.find(-1)->second);
+    EXPECT_EQ(2, btree_.find(map_.begin()->first)->second);
+
+    btree_.erase(-1);
+    EXPECT_EQ(btree_.end(), btree_.find(-1));
+    EXPECT_EQ(0u, btree_.erase(-1));
+}
+
+TEST_F(RandomBTree, ShouldKeepWritesOfOneKeyInOrder) {
+    btree_.set_write_buffer(16);
+    btree_.insert(-1, 1);
+    btree_.erase(-1);
+    btree_.upsert(-1, 2);
+    btree_.upsert(-1, 3);
+    btree_.flush();
+
+    EXPECT_EQ(3, btree_.find(-1)->second);
+    EXPECT_EQ(map_.size() + 1, btree_.size());
+}
+
+TEST_F(RandomBTree, ShouldReadBufferedWritesWithoutApplyingThem) {
+    cbt::btree_stats stats;
+    btree_.set_stats(&stats);
+    btree_.set_write_buffer(100000);
+
+    size_t entries = map_.size();
+
+    for (int i = 0; i < 2000; i++) {
+        int key = (i * 7919) % 4200 - 100;  // a write to a buffered key flushes
+
+        switch (i % 3) {
+            case 0:
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+                break;
+            case 1:
+                btree_.upsert(key, i);
+                map_[key] = i;
+                break;
+            case 2:
+                EXPECT_EQ(map_.erase(key), btree_.erase(key));
+                break;
+        }
+    }
+
+    const cbt::btree<int, int, 2>& tree = btree_;
+    std::vector<std::pair<int, int> > expected(map_.begin(), map_.end());
+
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_FALSE(tree.empty());
+    EXPECT_EQ(expected.front(), tree.min());
+    EXPECT_EQ(expected.back(), tree.max());
+
+    std::vector<std::pair<int, int> > merged;
+    cbt::btree<int, int, 2>::cursor c = tree.make_cursor();
+
+    for (bool valid = c.first(); valid; valid = c.next())
+        merged.push_back(*c);
+
+    EXPECT_EQ(expected, merged);
+
+    cbt::frozen_btree<int, int> frozen = tree.freeze();
+    std::vector<std::pair<int, int> > frozen_items(frozen.begin(),
+            frozen.end());
+    EXPECT_EQ(expected, frozen_items);
+
+    EXPECT_EQ(entries, stats.entries());
+    btree_.flush();
+    EXPECT_EQ(map_.size(), stats.entries());
+
+    ExpectSameContents();
+}
+
+TEST(BTree, ShouldMergeBufferedWritesWithEqualKeys) {
+    cbt::btree<int, int, 2> b;
+
+    for (int key = 0; key < 50; key++)
+        b.insert(key, 0);
+
+    b.insert(20, 1);
+    b.set_write_buffer(100);
+    b.upsert(20, 2);  // the first entry of 20
+    b.insert(20, 3);
+    b.erase(49);
+    b.insert(48, 4);
+
+    const cbt::btree<int, int, 2>& tree = b;
+    std::vector<std::pair<int, int> > merged;
+    cbt::btree<int, int, 2>::cursor c = tree.make_cursor();
+
+    for (bool valid = c.first(); valid; valid = c.next())
+        merged.push_back(*c);
+
+    EXPECT_EQ(52u, tree.size());
+    EXPECT_EQ(std::make_pair(48, 4), tree.max());
+    EXPECT_EQ(20, merged[20].first);
+    EXPECT_EQ(2, merged[20].second);  // upsert() sets the first
+    EXPECT_EQ(std::make_pair(20, 3), merged[22]);  // insert() goes after
+
+    b.flush();
+
+    std::vector<std::pair<int, int> > applied(b.begin(), b.end());
+    EXPECT_EQ(applied, merged);
+}
+
+TEST_F(RandomBTree, ShouldInsertUnsortedBatch) {
+    std::vector<std::pair<int, int> > batch;
+
+    for (int i = 0; i < 3000; i++) {
+        int key = 4000 + rand() % 8000;
+
+        if (map_.insert(std::make_pair(key, i)).second)
+            batch.push_back(std::make_pair(key, i));
+    }
+
+    btree_.insert_batch(batch.begin(), batch.end());
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldInsertBatchAcrossClone) {
+    cbt::btree<int, int, 2> copy = btree_.clone();
+    std::vector<std::pair<int, int> > batch;
+
+    for (int key = -500; key < 5000; key += 3) {
+        if (map_.insert(std::make_pair(key, key)).second)
+            batch.push_back(std::make_pair(key, key));
+    }
+
+    btree_.insert_batch(batch.begin(), batch.end());
+
+    ExpectSameContents();
+    EXPECT_EQ(map_.size() - batch.size(), copy.size());
+    EXPECT_EQ(copy.end(), copy.find(-500));
+}
+
+TEST_F(RandomBTree, ShouldKeepContentsWhenCompacted) {
+    btree_.compact();
+    ExpectSameContents();
+
+    for (int i = 0; i < 500; i++) {
+        int key = rand() % 4000;
+
+        if (map_.erase(key))
+            btree_.erase(key);
+        else if (map_.insert(std::make_pair(key, i)).second)
+            btree_.insert(key, i);
+    }
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldCompactIncrementallyWhileChanging) {
+    int calls = 1;
+
+    for (int i = 0; !btree_.compact(10); i++, calls++) {
+        int key = rand() % 4000;
+
+        if (map_.erase(key))
+            btree_.erase(key);
+        else if (map_.insert(std::make_pair(key, i)).second)
+            btree_.insert(key, i);
+    }
+
+    EXPECT_LT(1, calls);
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldKeepContentsInHugePageChunks) {
+    btree_.set_huge_pages(true);
+    btree_.compact();
+
+    EXPECT_TRUE(btree_.huge_pages());
+    ExpectSameContents();
+
+    btree_.set_huge_pages(false);
+    btree_.compact();
+
+    ExpectSameContents();
+}
+
+TEST_F(RandomBTree, ShouldLeaveCloneUnchangedWhenCompacted) {
+    cbt::btree<int, int, 2> copy = btree_.clone();
+
+    for (int key = 4000; key < 4500; key++) {
+        map_.insert(std::make_pair(key, key));
+        btree_.insert(key, key);
+    }
+
+    btree_.compact();
+    copy.compact();
+
+    ExpectSameContents();
+    EXPECT_EQ(map_.size() - 500, copy.size());
+    EXPECT_EQ(copy.end(), copy.find(4000));
+}
+
+TEST(BTree, ShouldRefillLeavesWhenCompacted) {
+    cbt::btree_stats stats;
+    cbt::btree<int, int, 2> b;
+    b.set_stats(&stats);
+
+    std::set<int> keys;
+    srand(5);
+
+    while (keys.size() < 3000) {
+        int key = rand();
+
+        if (keys.insert(key).second)
+            b.insert(key, key);
+    }
+
+    uint64_t nodes = stats.nodes();
+    double fill_factor = stats.fill_factor();
+
+    b.compact();
+
+    EXPECT_GT(nodes, stats.nodes());
+    EXPECT_LT(fill_factor, stats.fill_factor());
+    EXPECT_EQ(3000u, b.size());
+    EXPECT_EQ(*keys.rbegin(), b.max().first);
+}
+
+TEST(BTree, ShouldKeepShapeAfterBatchIntoEmptyTree) {
+    cbt::btree_stats stats;
+    cbt::btree<int, int> b;
+    b.set_stats(&stats);
+
+    std::vector<std::pair<int, int> > batch;
+
+    for (int i = 0; i < 7; i++)
+        batch.push_back(std::make_pair(i, i));
+
+    b.insert_batch(batch.begin(), batch.end());
+
+    // order 1: one by one, they would need 3 levels and 7 nodes
+    EXPECT_EQ(7u, b.size());
+    EXPECT_EQ(7u, stats.entries());
+    EXPECT_EQ(2u, stats.height());
+    EXPECT_EQ(3u, stats.nodes(0));
+    EXPECT_EQ(1u, stats.nodes(1));
+    EXPECT_EQ(7u, stats.ops(cbt::btree_stats::INSERT));
+}
+
+// string keys of this test keep fingerprints in their leaves
+namespace cbt {
+    template<>
+        struct key_fingerprint<std::string> : string_fingerprint { };
+}
+
+class StringBTree : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            srand(11);
+
+            for (int i = 0; i < 3000; i++) {
+                std::string key = Key(rand() % 6000);
+
+                if (map_.insert(std::make_pair(key, i)).second)
+                    btree_.insert(key, i);
+            }
+        }
+
+        static std::string Key(const int& n) {
+            std::string key("key/");
+
+            for (int i = n; i > 0; i /= 10)
+                key += static_cast<char>('0' + i % 10);
+
+            return key;
+        }
+
+        std::map<std::string, int> map_;
+        cbt::btree<std::string, int, 3> btree_;
+};
+
+TEST_F(StringBTree, ShouldFindEveryKeyAndNoOther) {
+    for (int n = 0; n < 6000; n++) {
+        std::map<std::string, int>::iterator it_map = map_.find(Key(n));
+        cbt::btree<std::string, int, 3>::iterator it = btree_.find(Key(n));
+
+        if (it_map == map_.end()) {
+            EXPECT_EQ(btree_.end(), it);
+        } else {
+            ASSERT_NE(btree_.end(), it);
+            EXPECT_EQ(it_map->first, it->first);
+            EXPECT_EQ(it_map->second, it->second);
+        }
+    }
+}
+
+TEST_F(StringBTree, ShouldFindKeysAfterErasesAndClone) {
+    cbt::btree<std::string, int, 3> copy = btree_.clone();
+    std::map<std::string, int> before = map_;
+
+    for (int n = 0; n < 6000; n += 2) {
+        EXPECT_EQ(map_.erase(Key(n)), btree_.erase(Key(n)));
+        btree_.insert(Key(n) + "/x", n);
+        map_.insert(std::make_pair(Key(n) + "/x", n));
+    }
+
+    for (std::map<std::string, int>::iterator it = map_.begin();
+            it != map_.end(); ++it)
+        ASSERT_EQ(it->second, btree_.find(it->first)->second);
+
+    for (std::map<std::string, int>::iterator it = before.begin();
+            it != before.end(); ++it)
+        ASSERT_EQ(it->second, copy.find(it->first)->second);
+
+    EXPECT_EQ(copy.end(), copy.find(Key(2) + "/x"));
+}
+
+TEST_F(StringBTree, ShouldMatchMapBoundsForPartialKeys) {
+    for (int n = 0; n < 6000; n += 7) {
+        std::string probe = Key(n);
+        probe.resize(n % (probe.size() + 1));
+
+        std::map<std::string, int>::iterator it_map = map_.lower_bound(probe);
+        cbt::btree<std::string, int, 3>::iterator it = btree_.lower_bound(probe);
+        ASSERT_EQ(it_map == map_.end(), it == btree_.end());
+
+        if (it_map != map_.end()) {
+            EXPECT_EQ(it_map->first, it->first);
+        }
+
+        it_map = map_.upper_bound(probe + "~");
+        it = btree_.upper_bound(probe + "~");
+        ASSERT_EQ(it_map == map_.end(), it == btree_.end());
+
+        if (it_map != map_.end()) {
+            EXPECT_EQ(it_map->first, it->first);
+        }
+    }
+}
+
+struct CollidingKey {
+    CollidingKey(const int& n = 0) : n_(n) { }
+
+    bool operator<(const CollidingKey& other) const { return n_ < other.n_; }
+    bool operator>(const CollidingKey& other) const { return n_ > other.n_; }
+    bool operator==(const CollidingKey& other) const {
+        return n_ == other.n_;
+    }
+
+    int n_;
+};
+
+namespace cbt {
+    template<>
+        struct key_fingerprint<CollidingKey> {
+            static const bool ENABLED = true;
+
+            static uint8_t of(const CollidingKey& key) { return key.n_ % 2; }
+        };
+}
+
+TEST(BTree, ShouldTellCollidingFingerprintsApart) {
+    cbt::btree<CollidingKey, int, 20> b;
+
+    for (int n = 0; n < 1000; n += 3)
+        b.insert(n, n);
+
+    for (int n = 0; n < 1000; n++) {
+        if (n % 3 == 0)
+            EXPECT_EQ(n, b.find(n)->second);
+        else
+            EXPECT_EQ(b.end(), b.find(n));
+    }
+}
+
+struct PlainKey {
+    PlainKey(const int& n = 0) : n_(n) { }
+
+    bool operator<(const PlainKey& other) const { return n_ < other.n_; }
+
+    int n_;
+};
+
+TEST(BTree, ShouldKeepFingerprintsWithoutGrowingNodes) {
+    EXPECT_TRUE((cbt::_BTreeNode<CollidingKey, int, 20>::HAS_FINGERPRINTS));
+    EXPECT_FALSE((cbt::_BTreeNode<PlainKey, int, 20>::HAS_FINGERPRINTS));
+    EXPECT_EQ(sizeof(cbt::_BTreeNode<PlainKey, int, 20>),
+            sizeof(cbt::_BTreeNode<CollidingKey, int, 20>));
+    EXPECT_EQ(sizeof(cbt::_BTreeNode<PlainKey, int, 1>),
+            sizeof(cbt::_BTreeNode<CollidingKey, int, 1>));
+}
+
+TEST(BTree, ShouldRefuseToJoinOverlappingTrees) {
+    cbt::btree<int, int> left, right;
+    left.insert(5, 5);
+    right.insert(3, 3);
+
+    EXPECT_THROW(left.join(&right), std::invalid_argument);
+    EXPECT_THROW(right.split_at(4, &left), std::invalid_argument);
+}
+
 int main(int argc, char* argv[]) {
     ::google::InitGoogleLogging(argv[0]);
     ::testing::InitGoogleTest(&argc, argv);